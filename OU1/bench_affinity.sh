@@ -0,0 +1,34 @@
+#!/bin/bash
+# Compares the --affinity policies on pipelines that move a lot of data
+# through pipes. tp_chain is a chain of cat processes where every handoff
+# is a pipe, tp_gzip has one busy stage, tp_replica a replicated stage.
+# Every run is repeated and the best time is used.
+# usage: ./bench_affinity.sh [RUNS] [MB]
+
+RUNS=${1:-3}
+MB=${2:-512}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+TIMEFORMAT=%R
+
+yes "the quick brown fox jumps over the lazy dog 1234567890" | head -c "${MB}M" > "$DIR/big.txt"
+
+printf 'cat %s\ncat\ncat\ncat\nwc -c\n' "$DIR/big.txt" > "$DIR/tp_chain"
+printf 'cat %s\ngzip -1\nwc -c\n' "$DIR/big.txt" > "$DIR/tp_gzip"
+printf 'cat %s\n@4 grep -c lazy\nwc -l\n' "$DIR/big.txt" > "$DIR/tp_replica"
+
+echo "$(nproc) cpus, $MB MB (MB/s, best of $RUNS)"
+for spec in tp_chain tp_gzip tp_replica
+do
+    for policy in none compact cache spread
+    do
+        best=
+        for ((i = 0; i < RUNS; i++))
+        do
+            seconds=$( { time ./mexec --no-builtins --affinity=$policy "$DIR/$spec" > /dev/null ; } 2>&1 )
+            best=$(awk -v s="$seconds" -v b="$best" 'BEGIN { print (b == "" || s < b) ? s : b }')
+        done
+        printf '  %-11s %-8s %8.1f\n' "$spec" "$policy" "$(awk -v s="$best" -v mb="$MB" 'BEGIN { print mb / s }')"
+    done
+done
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Compares builtin stages with the real commands (--no-builtins).
+# Latency: a short pipeline on a small file, run many times.
+# Throughput: the same pipelines on a big generated file. tp_grep matches
+# every line, tp_miss matches none.
+# usage: ./bench_builtins.sh [RUNS] [MB]
+
+RUNS=${1:-200}
+MB=${2:-256}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+TIMEFORMAT=%R
+
+seq 1 20 > "$DIR/small.txt"
+yes "the quick brown fox jumps over the lazy dog 1234567890" | head -c "${MB}M" > "$DIR/big.txt"
+
+printf 'cat %s\nwc -l\n' "$DIR/small.txt" > "$DIR/lat_wc"
+printf 'cat %s\ngrep -F 1\nhead -n 5\n' "$DIR/small.txt" > "$DIR/lat_grep"
+printf 'cat %s\nwc -l\n' "$DIR/big.txt" > "$DIR/tp_wc"
+printf 'cat %s\ngrep -F -c lazy\n' "$DIR/big.txt" > "$DIR/tp_grep"
+printf 'cat %s\ngrep -F -c zebra\n' "$DIR/big.txt" > "$DIR/tp_miss"
+printf 'cat %s\ncat\nwc -c\n' "$DIR/big.txt" > "$DIR/tp_cat"
+
+echo "latency, $RUNS runs (ms per pipeline)"
+for spec in lat_wc lat_grep
+do
+    for mode in "" "--no-builtins"
+    do
+        seconds=$( { time for ((i = 0; i < RUNS; i++)); do ./mexec $mode "$DIR/$spec" > /dev/null; done ; } 2>&1 )
+        printf '  %-9s %-14s %8.3f\n' "$spec" "${mode:-builtins}" "$(awk -v s="$seconds" -v n="$RUNS" 'BEGIN { print s * 1000 / n }')"
+    done
+done
+
+echo "throughput, $MB MB (MB/s)"
+for spec in tp_wc tp_grep tp_miss tp_cat
+do
+    for mode in "" "--no-builtins"
+    do
+        seconds=$( { time ./mexec $mode "$DIR/$spec" > /dev/null ; } 2>&1 )
+        printf '  %-9s %-14s %8.1f\n' "$spec" "${mode:-builtins}" "$(awk -v s="$seconds" -v mb="$MB" 'BEGIN { print mb / s }')"
+    done
+done
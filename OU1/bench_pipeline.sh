@@ -0,0 +1,123 @@
+#!/bin/bash
+# Runs chains of 1 to 64 cat stages with ./mexec, with its builtins and
+# with /bin/sh and appends one CSV row per chain to track regressions:
+#   launch_ms    start of the run until the last stage is running
+#   teardown_ms  last stage done until the run has returned
+#   mb_per_s     the generated input through the whole chain
+# Launch and teardown use a chain of cat stages that ends in date, on empty
+# input, throughput one that reads the input. The median of the runs is used.
+# The input lines get lengths from DIST: fixed:N, uniform:MIN:MAX or exp:MEAN.
+# usage: ./bench_pipeline.sh [-r RUNS] [-s MB] [-l DIST] [-o CSV]
+
+RUNS=5
+MB=16
+DIST=uniform:1:120
+CSV=bench_pipeline.csv
+STAGES="1 2 4 8 16 32 64"
+
+while getopts "r:s:l:o:" flag
+do
+    case $flag in
+    r) RUNS=$OPTARG ;;
+    s) MB=$OPTARG ;;
+    l) DIST=$OPTARG ;;
+    o) CSV=$OPTARG ;;
+    *) echo "usage: $0 [-r RUNS] [-s MB] [-l DIST] [-o CSV]" >&2; exit 1 ;;
+    esac
+done
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# writes MB megabytes of lines with lengths from DIST to stdout.
+generate() {
+    awk -v bytes=$((MB * 1024 * 1024)) -v dist="$DIST" 'BEGIN {
+        n = split(dist, d, ":")
+        srand(1)
+        chars = "the quick brown fox jumps over the lazy dog 0123456789 "
+        while (length(chars) < 4096) chars = chars chars
+        while (bytes > 0) {
+            if (d[1] == "fixed") len = d[2]
+            else if (d[1] == "uniform") len = d[2] + int(rand() * (d[3] - d[2] + 1))
+            else if (d[1] == "exp") len = int(-d[2] * log(1 - rand()))
+            else { print "invalid DIST " dist > "/dev/stderr"; exit 1 }
+            if (len > 4096) len = 4096
+            if (len + 1 > bytes) len = bytes - 1
+            print substr(chars, 1 + int(rand() * 64), len)
+            bytes -= len + 1
+        }
+    }'
+}
+
+# writes a chain of N stages, one per line, that starts with FIRST and ends with LAST.
+chain() {
+    local n=$1 first=$2 last=$3
+
+    if [ "$n" -eq 1 ]
+    then
+        echo "$last"
+        return
+    fi
+    echo "$first"
+    for ((i = 2; i < n; i++))
+    do
+        echo cat
+    done
+    echo "$last"
+}
+
+# runs a spec file with IMPL, stdin from $2.
+run() {
+    case $IMPL in
+    mexec) ./mexec --no-builtins "$1" < "$2" ;;
+    builtins) ./mexec "$1" < "$2" ;;
+    sh) /bin/sh -c "$(paste -s -d '|' "$1")" < "$2" ;;
+    esac
+}
+
+# prints the median of a list of numbers, one per line.
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+generate > "$DIR/input.txt" || exit 1
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+DATE=$(date +%Y-%m-%dT%H:%M:%S)
+
+if [ ! -s "$CSV" ]
+then
+    echo "date,commit,impl,stages,mb,dist,launch_ms,teardown_ms,mb_per_s" > "$CSV"
+fi
+
+echo "$MB MB, lines $DIST, median of $RUNS runs"
+printf '  %-9s %6s %10s %12s %9s\n' impl stages launch_ms teardown_ms mb_per_s
+for IMPL in mexec builtins sh
+do
+    for n in $STAGES
+    do
+        chain "$n" cat 'date +%s.%N' > "$DIR/latency"
+        chain "$n" "cat $DIR/input.txt" 'wc -c' > "$DIR/throughput"
+
+        for ((r = 0; r < RUNS; r++))
+        do
+            start=$EPOCHREALTIME
+            ran=$(run "$DIR/latency" /dev/null)
+            end=$EPOCHREALTIME
+            awk -v s="$start" -v r="$ran" -v e="$end" 'BEGIN { printf "%.3f %.3f\n", (r - s) * 1000, (e - r) * 1000 }'
+        done > "$DIR/times"
+        launch=$(cut -d ' ' -f 1 "$DIR/times" | median)
+        teardown=$(cut -d ' ' -f 2 "$DIR/times" | median)
+
+        for ((r = 0; r < RUNS; r++))
+        do
+            start=$EPOCHREALTIME
+            run "$DIR/throughput" /dev/null > /dev/null
+            end=$EPOCHREALTIME
+            awk -v s="$start" -v e="$end" -v mb="$MB" 'BEGIN { printf "%.1f\n", mb / (e - s) }'
+        done > "$DIR/rates"
+        rate=$(median < "$DIR/rates")
+
+        printf '  %-9s %6s %10s %12s %9s\n' $IMPL "$n" "$launch" "$teardown" "$rate"
+        echo "$DATE,$COMMIT,$IMPL,$n,$MB,$DIST,$launch,$teardown,$rate" >> "$CSV"
+    done
+done
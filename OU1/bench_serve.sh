@@ -0,0 +1,47 @@
+#!/bin/bash
+# Compares the launch latency of a short pipeline run by ./mexec with the
+# same pipeline sent to a mexec --serve daemon by ./mexec_client. Every
+# launch is timed on its own and the p50 and p99 are printed.
+# usage: ./bench_serve.sh [RUNS]
+
+RUNS=${1:-1000}
+DIR=$(mktemp -d)
+SOCKET="$DIR/mexec.sock"
+
+./mexec --serve "$SOCKET" &
+DAEMON=$!
+trap 'kill $DAEMON; rm -rf "$DIR"' EXIT
+
+printf 'echo hello\ncat\n' > "$DIR/short"
+printf 'echo hello\ngrep -F hello\nwc -l\n' > "$DIR/three"
+
+while [ ! -S "$SOCKET" ]
+do
+    sleep 0.01
+done
+
+# prints "p50 p99" in ms of a list of times in seconds, one per line.
+percentiles() {
+    sort -n | awk '{ t[NR] = $1 } END { printf "%8.3f %8.3f\n", t[int(NR * 0.5)] * 1000, t[int(NR * 0.99)] * 1000 }'
+}
+
+echo "launch latency, $RUNS runs (ms)"
+printf '  %-7s %-8s %8s %8s\n' spec mode p50 p99
+for spec in short three
+do
+    for mode in direct serve
+    do
+        for ((i = 0; i < RUNS; i++))
+        do
+            start=$EPOCHREALTIME
+            if [ $mode = direct ]
+            then
+                ./mexec "$DIR/$spec" > /dev/null
+            else
+                ./mexec_client "$SOCKET" "$DIR/$spec" > /dev/null
+            fi
+            end=$EPOCHREALTIME
+            awk -v s="$start" -v e="$end" 'BEGIN { print e - s }'
+        done | percentiles | xargs printf '  %-7s %-8s %8s %8s\n' $spec $mode
+    done
+done
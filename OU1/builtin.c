@@ -0,0 +1,916 @@
+/**
+ * @file builtin.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of common commands that run as threads in mexec.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "builtin.h"
+
+//bytes read at a time.
+#define READ_SIZE (1 << 20)
+//bytes collected before the output is written.
+#define WRITE_SIZE (64 * 1024)
+
+// ===========INTERNAL DATA TYPES============
+
+typedef enum kind
+{
+    BUILTIN_CAT,
+    BUILTIN_HEAD,
+    BUILTIN_WC,
+    BUILTIN_GREP
+} kind;
+
+//the output of a builtin, written in large pieces.
+typedef struct writer
+{
+    int fd;
+    char *buffer;
+    size_t length;
+    //set when the reader is gone.
+    bool broken;
+    //set when a write failed for another reason.
+    bool failed;
+} writer;
+
+struct builtin
+{
+    kind kind;
+    const char *name;
+    //head: lines to print. wc: true for -l, false for -c.
+    long lines;
+    bool count_lines;
+    //grep.
+    const char *pattern;
+    size_t pattern_length;
+    bool invert;
+    bool count;
+    //files to read, none means stdin.
+    char **files;
+    int numb_of_files;
+    int dir_fd;
+    int in_fd;
+    int out_fd;
+    int done_fd;
+    pthread_t thread;
+    int exit_code;
+    //signal given to builtin_kill, 0 while the builtin may run.
+    atomic_int killed;
+    struct rusage usage;
+};
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that parses a count of lines for head.
+ *
+ * @param arg the argument
+ * @param lines set to the count
+ * @return true if the argument is a count head accepts
+ */
+static bool parse_lines(const char *arg, long *lines)
+{
+    char *rest;
+
+    if (*arg < '0' || *arg > '9')
+    {
+        return false;
+    }
+
+    errno = 0;
+    *lines = strtol(arg, &rest, 10);
+    return errno == 0 && *rest == '\0';
+}
+
+/**
+ * @brief Function that recognises a supported command and fills in the
+ *        flags of the builtin.
+ *
+ * @param argv the command
+ * @param b the builtin to fill in
+ * @return true if the command is one of the supported forms
+ */
+static bool parse(char **argv, builtin *b)
+{
+    char **arg = argv + 1;
+
+    memset(b, 0, sizeof(*b));
+    b->name = argv[0];
+
+    if (strcmp(argv[0], "cat") == 0)
+    {
+        b->kind = BUILTIN_CAT;
+        //"-" is stdin, every other flag is left to the real cat.
+        for (char **file = arg; *file != NULL; file++)
+        {
+            if ((*file)[0] == '-' && (*file)[1] != '\0')
+            {
+                return false;
+            }
+        }
+    }
+    else if (strcmp(argv[0], "head") == 0)
+    {
+        b->kind = BUILTIN_HEAD;
+        b->lines = 10;
+        if (*arg != NULL && strcmp(*arg, "-n") == 0)
+        {
+            if (arg[1] == NULL || !parse_lines(arg[1], &b->lines))
+            {
+                return false;
+            }
+            arg += 2;
+        }
+        else if (*arg != NULL && strncmp(*arg, "-n", 2) == 0)
+        {
+            if (!parse_lines(*arg + 2, &b->lines))
+            {
+                return false;
+            }
+            arg++;
+        }
+        else if (*arg != NULL && (*arg)[0] == '-' && (*arg)[1] != '\0')
+        {
+            if (!parse_lines(*arg + 1, &b->lines))
+            {
+                return false;
+            }
+            arg++;
+        }
+    }
+    else if (strcmp(argv[0], "wc") == 0)
+    {
+        b->kind = BUILTIN_WC;
+        if (*arg == NULL || (strcmp(*arg, "-l") != 0 && strcmp(*arg, "-c") != 0))
+        {
+            return false;
+        }
+        b->count_lines = (*arg)[1] == 'l';
+        arg++;
+    }
+    else if (strcmp(argv[0], "grep") == 0)
+    {
+        bool fixed = false;
+
+        b->kind = BUILTIN_GREP;
+        for (; *arg != NULL && (*arg)[0] == '-' && (*arg)[1] != '\0'; arg++)
+        {
+            for (const char *flag = *arg + 1; *flag != '\0'; flag++)
+            {
+                if (*flag == 'F')
+                {
+                    fixed = true;
+                }
+                else if (*flag == 'v')
+                {
+                    b->invert = true;
+                }
+                else if (*flag == 'c')
+                {
+                    b->count = true;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+        }
+        if (!fixed || *arg == NULL)
+        {
+            return false;
+        }
+        b->pattern = *arg++;
+        b->pattern_length = strlen(b->pattern);
+    }
+    else
+    {
+        return false;
+    }
+
+    b->files = arg;
+    while (arg[b->numb_of_files] != NULL)
+    {
+        b->numb_of_files++;
+    }
+
+    //only cat prints several files the same way as one.
+    return b->kind == BUILTIN_CAT || b->numb_of_files <= 1;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Function that counts newlines 32 bytes at a time with AVX2. The
+ *        compares are summed in byte lanes and folded into 64 bit lanes
+ *        every 255 rounds, before a byte lane can overflow.
+ *
+ * @param data the bytes
+ * @param length number of bytes
+ * @return number of newlines
+ */
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char *data, size_t length)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    size_t count = 0;
+
+    while (i + 32 <= length)
+    {
+        __m256i sums = _mm256_setzero_si256();
+
+        for (int round = 0; round < 255 && i + 32 <= length; round++, i += 32)
+        {
+            __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+            sums = _mm256_sub_epi8(sums, _mm256_cmpeq_epi8(bytes, newline));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(sums, _mm256_setzero_si256()));
+    }
+
+    count = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1)
+        + _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+
+    for (; i < length; i++)
+    {
+        count += data[i] == '\n';
+    }
+
+    return count;
+}
+
+/**
+ * @brief Function that counts newlines 16 bytes at a time with SSE2, which
+ *        every x86-64 cpu has.
+ *
+ * @param data the bytes
+ * @param length number of bytes
+ * @return number of newlines
+ */
+static size_t count_newlines_sse2(const char *data, size_t length)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    size_t count = 0;
+
+    while (i + 16 <= length)
+    {
+        __m128i sums = _mm_setzero_si128();
+
+        for (int round = 0; round < 255 && i + 16 <= length; round++, i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+            sums = _mm_sub_epi8(sums, _mm_cmpeq_epi8(bytes, newline));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(sums, _mm_setzero_si128()));
+    }
+
+    count = _mm_cvtsi128_si64(total) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+
+    for (; i < length; i++)
+    {
+        count += data[i] == '\n';
+    }
+
+    return count;
+}
+#endif
+
+/**
+ * @brief Function that counts the newlines in a buffer with the widest
+ *        vector instructions the cpu has.
+ *
+ * @param data the bytes
+ * @param length number of bytes
+ * @return number of newlines
+ */
+static size_t count_newlines(const char *data, size_t length)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return count_newlines_avx2(data, length);
+    }
+    return count_newlines_sse2(data, length);
+#else
+    size_t count = 0;
+
+    for (const char *end = data + length; (data = memchr(data, '\n', end - data)) != NULL; data++)
+    {
+        count++;
+    }
+
+    return count;
+#endif
+}
+
+/**
+ * @brief Function that writes all of a buffer to the output.
+ *
+ * @param w the output
+ * @param data the bytes
+ * @param length number of bytes
+ */
+static void write_all(writer *w, const char *data, size_t length)
+{
+    while (length > 0 && !w->broken && !w->failed)
+    {
+        ssize_t n = write(w->fd, data, length);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            w->broken = errno == EPIPE;
+            w->failed = errno != EPIPE;
+            return;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+/**
+ * @brief Function that writes the collected output.
+ *
+ * @param w the output
+ */
+static void flush(writer *w)
+{
+    write_all(w, w->buffer, w->length);
+    w->length = 0;
+}
+
+/**
+ * @brief Function that adds bytes to the output. Large pieces are written
+ *        at once instead of being copied.
+ *
+ * @param w the output
+ * @param data the bytes
+ * @param length number of bytes
+ */
+static void put(writer *w, const char *data, size_t length)
+{
+    if (w->length + length > WRITE_SIZE)
+    {
+        flush(w);
+    }
+    if (length >= WRITE_SIZE)
+    {
+        write_all(w, data, length);
+        return;
+    }
+
+    memcpy(w->buffer + w->length, data, length);
+    w->length += length;
+}
+
+/**
+ * @brief Function that reads from an fd and retries when interrupted. A
+ *        builtin that is killed reads no more, as if the input had ended.
+ *
+ * @param b the builtin
+ * @param fd fd to read from
+ * @param buffer where to put the bytes
+ * @param size room in the buffer
+ * @return bytes read, 0 at the end, -1 on error
+ */
+static ssize_t read_some(const builtin *b, int fd, char *buffer, size_t size)
+{
+    ssize_t n;
+
+    if (b->killed != 0)
+    {
+        return 0;
+    }
+
+    while ((n = read(fd, buffer, size)) < 0 && errno == EINTR)
+    {
+        continue;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Function that copies an fd to the output, with splice when one of
+ *        them is a pipe and sendfile when the input is a file, so the bytes
+ *        are not copied through mexec.
+ *
+ * @param b the builtin
+ * @param w the output
+ * @param fd fd to copy
+ * @param buffer buffer of READ_SIZE bytes for when splice can not be used
+ * @return 0 on success, -1 on a read error
+ */
+static int cat_fd(builtin *b, writer *w, int fd, char *buffer)
+{
+    ssize_t n;
+
+    flush(w);
+    while (b->killed == 0 && (n = splice(fd, NULL, w->fd, NULL, READ_SIZE, SPLICE_F_MOVE)) != 0)
+    {
+        if (n > 0 || errno == EINTR)
+        {
+            continue;
+        }
+        if (errno == EPIPE)
+        {
+            w->broken = true;
+            return 0;
+        }
+        if (errno != EINVAL)
+        {
+            return -1;
+        }
+
+        //neither fd is a pipe, like "cat < in > out".
+        while (b->killed == 0 && (n = sendfile(w->fd, fd, NULL, READ_SIZE)) > 0)
+        {
+            continue;
+        }
+        if (b->killed != 0)
+        {
+            return 0;
+        }
+        if (n == 0 || (errno != EINVAL && errno != ENOSYS))
+        {
+            w->broken = n < 0 && errno == EPIPE;
+            w->failed = n < 0 && errno != EPIPE;
+            return 0;
+        }
+        while ((n = read_some(b, fd, buffer, READ_SIZE)) > 0 && !w->broken && !w->failed)
+        {
+            write_all(w, buffer, n);
+        }
+        return n < 0 ? -1 : 0;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that copies the first lines of an fd to the output.
+ *
+ * @param b the builtin
+ * @param w the output
+ * @param fd fd to read
+ * @param buffer buffer of READ_SIZE bytes
+ * @return 0 on success, -1 on a read error
+ */
+static int head_fd(builtin *b, writer *w, int fd, char *buffer)
+{
+    long left = b->lines;
+    ssize_t n;
+
+    while (left > 0 && (n = read_some(b, fd, buffer, READ_SIZE)) > 0)
+    {
+        const char *end = buffer;
+
+        while (left > 0 && (end = memchr(end, '\n', buffer + n - end)) != NULL)
+        {
+            end++;
+            left--;
+        }
+
+        put(w, buffer, end != NULL ? end - buffer : n);
+        if (w->broken)
+        {
+            return 0;
+        }
+    }
+
+    return left > 0 && n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Function that counts the lines or bytes of an fd.
+ *
+ * @param b the builtin
+ * @param fd fd to read
+ * @param buffer buffer of READ_SIZE bytes
+ * @param total set to the count
+ * @return 0 on success, -1 on a read error
+ */
+static int wc_fd(builtin *b, int fd, char *buffer, unsigned long long *total)
+{
+    struct stat st;
+    ssize_t n;
+
+    *total = 0;
+
+    //the size of a file is known without reading it.
+    if (!b->count_lines && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+
+        *total = offset >= 0 && offset < st.st_size ? st.st_size - offset : 0;
+        return 0;
+    }
+
+    while ((n = read_some(b, fd, buffer, READ_SIZE)) > 0)
+    {
+        *total += b->count_lines ? count_newlines(buffer, n) : (size_t)n;
+    }
+
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Function that finds the first place where the pattern is in a
+ *        buffer. memchr finds where the first byte of the pattern is and
+ *        memcmp checks the rest.
+ *
+ * @param b the builtin
+ * @param start start of the buffer
+ * @param end end of the buffer
+ * @return the first match, or NULL
+ */
+static const char *find(const builtin *b, const char *start, const char *end)
+{
+    if (b->pattern_length == 0)
+    {
+        return start;
+    }
+
+    const char *last = end - b->pattern_length;
+
+    while (start <= last && (start = memchr(start, b->pattern[0], last - start + 1)) != NULL)
+    {
+        if (memcmp(start + 1, b->pattern + 1, b->pattern_length - 1) == 0)
+        {
+            return start;
+        }
+        start++;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Function that runs grep on whole lines. The pattern is searched
+ *        for in the whole buffer, not line by line, so the lines between two
+ *        matches are never looked at one by one.
+ *
+ * @param b the builtin
+ * @param w the output
+ * @param start the first line
+ * @param end the end of the last line, just after its newline
+ * @param selected increased by the number of selected lines
+ */
+static void grep_lines(const builtin *b, writer *w, const char *start, const char *end, unsigned long long *selected)
+{
+    //matching lines that follow each other are written as one piece.
+    const char *run = start;
+    const char *run_end = start;
+
+    while (start < end)
+    {
+        const char *match = find(b, start, end);
+        const char *line = end;
+        const char *next = end;
+
+        if (match != NULL)
+        {
+            //counting matches does not need to know where the line starts.
+            const char *newline = b->count && !b->invert ? NULL : memrchr(start, '\n', match - start);
+
+            line = newline != NULL ? newline + 1 : start;
+            next = (const char *)memchr(match, '\n', end - match) + 1;
+        }
+
+        //the lines before the matching line do not match.
+        if (b->invert && line > start)
+        {
+            if (b->count)
+            {
+                *selected += count_newlines(start, line - start);
+            }
+            else
+            {
+                put(w, start, line - start);
+                (*selected)++;
+            }
+        }
+
+        if (!b->invert && match != NULL)
+        {
+            if (!b->count && line != run_end)
+            {
+                put(w, run, run_end - run);
+                run = line;
+            }
+            run_end = next;
+            (*selected)++;
+        }
+
+        start = next;
+    }
+
+    if (!b->count && !b->invert)
+    {
+        put(w, run, run_end - run);
+    }
+}
+
+/**
+ * @brief Function that runs grep on an fd. The buffer is grown if one line
+ *        does not fit, and a last line without newline gets one.
+ *
+ * @param b the builtin
+ * @param w the output
+ * @param fd fd to read
+ * @param selected increased by the number of selected lines
+ * @return 0 on success, -1 on a read error
+ */
+static int grep_fd(const builtin *b, writer *w, int fd, unsigned long long *selected)
+{
+    size_t capacity = READ_SIZE;
+    size_t used = 0;
+    char *buffer = malloc(capacity + 1);
+    ssize_t n;
+
+    if (buffer == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!w->broken && (n = read_some(b, fd, buffer + used, capacity - used)) > 0)
+    {
+        char *newline = memrchr(buffer + used, '\n', n);
+
+        used += n;
+        if (newline != NULL)
+        {
+            size_t whole = newline - buffer + 1;
+
+            grep_lines(b, w, buffer, buffer + whole, selected);
+            memmove(buffer, buffer + whole, used - whole);
+            used -= whole;
+        }
+        else if (used == capacity)
+        {
+            capacity *= 2;
+            if ((buffer = realloc(buffer, capacity + 1)) == NULL)
+            {
+                perror("Failed to allocate");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (used > 0 && n == 0)
+    {
+        buffer[used++] = '\n';
+        grep_lines(b, w, buffer, buffer + used, selected);
+    }
+
+    free(buffer);
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Function that runs in the thread of a builtin. It runs the command
+ *        on stdin or on every file and sets the exit code the real command
+ *        would have.
+ *
+ * @param ptr the builtin
+ * @return NULL
+ */
+static void *builtin_worker(void *ptr)
+{
+    builtin *b = ptr;
+    writer w = {b->out_fd, malloc(WRITE_SIZE), 0, false, false};
+    char *buffer = b->kind == BUILTIN_GREP ? NULL : malloc(READ_SIZE);
+    int numb_of_inputs = b->numb_of_files > 0 ? b->numb_of_files : 1;
+    unsigned long long selected = 0;
+    sigset_t set;
+
+    if (w.buffer == NULL || (b->kind != BUILTIN_GREP && buffer == NULL))
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+
+    //a reader that is gone gives EPIPE here instead of killing mexec.
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (int i = 0; i < numb_of_inputs && !w.broken && !w.failed; i++)
+    {
+        const char *file = b->numb_of_files > 0 ? b->files[i] : "-";
+        int fd = strcmp(file, "-") == 0 ? b->in_fd : openat(b->dir_fd, file, O_RDONLY | O_CLOEXEC);
+        unsigned long long total = 0;
+        int result = 0;
+
+        //the messages are the ones of the GNU tools.
+        if (fd == -1 && b->kind == BUILTIN_HEAD)
+        {
+            fprintf(stderr, "head: cannot open '%s' for reading: %s\n", file, strerror(errno));
+            b->exit_code = 1;
+            continue;
+        }
+        if (fd == -1)
+        {
+            fprintf(stderr, "%s: %s: %s\n", b->name, file, strerror(errno));
+            b->exit_code = b->kind == BUILTIN_GREP ? 2 : 1;
+            continue;
+        }
+
+        switch (b->kind)
+        {
+        case BUILTIN_CAT:
+            result = cat_fd(b, &w, fd, buffer);
+            break;
+        case BUILTIN_HEAD:
+            result = head_fd(b, &w, fd, buffer);
+            break;
+        case BUILTIN_WC:
+            if ((result = wc_fd(b, fd, buffer, &total)) == 0)
+            {
+                char line[64 + PATH_MAX];
+                int length = b->numb_of_files > 0 ? snprintf(line, sizeof(line), "%llu %s\n", total, file)
+                    : snprintf(line, sizeof(line), "%llu\n", total);
+                put(&w, line, length < (int)sizeof(line) ? length : (int)sizeof(line) - 1);
+            }
+            break;
+        case BUILTIN_GREP:
+            result = grep_fd(b, &w, fd, &selected);
+            break;
+        }
+
+        if (result == -1)
+        {
+            fprintf(stderr, "%s: %s: %s\n", b->name, file, strerror(errno));
+            b->exit_code = b->kind == BUILTIN_GREP ? 2 : 1;
+        }
+        if (fd != b->in_fd)
+        {
+            close(fd);
+        }
+    }
+
+    //a killed builtin writes nothing more, like a process that got the signal.
+    w.broken = w.broken || b->killed != 0;
+
+    if (b->kind == BUILTIN_GREP)
+    {
+        if (b->count)
+        {
+            char line[32];
+            put(&w, line, snprintf(line, sizeof(line), "%llu\n", selected));
+        }
+        //grep exits with 1 when nothing was selected, unless an error came first.
+        if (b->exit_code == 0 && selected == 0)
+        {
+            b->exit_code = 1;
+        }
+    }
+
+    flush(&w);
+    if (w.failed)
+    {
+        fprintf(stderr, "%s: write error: %s\n", b->name, strerror(errno));
+        b->exit_code = b->kind == BUILTIN_GREP ? 2 : 1;
+    }
+    b->exit_code = w.broken ? -1 : b->exit_code;
+
+    getrusage(RUSAGE_THREAD, &b->usage);
+    free(w.buffer);
+    free(buffer);
+
+    //closing at once gives the next stage its EOF and the one before EPIPE.
+    close(b->in_fd);
+    close(b->out_fd);
+    eventfd_write(b->done_fd, 1);
+    return NULL;
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that checks if a command can be run as a builtin.
+ *
+ * @param argv the command
+ * @return true if it is one of the supported forms
+ */
+bool builtin_supported(char **argv)
+{
+    builtin b;
+
+    return parse(argv, &b);
+}
+
+/**
+ * @brief Function that starts a builtin in a thread. The builtin takes over
+ *        in_fd and out_fd and closes them when it is done.
+ *
+ * @param argv the command, builtin_supported must be true for it
+ * @param dir_fd directory relative file names are opened from, or AT_FDCWD
+ * @param in_fd fd to read stdin from
+ * @param out_fd fd to write stdout to
+ * @return builtin* that was started
+ */
+builtin *builtin_start(char **argv, int dir_fd, int in_fd, int out_fd)
+{
+    builtin *b = malloc(sizeof(*b));
+
+    if (b == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+
+    parse(argv, b);
+    atomic_init(&b->killed, 0);
+    b->dir_fd = dir_fd;
+    b->in_fd = in_fd;
+    b->out_fd = out_fd;
+
+    if ((b->done_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+    {
+        perror("Eventfd failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pthread_create(&b->thread, NULL, builtin_worker, b) != 0)
+    {
+        perror("Thread create failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    return b;
+}
+
+/**
+ * @brief Function that returns an fd that becomes readable when the
+ *        builtin is done.
+ *
+ * @param b the builtin
+ * @return the fd
+ */
+int builtin_done_fd(const builtin *b)
+{
+    return b->done_fd;
+}
+
+/**
+ * @brief Function that stops a builtin. It reads nothing more and ends as
+ *        if it had been killed by the signal, as soon as the read or write
+ *        it is in returns.
+ *
+ * @param b the builtin
+ * @param sig the signal to report in the wait status
+ */
+void builtin_kill(builtin *b, int sig)
+{
+    int none = 0;
+
+    atomic_compare_exchange_strong(&b->killed, &none, sig);
+}
+
+/**
+ * @brief Function that waits for a builtin and frees it.
+ *
+ * @param b the builtin
+ * @param usage set to the cpu time used by the thread
+ * @return wait status, as if the builtin had been a process
+ */
+int builtin_wait(builtin *b, struct rusage *usage)
+{
+    pthread_join(b->thread, NULL);
+
+    //a builtin whose reader is gone ends like a process killed by SIGPIPE.
+    int status = b->killed != 0 ? b->killed : b->exit_code == -1 ? SIGPIPE : b->exit_code << 8;
+
+    *usage = b->usage;
+    close(b->done_fd);
+    free(b);
+    return status;
+}
@@ -0,0 +1,76 @@
+#ifndef __BUILTIN_H
+#define __BUILTIN_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * A builtin is a common command that mexec runs as a thread instead of
+ * starting a process. Only these forms are builtins, anything else is
+ * started as the real command:
+ *
+ *	cat [FILE...]
+ *	head [-n N | -N] [FILE]
+ *	wc -l [FILE]  or  wc -c [FILE]
+ *	grep -F [-v] [-c] PATTERN [FILE]
+ *
+ * They print the same output and exit with the same status as the GNU
+ * tools. A builtin whose reader is gone ends as if killed by SIGPIPE.
+ */
+
+// Builtin type.
+typedef struct builtin builtin;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that checks if a command can be run as a builtin.
+ *
+ * @param argv the command
+ * @return true if it is one of the supported forms
+ */
+bool builtin_supported(char **argv);
+
+/**
+ * @brief Function that starts a builtin in a thread. The builtin takes over
+ *        in_fd and out_fd and closes them when it is done.
+ *
+ * @param argv the command, builtin_supported must be true for it
+ * @param dir_fd directory relative file names are opened from, or AT_FDCWD
+ * @param in_fd fd to read stdin from
+ * @param out_fd fd to write stdout to
+ * @return builtin* that was started
+ */
+builtin *builtin_start(char **argv, int dir_fd, int in_fd, int out_fd);
+
+/**
+ * @brief Function that returns an fd that becomes readable when the
+ *        builtin is done.
+ *
+ * @param b the builtin
+ * @return the fd
+ */
+int builtin_done_fd(const builtin *b);
+
+/**
+ * @brief Function that stops a builtin. It reads nothing more and ends as
+ *        if it had been killed by the signal, as soon as the read or write
+ *        it is in returns.
+ *
+ * @param b the builtin
+ * @param sig the signal to report in the wait status
+ */
+void builtin_kill(builtin *b, int sig);
+
+/**
+ * @brief Function that waits for a builtin and frees it.
+ *
+ * @param b the builtin
+ * @param usage set to the cpu time used by the thread
+ * @return wait status, as if the builtin had been a process
+ */
+int builtin_wait(builtin *b, struct rusage *usage);
+
+#endif
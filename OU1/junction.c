@@ -0,0 +1,521 @@
+/**
+ * @file junction.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of the threads that join pipes where a pipeline branches.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "junction.h"
+
+//bytes moved by one tee or splice call.
+#define TEE_CHUNK (1 << 20)
+//bytes read from one producer at a time when merging.
+#define READ_CHUNK (64 * 1024)
+//a line longer than this is written in pieces.
+#define MAX_LINE_BUFFER (1 << 20)
+
+// ===========INTERNAL DATA TYPES============
+
+struct junction
+{
+    //the one end on the single side.
+    int fd;
+    //the ends on the branching side, -1 when closed.
+    int *fds;
+    int count;
+    pthread_t thread;
+};
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that blocks SIGPIPE in the calling thread, so a closed
+ *        reader gives EPIPE instead of killing mexec.
+ */
+static void block_sigpipe(void)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+/**
+ * @brief Function that moves exactly length bytes from one pipe to another.
+ *
+ * @param in_fd pipe to move from
+ * @param out_fd fd to move to
+ * @param length number of bytes
+ * @return 0 on success, -1 on failure with errno set
+ */
+static int splice_all(int in_fd, int out_fd, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = splice(in_fd, NULL, out_fd, NULL, length, SPLICE_F_MOVE);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that gives one consumer the bytes that tee could not copy
+ *        to it. tee always copies from the start of the pipe, so the whole
+ *        chunk is copied to an empty scratch pipe, the part the consumer
+ *        already has is dropped and the rest is spliced to it.
+ *
+ * @param j the junction
+ * @param scratch the scratch pipe, created on first use
+ * @param devnull /dev/null, opened on first use
+ * @param out_fd the consumer
+ * @param done bytes the consumer already has
+ * @param length bytes in the chunk
+ * @return 0 on success, -1 if the consumer is gone
+ */
+static int tee_rest(junction *j, int scratch[2], int *devnull, int out_fd, size_t done, size_t length)
+{
+    if (scratch[0] == -1)
+    {
+        //at least as big as the input pipe so one tee copies all of it.
+        if (pipe2(scratch, O_CLOEXEC) == -1 || fcntl(scratch[1], F_SETPIPE_SZ, fcntl(j->fd, F_GETPIPE_SZ)) == -1)
+        {
+            perror("Tee failed!");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (*devnull == -1 && (*devnull = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1)
+    {
+        perror("/dev/null");
+        exit(EXIT_FAILURE);
+    }
+
+    ssize_t n;
+    while ((n = tee(j->fd, scratch[1], length, 0)) < 0 && errno == EINTR)
+    {
+        continue;
+    }
+    if (n != (ssize_t)length || splice_all(scratch[0], *devnull, done) == -1)
+    {
+        perror("Tee failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    if (splice_all(scratch[0], out_fd, length - done) == -1)
+    {
+        //empties the scratch pipe for the next consumer.
+        if (errno != EPIPE || splice_all(scratch[0], *devnull, length - done) == -1)
+        {
+            perror("Tee failed!");
+            exit(EXIT_FAILURE);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that copies one chunk to a consumer with tee, without
+ *        consuming it from the input.
+ *
+ * @param j the junction
+ * @param i index of the consumer
+ * @param length bytes in the chunk
+ * @param scratch the scratch pipe for tee_rest
+ * @param devnull /dev/null for tee_rest
+ * @return 0 on success, -1 if the consumer is gone
+ */
+static int tee_one(junction *j, int i, size_t length, int scratch[2], int *devnull)
+{
+    ssize_t n;
+
+    while ((n = tee(j->fd, j->fds[i], length, 0)) < 0 && errno == EINTR)
+    {
+        continue;
+    }
+
+    if (n < 0)
+    {
+        if (errno != EPIPE)
+        {
+            perror("Tee failed!");
+        }
+        return -1;
+    }
+
+    //the consumer's pipe had room for only a part of the chunk.
+    if ((size_t)n < length)
+    {
+        return tee_rest(j, scratch, devnull, j->fds[i], n, length);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that runs in the thread of a tee junction. The first
+ *        consumer decides how big a chunk is, every other consumer gets the
+ *        same chunk and then it is dropped from the input.
+ *
+ * @param ptr the junction
+ * @return NULL
+ */
+static void *tee_worker(void *ptr)
+{
+    junction *j = ptr;
+    int scratch[2] = {-1, -1};
+    int devnull = -1;
+    int live = j->count;
+
+    block_sigpipe();
+
+    while (live > 0)
+    {
+        ssize_t length = -1;
+
+        for (int i = 0; i < j->count; i++)
+        {
+            if (j->fds[i] == -1)
+            {
+                continue;
+            }
+
+            //the first tee waits for data and gives the size of the chunk.
+            if (length == -1)
+            {
+                while ((length = tee(j->fd, j->fds[i], TEE_CHUNK, 0)) < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (length == 0)
+                {
+                    break;
+                }
+                if (length > 0)
+                {
+                    continue;
+                }
+                if (errno != EPIPE)
+                {
+                    perror("Tee failed!");
+                }
+                length = -1;
+            }
+            else if (tee_one(j, i, length, scratch, &devnull) == 0)
+            {
+                continue;
+            }
+
+            close(j->fds[i]);
+            j->fds[i] = -1;
+            live--;
+        }
+
+        if (length <= 0)
+        {
+            //EOF, or every consumer is gone.
+            if (length == 0)
+            {
+                break;
+            }
+            continue;
+        }
+
+        //everyone has the chunk, now it is dropped from the input.
+        if (devnull == -1 && (devnull = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1)
+        {
+            perror("/dev/null");
+            exit(EXIT_FAILURE);
+        }
+        if (splice_all(j->fd, devnull, length) == -1)
+        {
+            perror("Splice failed!");
+            break;
+        }
+    }
+
+    //closing at once gives the consumers their EOF.
+    close(j->fd);
+    j->fd = -1;
+    for (int i = 0; i < j->count; i++)
+    {
+        if (j->fds[i] != -1)
+        {
+            close(j->fds[i]);
+            j->fds[i] = -1;
+        }
+    }
+
+    if (scratch[0] != -1)
+    {
+        close(scratch[0]);
+        close(scratch[1]);
+    }
+    if (devnull != -1)
+    {
+        close(devnull);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Function that writes all of a buffer to an fd.
+ *
+ * @param fd fd to write to
+ * @param buffer the data
+ * @param length length of the data
+ * @return 0 on success, -1 on failure
+ */
+static int write_all(int fd, const char *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, buffer, length);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        buffer += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that writes to the consumer of a merge junction.
+ *
+ * @param j the junction
+ * @param buffer the data
+ * @param length length of the data
+ * @return true if the consumer is gone or the write failed
+ */
+static bool merge_write(junction *j, const char *buffer, size_t length)
+{
+    if (write_all(j->fd, buffer, length) == -1)
+    {
+        if (errno != EPIPE)
+        {
+            perror("Write failed!");
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Function that runs in the thread of a merge junction. Every
+ *        producer has a buffer, only the whole lines in it are written and
+ *        the rest waits for more data or the end of the producer.
+ *
+ * @param ptr the junction
+ * @return NULL
+ */
+static void *merge_worker(void *ptr)
+{
+    junction *j = ptr;
+    struct pollfd *fds = calloc(j->count, sizeof(*fds));
+    char **buffers = calloc(j->count, sizeof(*buffers));
+    size_t *lengths = calloc(j->count, sizeof(*lengths));
+    int live = j->count;
+    bool failed = false;
+
+    if (fds == NULL || buffers == NULL || lengths == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+
+    block_sigpipe();
+
+    for (int i = 0; i < j->count; i++)
+    {
+        fds[i].fd = j->fds[i];
+        fds[i].events = POLLIN;
+        if ((buffers[i] = malloc(MAX_LINE_BUFFER + READ_CHUNK)) == NULL)
+        {
+            perror("Failed to allocate");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (live > 0 && !failed)
+    {
+        if (poll(fds, j->count, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Poll failed!");
+            break;
+        }
+
+        for (int i = 0; i < j->count && !failed; i++)
+        {
+            if (fds[i].fd == -1 || fds[i].revents == 0)
+            {
+                continue;
+            }
+
+            ssize_t n = read(fds[i].fd, buffers[i] + lengths[i], READ_CHUNK);
+
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            //the last line of a producer is written even without a newline.
+            if (n <= 0)
+            {
+                failed = merge_write(j, buffers[i], lengths[i]);
+                lengths[i] = 0;
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                j->fds[i] = -1;
+                live--;
+                continue;
+            }
+
+            char *newline = memrchr(buffers[i] + lengths[i], '\n', n);
+            lengths[i] += n;
+
+            size_t whole = newline != NULL ? (size_t)(newline - buffers[i]) + 1
+                : lengths[i] >= MAX_LINE_BUFFER ? lengths[i] : 0;
+
+            if (whole > 0)
+            {
+                failed = merge_write(j, buffers[i], whole);
+                memmove(buffers[i], buffers[i] + whole, lengths[i] - whole);
+                lengths[i] -= whole;
+            }
+        }
+    }
+
+    //a consumer that is gone closes every producer, they get EPIPE.
+    close(j->fd);
+    j->fd = -1;
+    for (int i = 0; i < j->count; i++)
+    {
+        if (j->fds[i] != -1)
+        {
+            close(j->fds[i]);
+            j->fds[i] = -1;
+        }
+        free(buffers[i]);
+    }
+
+    free(fds);
+    free(buffers);
+    free(lengths);
+    return NULL;
+}
+
+/**
+ * @brief Function that creates a junction and starts its thread.
+ *
+ * @param fd the end on the single side
+ * @param fds the ends on the branching side
+ * @param count number of fds
+ * @param worker the thread function
+ * @return junction* that was started
+ */
+static junction *junction_start(int fd, const int *fds, int count, void *(*worker)(void *))
+{
+    junction *j = malloc(sizeof(*j));
+
+    if (j == NULL || (j->fds = malloc(sizeof(*j->fds) * count)) == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+
+    j->fd = fd;
+    j->count = count;
+    memcpy(j->fds, fds, sizeof(*j->fds) * count);
+
+    if (pthread_create(&j->thread, NULL, worker, j) != 0)
+    {
+        perror("Thread create failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    return j;
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that starts a thread that copies in_fd to every fd in
+ *        out_fds. The junction takes over all the fds. A consumer that
+ *        exits is dropped, the others still get everything.
+ *
+ * @param in_fd read end of the pipe of the producer
+ * @param out_fds write ends of the pipes of the consumers
+ * @param count number of consumers
+ * @return junction* that was started
+ */
+junction *junction_tee(int in_fd, const int *out_fds, int count)
+{
+    return junction_start(in_fd, out_fds, count, tee_worker);
+}
+
+/**
+ * @brief Function that starts a thread that merges every fd in in_fds line
+ *        by line into out_fd. The junction takes over all the fds.
+ *
+ * @param in_fds read ends of the pipes of the producers
+ * @param count number of producers
+ * @param out_fd write end of the pipe of the consumer
+ * @return junction* that was started
+ */
+junction *junction_merge(const int *in_fds, int count, int out_fd)
+{
+    return junction_start(out_fd, in_fds, count, merge_worker);
+}
+
+/**
+ * @brief Function that waits for a junction to finish and frees it.
+ *
+ * @param j the junction
+ */
+void junction_join(junction *j)
+{
+    //the thread closes all the fds itself when it is done.
+    pthread_join(j->thread, NULL);
+    free(j->fds);
+    free(j);
+}
@@ -0,0 +1,48 @@
+#ifndef __JUNCTION_H
+#define __JUNCTION_H
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * A junction is a thread that joins pipes where a pipeline branches. A tee
+ * junction copies one pipe to several with tee(2), so the data stays in the
+ * kernel. A merge junction reads several pipes and writes whole lines to
+ * one, so lines from different producers are never mixed.
+ */
+
+// Junction type.
+typedef struct junction junction;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that starts a thread that copies in_fd to every fd in
+ *        out_fds. The junction takes over all the fds. A consumer that
+ *        exits is dropped, the others still get everything.
+ *
+ * @param in_fd read end of the pipe of the producer
+ * @param out_fds write ends of the pipes of the consumers
+ * @param count number of consumers
+ * @return junction* that was started
+ */
+junction *junction_tee(int in_fd, const int *out_fds, int count);
+
+/**
+ * @brief Function that starts a thread that merges every fd in in_fds line
+ *        by line into out_fd. The junction takes over all the fds.
+ *
+ * @param in_fds read ends of the pipes of the producers
+ * @param count number of producers
+ * @param out_fd write end of the pipe of the consumer
+ * @return junction* that was started
+ */
+junction *junction_merge(const int *in_fds, int count, int out_fd);
+
+/**
+ * @brief Function that waits for a junction to finish and frees it.
+ *
+ * @param j the junction
+ */
+void junction_join(junction *j);
+
+#endif
@@ -0,0 +1,483 @@
+/**
+ * @file memo.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of the memo of outputs of pure pipeline prefixes.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "memo.h"
+
+//bytes moved by one tee or splice call.
+#define MEMO_CHUNK (1 << 20)
+//bytes copied at a time when the output is not a pipe.
+#define MEMO_BUFFER (64 * 1024)
+
+//FNV-1a 128 bit offset basis and prime.
+#define FNV_OFFSET (((memo_key)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+#define FNV_PRIME (((memo_key)0x0000000001000000ULL << 64) | 0x000000000000013bULL)
+
+// ===========INTERNAL DATA TYPES============
+
+struct memo_recorder
+{
+    int in_fd;
+    int out_fd;
+    int file_fd;
+    //the name of the output in the memo and the name it is written under.
+    char path[PATH_MAX];
+    char temp[PATH_MAX];
+    //set when the whole output was copied, and when the file could not be written.
+    bool complete;
+    bool failed;
+    pthread_t thread;
+};
+
+//a file in the memo when it is made smaller.
+typedef struct entry
+{
+    char *name;
+    off_t size;
+    struct timespec used;
+} entry;
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that makes the name of an output from its key.
+ *
+ * @param dir the memo directory
+ * @param key the key
+ * @param path set to the name
+ * @return 0 on success, -1 if the name is too long
+ */
+static int key_path(const char *dir, memo_key key, char path[PATH_MAX])
+{
+    int n = snprintf(path, PATH_MAX, "%s/%016llx%016llx", dir,
+        (unsigned long long)(key >> 64), (unsigned long long)key);
+
+    return n < PATH_MAX ? 0 : -1;
+}
+
+/**
+ * @brief Function that makes a directory and the directories above it.
+ *
+ * @param dir the directory
+ * @return 0 on success, -1 on failure
+ */
+static int make_dirs(const char *dir)
+{
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s", dir) >= (int)sizeof(path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if (mkdir(path, 0777) == -1 && errno != EEXIST)
+        {
+            return -1;
+        }
+        *slash = '/';
+    }
+
+    return mkdir(path, 0777) == -1 && errno != EEXIST ? -1 : 0;
+}
+
+/**
+ * @brief Function that writes a whole buffer.
+ *
+ * @param fd where to write
+ * @param buffer the bytes
+ * @param length number of bytes
+ * @return 0 on success, -1 on failure
+ */
+static int write_all(int fd, const char *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, buffer, length);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        buffer += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that moves bytes that tee has already copied to the output
+ *        from the input pipe to the file. If the file can not be written the
+ *        rest of them are read and dropped, the output already has them.
+ *
+ * @param r the recorder
+ * @param length number of bytes
+ * @return 0 on success, -1 if the input could not be read
+ */
+static int save(memo_recorder *r, size_t length)
+{
+    char buffer[MEMO_BUFFER];
+
+    while (length > 0 && !r->failed)
+    {
+        ssize_t n = splice(r->in_fd, NULL, r->file_fd, NULL, length, SPLICE_F_MOVE);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            r->failed = true;
+            break;
+        }
+        length -= n;
+    }
+
+    while (length > 0)
+    {
+        ssize_t n = read(r->in_fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that runs in the recorder thread. When the output is a pipe
+ *        tee copies the bytes to it and splice moves the same bytes to the
+ *        file, so they are never copied to mexec. Else they are read and
+ *        written to both. A file that can not be written only stops the
+ *        recording, the output still gets every byte.
+ *
+ * @param ptr the recorder
+ * @return NULL
+ */
+static void *record(void *ptr)
+{
+    memo_recorder *r = ptr;
+    char buffer[MEMO_BUFFER];
+    bool to_pipe = true;
+    sigset_t set;
+    ssize_t n;
+
+    //a reader that exits gives EPIPE here instead of killing mexec.
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;)
+    {
+        if (to_pipe)
+        {
+            n = tee(r->in_fd, r->out_fd, MEMO_CHUNK, 0);
+            if (n < 0 && errno == EINVAL)
+            {
+                to_pipe = false;
+                continue;
+            }
+            if (n > 0 && save(r, n) == -1)
+            {
+                break;
+            }
+        }
+        else
+        {
+            n = read(r->in_fd, buffer, sizeof(buffer));
+            if (n > 0 && write_all(r->out_fd, buffer, n) == -1)
+            {
+                n = -1;
+            }
+            if (n > 0 && !r->failed && write_all(r->file_fd, buffer, n) == -1)
+            {
+                r->failed = true;
+            }
+        }
+
+        if (n == 0)
+        {
+            r->complete = true;
+            break;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            //EPIPE means the reader is gone, closing in_fd passes that on to the writer.
+            if (errno != EPIPE)
+            {
+                perror("Memo failed!");
+            }
+            break;
+        }
+    }
+
+    close(r->in_fd);
+    close(r->out_fd);
+    return NULL;
+}
+
+/**
+ * @brief Function that compares two files in the memo by when they were used.
+ *
+ * @param a the first entry
+ * @param b the second entry
+ * @return less than, equal to or greater than 0 if a was used before, at the
+ *         same time as or after b
+ */
+static int compare_used(const void *a, const void *b)
+{
+    const entry *x = a;
+    const entry *y = b;
+
+    if (x->used.tv_sec != y->used.tv_sec)
+    {
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    }
+    return (x->used.tv_nsec > y->used.tv_nsec) - (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+/**
+ * @brief Function that removes the files in the memo that were used longest
+ *        ago until the rest fit in its size.
+ *
+ * @param dir the memo directory
+ * @param capacity largest size of the memo in bytes
+ */
+static void evict(const char *dir, long long capacity)
+{
+    DIR *d = opendir(dir);
+    entry *entries = NULL;
+    size_t count = 0;
+    size_t size = 0;
+    long long total = 0;
+    struct dirent *ent;
+
+    if (d == NULL)
+    {
+        return;
+    }
+
+    while ((ent = readdir(d)) != NULL)
+    {
+        struct stat st;
+
+        if (fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if (count == size)
+        {
+            size = size == 0 ? 64 : size * 2;
+            if ((entries = realloc(entries, size * sizeof(*entries))) == NULL)
+            {
+                fprintf(stderr, "Memory allocation failed!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        entries[count++] = (entry){strdup(ent->d_name), st.st_size, st.st_mtim};
+        total += st.st_size;
+    }
+
+    if (total > capacity)
+    {
+        qsort(entries, count, sizeof(*entries), compare_used);
+        for (size_t i = 0; i < count && total > capacity; i++)
+        {
+            if (unlinkat(dirfd(d), entries[i].name, 0) == 0)
+            {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(entries[i].name);
+    }
+    free(entries);
+    closedir(d);
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that starts a key.
+ *
+ * @param key the key
+ */
+void memo_key_init(memo_key *key)
+{
+    *key = FNV_OFFSET;
+}
+
+/**
+ * @brief Function that adds bytes to a key.
+ *
+ * @param key the key
+ * @param data the bytes
+ * @param length number of bytes
+ */
+void memo_key_add(memo_key *key, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        *key ^= bytes[i];
+        *key *= FNV_PRIME;
+    }
+}
+
+/**
+ * @brief Function that adds the identity of a file to a key: where it is,
+ *        its size and when it was changed. A file that is changed gets
+ *        another key without being read.
+ *
+ * @param key the key
+ * @param st the status of the file
+ */
+void memo_key_add_file(memo_key *key, const struct stat *st)
+{
+    //the fields are copied so padding in struct stat is not hashed.
+    long long identity[7] = {st->st_dev, st->st_ino, st->st_size, st->st_mtim.tv_sec,
+        st->st_mtim.tv_nsec, st->st_ctim.tv_sec, st->st_ctim.tv_nsec};
+
+    memo_key_add(key, identity, sizeof(identity));
+}
+
+/**
+ * @brief Function that looks up a saved output and marks it as used.
+ *
+ * @param dir the memo directory
+ * @param key the key
+ * @return fd of the saved output, or -1 if there is none
+ */
+int memo_lookup(const char *dir, memo_key key)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    if (key_path(dir, key, path) == -1 || (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        return -1;
+    }
+
+    //the mtime is when the output was last used, the oldest is removed first.
+    futimens(fd, NULL);
+    return fd;
+}
+
+/**
+ * @brief Function that starts a thread that copies in_fd to out_fd and to a
+ *        new file in the memo. The recorder takes over both fds.
+ *
+ * @param dir the memo directory, made if it does not exist
+ * @param key the key of the output
+ * @param in_fd read end of the pipe of the last pure stage
+ * @param out_fd where the output goes on to
+ * @return memo_recorder* that was started, or NULL if no file could be made
+ *         and the fds were not taken over
+ */
+memo_recorder *memo_record(const char *dir, memo_key key, int in_fd, int out_fd)
+{
+    memo_recorder *r = calloc(1, sizeof(*r));
+
+    if (r == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (key_path(dir, key, r->path) == -1
+        || snprintf(r->temp, sizeof(r->temp), "%s/.tmp.XXXXXX", dir) >= (int)sizeof(r->temp))
+    {
+        fprintf(stderr, "mexec: memo directory name is too long\n");
+        free(r);
+        return NULL;
+    }
+
+    if (make_dirs(dir) == -1 || (r->file_fd = mkostemp(r->temp, O_CLOEXEC)) == -1)
+    {
+        perror(dir);
+        free(r);
+        return NULL;
+    }
+
+    r->in_fd = in_fd;
+    r->out_fd = out_fd;
+    if (pthread_create(&r->thread, NULL, record, r) != 0)
+    {
+        perror("Thread create failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    return r;
+}
+
+/**
+ * @brief Function that waits for a recorder and frees it. The output is
+ *        added to the memo if keep is set and all of it was copied, then
+ *        the oldest outputs are removed until the memo fits in its size.
+ *
+ * @param r the recorder
+ * @param keep true if every stage of the prefix succeeded
+ * @param capacity largest size of the memo in bytes
+ */
+void memo_finish(memo_recorder *r, bool keep, long long capacity)
+{
+    pthread_join(r->thread, NULL);
+    close(r->file_fd);
+
+    //the output is only seen under its name once all of it is written.
+    if (keep && r->complete && !r->failed && rename(r->temp, r->path) == 0)
+    {
+        char *slash = strrchr(r->path, '/');
+
+        *slash = '\0';
+        evict(r->path, capacity);
+    }
+    else
+    {
+        unlink(r->temp);
+    }
+
+    free(r);
+}
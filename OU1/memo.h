@@ -0,0 +1,87 @@
+#ifndef __MEMO_H
+#define __MEMO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * The memo is a directory of saved outputs of pipeline prefixes whose
+ * stages are pure, so the same input always gives the same output. Every
+ * output is a file named by the key: a hash of everything the output
+ * depends on. A recorder copies the output of a prefix to the next stage
+ * and to a new file that is only added to the memo if the prefix succeeds.
+ * Files that are used get a new mtime and the oldest ones are removed when
+ * the memo grows past its size.
+ */
+
+// Key type, a 128 bit FNV-1a hash.
+typedef unsigned __int128 memo_key;
+
+// Recorder type.
+typedef struct memo_recorder memo_recorder;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that starts a key.
+ *
+ * @param key the key
+ */
+void memo_key_init(memo_key *key);
+
+/**
+ * @brief Function that adds bytes to a key.
+ *
+ * @param key the key
+ * @param data the bytes
+ * @param length number of bytes
+ */
+void memo_key_add(memo_key *key, const void *data, size_t length);
+
+/**
+ * @brief Function that adds the identity of a file to a key: where it is,
+ *        its size and when it was changed. A file that is changed gets
+ *        another key without being read.
+ *
+ * @param key the key
+ * @param st the status of the file
+ */
+void memo_key_add_file(memo_key *key, const struct stat *st);
+
+/**
+ * @brief Function that looks up a saved output and marks it as used.
+ *
+ * @param dir the memo directory
+ * @param key the key
+ * @return fd of the saved output, or -1 if there is none
+ */
+int memo_lookup(const char *dir, memo_key key);
+
+/**
+ * @brief Function that starts a thread that copies in_fd to out_fd and to a
+ *        new file in the memo. The recorder takes over both fds.
+ *
+ * @param dir the memo directory, made if it does not exist
+ * @param key the key of the output
+ * @param in_fd read end of the pipe of the last pure stage
+ * @param out_fd where the output goes on to
+ * @return memo_recorder* that was started, or NULL if no file could be made
+ *         and the fds were not taken over
+ */
+memo_recorder *memo_record(const char *dir, memo_key key, int in_fd, int out_fd);
+
+/**
+ * @brief Function that waits for a recorder and frees it. The output is
+ *        added to the memo if keep is set and all of it was copied, then
+ *        the oldest outputs are removed until the memo fits in its size.
+ *
+ * @param r the recorder
+ * @param keep true if every stage of the prefix succeeded
+ * @param capacity largest size of the memo in bytes
+ */
+void memo_finish(memo_recorder *r, bool keep, long long capacity);
+
+#endif
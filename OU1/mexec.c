@@ -8,6 +8,7 @@
  * @copyright Copyright (c) 2021
  * 
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -16,347 +17,2932 @@
 #include <errno.h>
 #include <string.h>
 #include <dirent.h>
-#define MAX_LENGTH 1024
-#define MAX_LENGTH_WITH_TERMINATORS 1026
+#include <fcntl.h>
+#include <spawn.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <limits.h>
+#include <strings.h>
+
+#include "replicate.h"
+#include "junction.h"
+#include "builtin.h"
+#include "spec.h"
+#include "profile.h"
+#include "topology.h"
+#include "serve.h"
+#include "memo.h"
+//bytes moved by one splice call in metered mode.
+#define SPLICE_CHUNK (1 << 20)
+//line that separates the pipelines in batch mode unless --batch gives another.
+#define DEFAULT_DELIMITER "---"
+//largest size of the memo unless --memo-size gives another.
+#define DEFAULT_MEMO_SIZE (1LL << 30)
+#define USAGE "usage: ./mexec [--pipe-size BYTES] [--metered] [--stats[=table|json]] [--batch[=DELIM]] [-j N] [--ordered] [--no-builtins] [--fail-fast[=SIGNAL]] [--profile]\n" \
+    "       [--trace FILE] [--affinity=compact|cache|spread] [--memo-dir DIR] [--memo-size BYTES] [--serve SOCKET | FILE]\n" \
+    "stage syntax: [name:] [@N] [@pure] command [args] [< file] [> file | >> file] [<- producer ...]\n"
+
+extern char **environ;
+
+//one command in the pipeline.
+typedef struct stage
+{
+    char **argv;
+    //"name:" before the command, NULL if the stage has no name.
+    char *name;
+    //line number in the file.
+    int line;
+    //names after "<-", NULL if the stage reads from the line above.
+    char **inputs;
+    int numb_of_inputs;
+    //stages the input comes from, resolved from inputs.
+    int *producers;
+    int numb_of_producers;
+    //instances of a stage written as "@N command", 1 for a plain stage.
+    int replicas;
+    //"@pure command", the output only depends on the input and the arguments.
+    bool pure;
+    replica_set *set;
+    //set when the stage runs as a builtin thread.
+    builtin *builtin;
+    //watches the pipe the stage reads from with --profile, else NULL.
+    probe *probe;
+    //cpus the stage is started on with --affinity, if pinned is set.
+    cpu_set_t cpus;
+    bool pinned;
+    //place in the spread order of the first instance of a replicated stage.
+    int first_cpu;
+    //"< file" on a first stage and "> file" or ">> file" on a last stage.
+    char *input;
+    char *output;
+    bool append;
+    pid_t pid;
+    int pidfd;
+    int status;
+    //exec is when posix_spawn returned, the start of a thread stage.
+    struct timespec start;
+    struct timespec exec;
+    struct timespec end;
+    struct rusage usage;
+} stage;
+
+//a pipe between two stages that mexec moves the data through in metered mode.
+typedef struct boundary
+{
+    int in_fd;
+    int out_fd;
+    unsigned long long bytes;
+    //when the first byte came and when the relay ended, eof unless the reader was gone.
+    struct timespec first;
+    struct timespec last;
+    bool eof;
+    pthread_t thread;
+} boundary;
+
+//the whole pipeline, parsed once before anything is started.
+typedef struct pipeline
+{
+    stage *stages;
+    int numb_of_stages;
+    boundary *boundaries;
+    //true if any stage has a name or reads from named stages.
+    bool graph;
+    int *producer_pool;
+    junction **junctions;
+    int numb_of_junctions;
+    int index;
+    int line;
+    int numb_of_running;
+    int numb_of_relays;
+    int output_fd;
+    int exit_code;
+    //index of the stage that stopped the pipeline with --fail-fast, or -1.
+    int failed_stage;
+    //one probe per stage and the thread that samples them with --profile.
+    probe *probes;
+    monitor *monitor;
+    //saves the output of the first memo_prefix stages when they are pure.
+    memo_recorder *recorder;
+    int memo_prefix;
+    struct timespec start;
+    struct timespec end;
+} pipeline;
+
+//formats of the --stats report.
+typedef enum stats_format
+{
+    STATS_NONE,
+    STATS_TABLE,
+    STATS_JSON
+} stats_format;
+
+//policies of --affinity.
+typedef enum affinity_policy
+{
+    AFFINITY_NONE,
+    //every stage on its own cpu, next to the stages it shares pipes with.
+    AFFINITY_COMPACT,
+    //every pipeline on the cpus of one L3 cache, the kernel places the stages there.
+    AFFINITY_CACHE,
+    //every stage on its own cpu, as far from the others as possible.
+    AFFINITY_SPREAD
+} affinity_policy;
+
+//flags given on the command line.
+typedef struct options
+{
+    int pipe_size;
+    bool metered;
+    stats_format stats;
+    const char *batch_delimiter;
+    int jobs;
+    bool ordered;
+    bool builtins;
+    //signal that --fail-fast sends to the other stages, 0 without it.
+    int fail_signal;
+    bool profile;
+    affinity_policy affinity;
+    //read once when --affinity is used.
+    const topology *topology;
+    //stdin, stdout and stderr of the stages, -1 to inherit the ones of mexec.
+    int input_fd;
+    int output_fd;
+    int error_fd;
+    //working directory and environment of the stages, the ones of a --serve client or of mexec.
+    int dir_fd;
+    char **env;
+    //where the outputs of pure stages are saved, NULL without a home directory.
+    const char *memo_dir;
+    long long memo_size;
+    //Chrome trace events of every pipeline go here with --trace, times are from trace_start.
+    FILE *trace;
+    struct timespec trace_start;
+} options;
+
+//a connection to mexec --serve, handled by its own thread.
+typedef struct client
+{
+    int fd;
+    //index of the pipeline of the connection, so pipelines get their own cpus and trace rows.
+    int index;
+    const options *opts;
+} client;
+
+//long options.
+static const struct option long_options[] =
+{
+    {"pipe-size", required_argument, NULL, 'p'},
+    {"metered", no_argument, NULL, 'm'},
+    {"stats", optional_argument, NULL, 's'},
+    {"batch", optional_argument, NULL, 'b'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"ordered", no_argument, NULL, 'o'},
+    {"no-builtins", no_argument, NULL, 'n'},
+    {"fail-fast", optional_argument, NULL, 'f'},
+    {"profile", no_argument, NULL, 'P'},
+    {"affinity", required_argument, NULL, 'a'},
+    {"serve", required_argument, NULL, 'S'},
+    {"memo-dir", required_argument, NULL, 'M'},
+    {"memo-size", required_argument, NULL, 'Z'},
+    {"trace", required_argument, NULL, 'T'},
+    {NULL, 0, NULL, 0}
+};
 
 //decliration of functions.
-int number_of_commands(int argc, char *argv[], char *buffer, char **string_buffer);
-void command_list_func(char *string_buffer, char command_list[][MAX_LENGTH]);
-void tokenizing(char command_list[][MAX_LENGTH], int i,  char *command[]);
-void child_process(int pipes[][2], pid_t p[], int numb_of_commands, char **string_buffer, char *buffer, int i);
-int number_of_commands_counter(char *buffer, char **string_buffer, size_t size_of_string, FILE *file);
+pipeline *parse_pipeline(const spec *sp, int first, int numb_of_commands);
+pipeline **parse_batch(const spec *sp, const char *delimiter, int *count);
+void pipeline_del(pipeline *p);
+int spawn_stage(stage *s, int in_fd, int out_fd, const options *opts);
+int find_command(const char *command, const options *opts, char *path, size_t size);
+int parse_signal(const char *arg);
+int take_fds(int in_fd, int out_fd, int *in, int *out);
+int start_replicas(stage *s, int in_fd, int out_fd, const options *opts);
+int start_builtin(stage *s, int in_fd, int out_fd, const options *opts);
+int resolve_graph(pipeline *p);
+int parse_redirections(const spec *sp, stage *s, char **argv);
+int check_redirections(const pipeline *p);
+int open_redirections(const stage *s, int dir_fd, int *in_fd, int *out_fd);
+int start_pipeline(pipeline *p, const options *opts, int in_fd, int out_fd);
+int start_graph(pipeline *p, const options *opts, int in_fd, int out_fd);
+int start_stage(stage *s, int in_fd, int out_fd, const options *opts);
+void reap_stage(pipeline *p, stage *s, const options *opts);
+void fail_pipeline(pipeline *p, int index, const options *opts);
+int exit_status(const stage *s);
+int pipefail_status(const pipeline *p);
+void print_profile(const pipeline *p);
+void place_stages(pipeline *p, const options *opts);
+int serve(const char *path, const options *opts);
+void *serve_client(void *ptr);
+int receive_request(int sock, int fds[SERVE_NUMB_OF_FDS], char **text, size_t *length, char **env_text, char ***env);
+int receive_all(int sock, char *buffer, size_t length);
+char **split_environment(char *text, size_t length);
+void finish_pipeline(pipeline *p, const options *opts);
+void print_status(const pipeline *p);
+int open_output_buffer(void);
+void flush_output(int fd, int out_fd);
+int run_jobs(pipeline **pipelines, int count, const options *opts);
+int make_pipe(int pipe_fds[2], const options *opts);
+void *relay(void *ptr);
+long long parse_size(const char *arg, long long max);
+int parse_number(const char *arg, const char *what);
+int pure_prefix(const pipeline *p, const options *opts, int in_fd, memo_key *key);
+int directory_path(int dir_fd, char *path, size_t size);
+void start_recorder(pipeline *p, const options *opts, memo_key key, int *out_fd, bool last);
+void print_stats(const pipeline *p, const options *opts);
+void print_trace(const pipeline *p, const options *opts);
+void print_json_chars(FILE *f, const char *str);
+double elapsed_ms(const struct timespec *start, const struct timespec *end);
+
+/**
+ * @brief Main function that runs the pipeline program.
+ * 
+ * @param argc argument
+ * @param argv number of arguments
+ * @return Exit success if nothing went wrong. 
+ */
+int main(int argc, char *argv[])
+{   
+    options opts = {0, false, STATS_NONE, NULL, 1, false, true, 0, false, AFFINITY_NONE, NULL, -1, -1, -1, 
+        AT_FDCWD, environ, NULL, DEFAULT_MEMO_SIZE, NULL, {0, 0}};
+    char memo_dir[PATH_MAX];
+    topology cpus;
+    const char *socket_path = NULL;
+    int flag;
+
+    //loop to catch the flags.
+    while ((flag = getopt_long(argc, argv, "j:", long_options, NULL)) != -1)
+    {
+        switch (flag)
+        {
+        case 'p':
+            opts.pipe_size = parse_size(optarg, 1024 * 1024 * 1024);
+            break;
+        case 'm':
+            opts.metered = true;
+            break;
+        case 's':
+            if (optarg == NULL || strcmp(optarg, "table") == 0)
+            {
+                opts.stats = STATS_TABLE;
+            }
+            else if (strcmp(optarg, "json") == 0)
+            {
+                opts.stats = STATS_JSON;
+            }
+            else
+            {
+                fprintf(stderr, USAGE);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b':
+            opts.batch_delimiter = optarg != NULL ? optarg : DEFAULT_DELIMITER;
+            break;
+        case 'o':
+            opts.ordered = true;
+            break;
+        case 'n':
+            opts.builtins = false;
+            break;
+        case 'f':
+            opts.fail_signal = optarg != NULL ? parse_signal(optarg) : SIGTERM;
+            break;
+        case 'P':
+            opts.profile = true;
+            break;
+        case 'a':
+            if (strcmp(optarg, "compact") == 0)
+            {
+                opts.affinity = AFFINITY_COMPACT;
+            }
+            else if (strcmp(optarg, "cache") == 0)
+            {
+                opts.affinity = AFFINITY_CACHE;
+            }
+            else if (strcmp(optarg, "spread") == 0)
+            {
+                opts.affinity = AFFINITY_SPREAD;
+            }
+            else if (strcmp(optarg, "none") != 0)
+            {
+                fprintf(stderr, USAGE);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            socket_path = optarg;
+            break;
+        case 'M':
+            opts.memo_dir = optarg;
+            break;
+        case 'Z':
+            opts.memo_size = parse_size(optarg, LLONG_MAX);
+            break;
+        case 'T':
+            //first byte and eof are seen by the relays of metered mode.
+            if ((opts.trace = fopen(optarg, "w")) == NULL)
+            {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            opts.metered = true;
+            break;
+        case 'j':
+            opts.jobs = parse_number(optarg, "jobs");
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    //checks amount of arguments sent in. Maximum of one file, none for the daemon.
+    if (argc - optind > (socket_path != NULL ? 0 : 1) || (socket_path != NULL && opts.batch_delimiter != NULL))
+    {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.affinity != AFFINITY_NONE)
+    {
+        if (topology_read(&cpus) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+        opts.topology = &cpus;
+    }
+
+    //the memo is $MEXEC_MEMO, else in $XDG_CACHE_HOME or ~/.cache.
+    if (opts.memo_dir == NULL)
+    {
+        const char *env;
+
+        if ((env = getenv("MEXEC_MEMO")) != NULL && *env != '\0')
+        {
+            snprintf(memo_dir, sizeof(memo_dir), "%s", env);
+        }
+        else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env != '\0')
+        {
+            snprintf(memo_dir, sizeof(memo_dir), "%s/mexec", env);
+        }
+        else if ((env = getenv("HOME")) != NULL && *env != '\0')
+        {
+            snprintf(memo_dir, sizeof(memo_dir), "%s/.cache/mexec", env);
+        }
+        else
+        {
+            memo_dir[0] = '\0';
+        }
+        opts.memo_dir = memo_dir[0] != '\0' ? memo_dir : NULL;
+    }
+
+    //the trace is a JSON array, a daemon never closes it and the viewers allow that.
+    if (opts.trace != NULL)
+    {
+        fprintf(opts.trace, "[\n");
+        clock_gettime(CLOCK_MONOTONIC, &opts.trace_start);
+    }
+
+    if (socket_path != NULL)
+    {
+        return serve(socket_path, &opts);
+    }
+
+    //the file is read and split into words once.
+    spec sp;
+    if (spec_read(optind < argc ? argv[optind] : NULL, &sp) == -1)
+    {
+        return EXIT_FAILURE;
+    }
+    
+    //check if file is empty or not.
+    if (sp.numb_of_lines == 0)
+    {
+        fprintf(stderr, "File is empty\n");
+        spec_free(&sp);
+        return EXIT_FAILURE;
+    }
+
+    //parse every stage once, the children only get their argv.
+    int numb_of_pipelines = 1;
+    pipeline **pipelines;
+    if (opts.batch_delimiter != NULL)
+    {
+        pipelines = parse_batch(&sp, opts.batch_delimiter, &numb_of_pipelines);
+    }
+    else if ((pipelines = malloc(sizeof(*pipelines))) != NULL)
+    {
+        pipelines[0] = parse_pipeline(&sp, 0, sp.numb_of_lines);
+        if (pipelines[0] == NULL)
+        {
+            free(pipelines);
+            pipelines = NULL;
+        }
+    }
+    if (pipelines == NULL)
+    {
+        spec_free(&sp);
+        return EXIT_FAILURE;
+    }
+
+    int exit_code = run_jobs(pipelines, numb_of_pipelines, &opts);
+
+    //de-allocate memory and exit program.
+    for (int i = 0; i < numb_of_pipelines; i++)
+    {
+        pipeline_del(pipelines[i]);
+    }
+    free(pipelines);
+    spec_free(&sp);
+    if (opts.trace != NULL)
+    {
+        fprintf(opts.trace, "\n]\n");
+        fclose(opts.trace);
+    }
+    if (opts.topology != NULL)
+    {
+        topology_free(&cpus);
+    }
+    return exit_code;
+}
+
+/**
+ * @brief Function that makes a pipeline of some lines of the spec. The argv
+ *        of every stage points into the words of the spec, the stage syntax
+ *        is taken off the front and back of it.
+ * 
+ * @param sp the spec
+ * @param first index of the first line of the pipeline
+ * @param numb_of_commands the number of lines
+ * @return the pipeline, or NULL if a line is empty
+ */
+pipeline *parse_pipeline(const spec *sp, int first, int numb_of_commands)
+{
+    int first_line = sp->lines[first].number;
+
+    pipeline *p = calloc(1, sizeof(*p));
+    if (p == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    p->numb_of_stages = numb_of_commands;
+    p->index = 1;
+    p->line = first_line;
+    p->output_fd = -1;
+    p->failed_stage = -1;
+    p->stages = calloc(numb_of_commands, sizeof(*p->stages));
+    p->boundaries = calloc(numb_of_commands, sizeof(*p->boundaries));
+    if (p->stages == NULL || p->boundaries == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < numb_of_commands; i++)
+    {
+        stage *s = &p->stages[i];
+        char **argv = sp->lines[first + i].argv;
+        int line_number = sp->lines[first + i].number;
+
+        s->line = line_number;
+        s->replicas = 1;
+        s->pid = -1;
+        s->pidfd = -1;
+
+        size_t length = argv[0] != NULL ? strlen(argv[0]) : 0;
+
+        //"name: command" names the stage so later stages can read from it.
+        if (length > 1 && argv[0][length - 1] == ':')
+        {
+            argv[0][length - 1] = '\0';
+            s->name = *argv++;
+            p->graph = true;
+
+            for (int j = 0; j < i; j++)
+            {
+                if (p->stages[j].name != NULL && strcmp(p->stages[j].name, s->name) == 0)
+                {
+                    fprintf(stderr, "Stage %s on line %d is already defined\n", s->name, line_number);
+                    pipeline_del(p);
+                    return NULL;
+                }
+            }
+        }
+
+        //"command <- a b" reads from the stages a and b instead of the line above.
+        for (char **arg = argv; *arg != NULL; arg++)
+        {
+            if (strcmp(*arg, "<-") == 0 && !spec_quoted(sp, arg))
+            {
+                *arg = NULL;
+                s->inputs = arg + 1;
+                while (s->inputs[s->numb_of_inputs] != NULL)
+                {
+                    s->numb_of_inputs++;
+                }
+                p->graph = true;
+                break;
+            }
+        }
+
+        //"@N command" runs the command in N instances, "@pure command" may be memoized.
+        while (argv[0] != NULL && argv[0][0] == '@' && !spec_quoted(sp, argv))
+        {
+            char *rest;
+            long replicas = strtol(argv[0] + 1, &rest, 10);
+
+            if (strcmp(argv[0], "@pure") == 0)
+            {
+                s->pure = true;
+            }
+            else if (*rest != '\0' || replicas <= 0 || replicas > 1024)
+            {
+                fprintf(stderr, "Invalid replication %s on line %d\n", argv[0], line_number);
+                pipeline_del(p);
+                return NULL;
+            }
+            else
+            {
+                s->replicas = replicas;
+            }
+            argv++;
+        }
+        s->argv = argv;
+
+        if (parse_redirections(sp, s, argv) == -1)
+        {
+            pipeline_del(p);
+            return NULL;
+        }
+
+        if (s->argv[0] == NULL)
+        {
+            fprintf(stderr, "Empty command on line %d\n", line_number);
+            pipeline_del(p);
+            return NULL;
+        }
+    }
+
+    if ((p->graph && resolve_graph(p) == -1) || check_redirections(p) == -1)
+    {
+        pipeline_del(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+/**
+ * @brief Function that takes "< file", "> file" and ">> file" out of the
+ *        argv of a stage. The file name can also be written right after the
+ *        operator, like "<file". Quoted operators are normal arguments.
+ * 
+ * @param sp the spec
+ * @param s the stage
+ * @param argv the words of the stage, moved together in place
+ * @return 0 on success, -1 if an operator has no file name
+ */
+int parse_redirections(const spec *sp, stage *s, char **argv)
+{
+    char **out = argv;
+
+    for (char **arg = argv; *arg != NULL; arg++)
+    {
+        char *word = *arg;
+        bool is_input = word[0] == '<' && word[1] != '-';
+        bool is_output = word[0] == '>';
+
+        if ((!is_input && !is_output) || spec_quoted(sp, arg))
+        {
+            *out++ = word;
+            continue;
+        }
+
+        bool append = is_output && word[1] == '>';
+        char *file = word + 1 + append;
+
+        if (*file == '\0' && (file = *++arg) == NULL)
+        {
+            fprintf(stderr, "Missing file name after %s on line %d\n", word, s->line);
+            return -1;
+        }
+
+        if (is_input)
+        {
+            s->input = file;
+        }
+        else
+        {
+            s->output = file;
+            s->append = append;
+        }
+    }
+
+    *out = NULL;
+    return 0;
+}
+
+/**
+ * @brief Function that checks that only the first stage reads from a file
+ *        and only the last stage writes to one. In a pipeline with named
+ *        stages that is any stage without producers or without consumers.
+ * 
+ * @param p the pipeline
+ * @return 0 on success, -1 if a redirection is on a stage in the middle
+ */
+int check_redirections(const pipeline *p)
+{
+    for (int i = 0; i < p->numb_of_stages; i++)
+    {
+        const stage *s = &p->stages[i];
+        bool first = p->graph ? s->numb_of_producers == 0 : i == 0;
+        bool last = p->graph || i == p->numb_of_stages - 1;
+
+        //a stage in a graph is last if no stage below reads from it.
+        for (int j = i + 1; p->graph && j < p->numb_of_stages; j++)
+        {
+            for (int k = 0; k < p->stages[j].numb_of_producers; k++)
+            {
+                last = last && p->stages[j].producers[k] != i;
+            }
+        }
+
+        if (s->input != NULL && !first)
+        {
+            fprintf(stderr, "Stage on line %d reads from %s but is not a first stage\n", s->line, s->input);
+            return -1;
+        }
+        if (s->output != NULL && !last)
+        {
+            fprintf(stderr, "Stage on line %d writes to %s but is not a last stage\n", s->line, s->output);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that opens the files a stage is redirected to. The file
+ *        becomes the stdin or stdout of the stage itself, so no stage and no
+ *        copy is needed to move the bytes between the file and a pipe.
+ * 
+ * @param s the stage
+ * @param dir_fd directory relative paths are opened from
+ * @param in_fd stdin of the stage, replaced by the input file
+ * @param out_fd stdout of the stage, replaced by the output file
+ * @return 0 on success, -1 if a file could not be opened
+ */
+int open_redirections(const stage *s, int dir_fd, int *in_fd, int *out_fd)
+{
+    int in = -1;
+    int out = -1;
+
+    if (s->input != NULL && (in = openat(dir_fd, s->input, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        perror(s->input);
+        return -1;
+    }
+
+    if (s->output != NULL 
+        && (out = openat(dir_fd, s->output, O_WRONLY | O_CREAT | O_CLOEXEC | (s->append ? O_APPEND : O_TRUNC), 0666)) == -1)
+    {
+        perror(s->output);
+        if (in != -1)
+        {
+            close(in);
+        }
+        return -1;
+    }
+
+    if (in != -1)
+    {
+        *in_fd = in;
+    }
+    if (out != -1)
+    {
+        *out_fd = out;
+    }
+    return 0;
+}
+
+/**
+ * @brief Function that finds the producers of every stage. A stage can only
+ *        read from stages above it, so the graph has no cycles and the
+ *        stages are already in an order where producers come first.
+ * 
+ * @param p the pipeline
+ * @return 0 on success, -1 if a stage reads from a stage that is not above it
+ */
+int resolve_graph(pipeline *p)
+{
+    int numb_of_edges = 0;
+
+    for (int i = 0; i < p->numb_of_stages; i++)
+    {
+        numb_of_edges += p->stages[i].inputs != NULL ? p->stages[i].numb_of_inputs : 1;
+    }
+
+    p->producer_pool = malloc(sizeof(*p->producer_pool) * numb_of_edges);
+    if (p->producer_pool == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int *next = p->producer_pool;
+    for (int i = 0; i < p->numb_of_stages; i++)
+    {
+        stage *s = &p->stages[i];
+
+        s->producers = next;
+        s->numb_of_producers = 0;
+
+        //without "<-" a stage reads from the line above, like a plain pipeline.
+        if (s->inputs == NULL)
+        {
+            if (i > 0)
+            {
+                s->producers[s->numb_of_producers++] = i - 1;
+            }
+        }
+
+        for (int k = 0; k < s->numb_of_inputs; k++)
+        {
+            int j = 0;
+
+            while (j < i && (p->stages[j].name == NULL || strcmp(p->stages[j].name, s->inputs[k]) != 0))
+            {
+                j++;
+            }
+            if (j == i)
+            {
+                fprintf(stderr, "Stage on line %d reads from %s, which is not defined above it\n", 
+                    s->line, s->inputs[k]);
+                return -1;
+            }
+            s->producers[s->numb_of_producers++] = j;
+        }
+
+        next += s->numb_of_producers;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that splits the spec into pipelines at every line that
+ *        is only the delimiter and parses each of them. Runs of delimiters
+ *        give no empty pipelines.
+ * 
+ * @param sp the spec
+ * @param delimiter the line between two pipelines
+ * @param count set to the number of pipelines
+ * @return the pipelines, or NULL if a line is empty or there are none
+ */
+pipeline **parse_batch(const spec *sp, const char *delimiter, int *count)
+{
+    size_t capacity = 16;
+    pipeline **pipelines = malloc(sizeof(*pipelines) * capacity);
+    int segment = 0;
+
+    if (pipelines == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    *count = 0;
+
+    for (int i = 0; i <= sp->numb_of_lines; i++)
+    {
+        char **argv = i < sp->numb_of_lines ? sp->lines[i].argv : NULL;
+        bool is_delimiter = argv != NULL && argv[0] != NULL && argv[1] == NULL && strcmp(argv[0], delimiter) == 0;
+
+        if (i < sp->numb_of_lines && !is_delimiter)
+        {
+            continue;
+        }
+
+        if (i > segment)
+        {
+            if ((size_t)*count == capacity)
+            {
+                capacity *= 2;
+                pipelines = realloc(pipelines, sizeof(*pipelines) * capacity);
+                if (pipelines == NULL)
+                {
+                    fprintf(stderr, "Memory allocation failed!\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            pipeline *p = parse_pipeline(sp, segment, i - segment);
+            if (p == NULL)
+            {
+                while (*count > 0)
+                {
+                    pipeline_del(pipelines[--(*count)]);
+                }
+                free(pipelines);
+                return NULL;
+            }
+            p->index = *count + 1;
+            pipelines[(*count)++] = p;
+        }
+        segment = i + 1;
+    }
+
+    if (*count == 0)
+    {
+        fprintf(stderr, "File is empty\n");
+        free(pipelines);
+        return NULL;
+    }
+
+    return pipelines;
+}
+
+/**
+ * @brief Function that frees a pipeline. The words belong to the spec.
+ * 
+ * @param p pipeline to free
+ */
+void pipeline_del(pipeline *p)
+{
+    free(p->probes);
+    free(p->producer_pool);
+    free(p->boundaries);
+    free(p->stages);
+    free(p);
+}
+
+/**
+ * @brief Function that starts one stage with its stdin and stdout connected
+ *        to the given pipe ends. posix_spawn lets the C library use its
+ *        vfork based fast path, so the parent is never copied.
+ * 
+ * @param s stage to start
+ * @param in_fd fd to use as stdin, or -1 to inherit
+ * @param out_fd fd to use as stdout, or -1 to inherit
+ * @param opts the flags, with the stderr, directory and environment of the stage
+ * @return 0 on success, -1 if the command could not be started
+ */
+int spawn_stage(stage *s, int in_fd, int out_fd, const options *opts)
+{
+    int err_fd = opts->error_fd;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+
+    //the daemon blocks SIGPIPE, the stage must not inherit that.
+    sigemptyset(&none);
+    if (posix_spawn_file_actions_init(&actions) != 0 || posix_spawnattr_init(&attr) != 0
+        || posix_spawnattr_setsigmask(&attr, &none) != 0 || posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK) != 0)
+    {
+        perror("Spawn failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    //the pipes are close-on-exec, dup2 clears the flag on stdin and stdout.
+    if ((in_fd != -1 && posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO) != 0)
+        || (out_fd != -1 && posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO) != 0)
+        || (err_fd != -1 && posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO) != 0))
+    {
+        perror("Dup failed!");
+        exit(EXIT_FAILURE);
+    }
+    if (opts->dir_fd != AT_FDCWD && posix_spawn_file_actions_addfchdir_np(&actions, opts->dir_fd) != 0)
+    {
+        perror("Spawn failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    char path[PATH_MAX];
+
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+    int error = find_command(s->argv[0], opts, path, sizeof(path));
+    if (error == 0)
+    {
+        error = posix_spawn(&s->pid, path, &actions, &attr, s->argv, opts->env);
+    }
+    //posix_spawn returns when the child has called exec.
+    clock_gettime(CLOCK_MONOTONIC, &s->exec);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    //check if exec returned any errors, the status is the one the shell gives.
+    if (error != 0)
+    {
+        fprintf(stderr, "%s: %s\n", s->argv[0], strerror(error));
+        s->status = (error == ENOENT ? 127 : 126) << 8;
+        s->pid = -1;
+        s->pidfd = -1;
+        return -1;
+    }
+
+    //the pidfd becomes readable when the stage exits, so it can be polled.
+    s->pidfd = syscall(SYS_pidfd_open, s->pid, 0);
+    if (s->pidfd == -1)
+    {
+        perror("pidfd_open failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that looks up a command like posix_spawnp, but in the PATH
+ *        of the environment of the stage instead of the one of mexec, so a
+ *        client of --serve gets the programs its shell would run. Relative
+ *        entries are taken from the directory of the stage.
+ * 
+ * @param command argv[0] of the stage
+ * @param opts the flags, with the directory and environment of the stage
+ * @param path set to the program to run
+ * @param size size of path
+ * @return 0 on success, or the errno posix_spawnp would have given
+ */
+int find_command(const char *command, const options *opts, char *path, size_t size)
+{
+    const char *search = "/bin:/usr/bin";
+    struct stat st;
+    int error = ENOENT;
+
+    if (*command == '\0')
+    {
+        return ENOENT;
+    }
+
+    //a command with a slash is not looked up.
+    if (strchr(command, '/') != NULL)
+    {
+        return snprintf(path, size, "%s", command) < (int)size ? 0 : ENAMETOOLONG;
+    }
+
+    for (char **variable = opts->env; *variable != NULL; variable++)
+    {
+        if (strncmp(*variable, "PATH=", 5) == 0)
+        {
+            search = *variable + 5;
+        }
+    }
+
+    //an empty entry is the directory of the stage, like in the shell.
+    for (;;)
+    {
+        const char *end = strchrnul(search, ':');
+        int length = end != search ? snprintf(path, size, "%.*s/%s", (int)(end - search), search, command)
+            : snprintf(path, size, "./%s", command);
+
+        if (length < (int)size && fstatat(opts->dir_fd, path, &st, 0) == 0 && S_ISREG(st.st_mode))
+        {
+            if (faccessat(opts->dir_fd, path, X_OK, AT_EACCESS) == 0)
+            {
+                return 0;
+            }
+            error = EACCES;
+        }
+
+        if (*end == '\0')
+        {
+            break;
+        }
+        search = end + 1;
+    }
+
+    return error;
+}
+
+/**
+ * @brief Function that duplicates the fds of a stage that runs as threads
+ *        in mexec. The threads keep their own copies, so the caller closes
+ *        the pipe ends like it does for a process.
+ * 
+ * @param in_fd fd to use as stdin, or -1 to inherit
+ * @param out_fd fd to use as stdout, or -1 to inherit
+ * @param in set to the copy of stdin
+ * @param out set to the copy of stdout
+ * @return 0 on success, -1 if the fds could not be duplicated
+ */
+int take_fds(int in_fd, int out_fd, int *in, int *out)
+{
+    *in = fcntl(in_fd != -1 ? in_fd : STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    *out = fcntl(out_fd != -1 ? out_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+
+    if (*in == -1 || *out == -1)
+    {
+        perror("Dup failed!");
+        if (*in != -1)
+        {
+            close(*in);
+        }
+        if (*out != -1)
+        {
+            close(*out);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that starts a stage written as "@N command". Its instances
+ *        are run by threads in mexec, the stage has no pid of its own and is
+ *        polled on an fd that becomes readable when all of them are done.
+ * 
+ * @param s stage to start
+ * @param in_fd fd to use as stdin, or -1 to inherit
+ * @param out_fd fd to use as stdout, or -1 to inherit
+ * @param opts the flags
+ * @return 0 on success, -1 if the fds could not be duplicated
+ */
+int start_replicas(stage *s, int in_fd, int out_fd, const options *opts)
+{
+    int in;
+    int out;
+
+    char path[PATH_MAX];
+
+    //a command that can not be found fails once, not in every instance.
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+    int error = find_command(s->argv[0], opts, path, sizeof(path));
+    if (error != 0)
+    {
+        fprintf(stderr, "%s: %s\n", s->argv[0], strerror(error));
+        s->status = (error == ENOENT ? 127 : 126) << 8;
+        return -1;
+    }
+    if (take_fds(in_fd, out_fd, &in, &out) == -1)
+    {
+        s->status = 1 << 8;
+        return -1;
+    }
+
+    cpu_set_t *cpus = NULL;
+
+    //the instances are spread out, each thread starts its instances on its own cpu.
+    if (opts->topology != NULL)
+    {
+        const topology *t = opts->topology;
+
+        if ((cpus = malloc(sizeof(*cpus) * s->replicas)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed!\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < s->replicas; i++)
+        {
+            CPU_ZERO(&cpus[i]);
+            CPU_SET(t->spread[(s->first_cpu + i) % t->numb_of_cpus], &cpus[i]);
+        }
+    }
+
+    s->set = replicas_start(s->argv, path, s->replicas, opts->ordered, opts->dir_fd, opts->env, in, out, cpus);
+    free(cpus);
+    s->exec = s->start;
+    s->pid = 0;
+    s->pidfd = replicas_done_fd(s->set);
+    return 0;
+}
+
+/**
+ * @brief Function that starts a stage as a builtin thread instead of a
+ *        process. Like a replicated stage it is polled on a done fd.
+ * 
+ * @param s stage to start
+ * @param in_fd fd to use as stdin, or -1 to inherit
+ * @param out_fd fd to use as stdout, or -1 to inherit
+ * @param opts the flags
+ * @return 0 on success, -1 if the fds could not be duplicated
+ */
+int start_builtin(stage *s, int in_fd, int out_fd, const options *opts)
+{
+    int in;
+    int out;
+
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+    if (take_fds(in_fd, out_fd, &in, &out) == -1)
+    {
+        s->status = 1 << 8;
+        return -1;
+    }
+
+    s->builtin = builtin_start(s->argv, opts->dir_fd, in, out);
+    s->exec = s->start;
+    s->pid = 0;
+    s->pidfd = builtin_done_fd(s->builtin);
+    return 0;
+}
+
+/**
+ * @brief Function that parses a signal given as a number or a name, with or
+ *        without "SIG" in front, like TERM, SIGKILL or 9.
+ * 
+ * @param arg the flag argument
+ * @return the signal
+ */
+int parse_signal(const char *arg)
+{
+    char *rest;
+    long number = strtol(arg, &rest, 10);
+
+    if (rest != arg && *rest == '\0' && number > 0 && number < NSIG)
+    {
+        return number;
+    }
+
+    const char *name = strncasecmp(arg, "SIG", 3) == 0 ? arg + 3 : arg;
+    for (int sig = 1; sig < NSIG; sig++)
+    {
+        const char *abbrev = sigabbrev_np(sig);
+
+        if (abbrev != NULL && strcasecmp(abbrev, name) == 0)
+        {
+            return sig;
+        }
+    }
+
+    fprintf(stderr, "Invalid signal: %s\n", arg);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Function that parses a size in bytes with an optional K, M or G
+ *        suffix.
+ * 
+ * @param arg the flag argument
+ * @param max the largest size that is valid
+ * @return the size
+ */
+long long parse_size(const char *arg, long long max)
+{
+    char *rest;
+
+    errno = 0;
+    long long size = strtoll(arg, &rest, 10);
+    long long unit = 1;
+
+    if (*rest == 'K' || *rest == 'k')
+    {
+        unit = 1024;
+        rest++;
+    }
+    else if (*rest == 'M' || *rest == 'm')
+    {
+        unit = 1024 * 1024;
+        rest++;
+    }
+    else if (*rest == 'G' || *rest == 'g')
+    {
+        unit = 1024 * 1024 * 1024;
+        rest++;
+    }
+
+    if (errno != 0 || *rest != '\0' || size <= 0 || size > max / unit)
+    {
+        fprintf(stderr, "Invalid size: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return size * unit;
+}
+
+/**
+ * @brief Function that parses a number that is at least 1.
+ * 
+ * @param arg the flag argument
+ * @param what what the number counts, used in the error message
+ * @return the number
+ */
+int parse_number(const char *arg, const char *what)
+{
+    char *rest;
+
+    errno = 0;
+    long number = strtol(arg, &rest, 10);
+
+    if (errno != 0 || rest == arg || *rest != '\0' || number < 1 || number > INT_MAX)
+    {
+        fprintf(stderr, "Invalid number of %s: %s\n", what, arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return number;
+}
+
+/**
+ * @brief Function that creates a close-on-exec pipe and sets its size if
+ *        --pipe-size is used. A size above /proc/sys/fs/pipe-max-size is only
+ *        a warning, the pipe keeps its default size.
+ * 
+ * @param pipe_fds the pipe
+ * @param opts the flags
+ * @return 0 on success, -1 if the pipe could not be created
+ */
+int make_pipe(int pipe_fds[2], const options *opts)
+{
+    static bool warned = false;
+
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+    {
+        perror("Pipe failed!");
+        return -1;
+    }
+
+    if (opts->pipe_size > 0 && fcntl(pipe_fds[1], F_SETPIPE_SZ, opts->pipe_size) == -1 && !warned)
+    {
+        perror("Pipe size not set");
+        warned = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that runs in one thread per boundary in metered mode. It
+ *        moves the data from the writing stage to the reading stage with
+ *        splice, so the bytes are counted without being copied to mexec. It
+ *        also notes when the first byte and the eof came for --trace.
+ * 
+ * @param ptr the boundary
+ * @return NULL
+ */
+void *relay(void *ptr)
+{
+    boundary *b = ptr;
+    sigset_t set;
+    ssize_t moved;
+
+    //a reader that exits gives EPIPE here instead of killing mexec.
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while ((moved = splice(b->in_fd, NULL, b->out_fd, NULL, SPLICE_CHUNK, SPLICE_F_MOVE)) != 0)
+    {
+        if (moved < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            //EPIPE means the reader is gone, closing in_fd passes that on to the writer.
+            if (errno != EPIPE)
+            {
+                perror("Splice failed!");
+            }
+            break;
+        }
+        if (b->bytes == 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &b->first);
+        }
+        b->bytes += moved;
+    }
+    b->eof = moved == 0;
+    clock_gettime(CLOCK_MONOTONIC, &b->last);
+
+    close(b->in_fd);
+    close(b->out_fd);
+    return NULL;
+}
+
+/**
+ * @brief Function that creates the pipes and starts every stage without
+ *        waiting for them. A pipe is created just before the stage that writes
+ *        to it and the parent closes its ends as soon as both stages are
+ *        started, so the parent only holds a few fds however long the
+ *        pipeline is. In metered mode every boundary is two pipes with a relay
+ *        thread between. When the first stages are pure and their output is
+ *        in the memo they are not started, the next stage reads the saved
+ *        output, else a recorder saves it on the way.
+ * 
+ * @param p the pipeline
+ * @param opts the flags
+ * @param in_fd stdin of the first stage, or -1 to inherit
+ * @param out_fd stdout of the last stage, or -1 to inherit
+ * @return number of stages that were started
+ */
+int start_pipeline(pipeline *p, const options *opts, int in_fd, int out_fd)
+{
+    int prev_read = in_fd;
+    int first = 0;
+    memo_key key = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    p->exit_code = EXIT_SUCCESS;
+    p->failed_stage = -1;
+    p->numb_of_running = 0;
+    p->numb_of_relays = 0;
+    p->numb_of_junctions = 0;
+    p->memo_prefix = 0;
+
+    if (opts->topology != NULL)
+    {
+        place_stages(p, opts);
+    }
+
+    if (opts->profile)
+    {
+        if ((p->probes = malloc(sizeof(*p->probes) * p->numb_of_stages)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed!\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < p->numb_of_stages; i++)
+        {
+            probe_init(&p->probes[i]);
+            p->stages[i].probe = &p->probes[i];
+        }
+    }
+
+    if (p->graph)
+    {
+        return start_graph(p, opts, in_fd, out_fd);
+    }
+
+    //a relay would count bytes of stages that are not run, so metered mode is never memoized.
+    if (opts->memo_dir != NULL && !opts->metered && (p->memo_prefix = pure_prefix(p, opts, in_fd, &key)) > 0)
+    {
+        int saved = memo_lookup(opts->memo_dir, key);
+
+        if (saved != -1)
+        {
+            for (first = 0; first < p->memo_prefix; first++)
+            {
+                stage *s = &p->stages[first];
+
+                s->pid = 0;
+                s->status = 0;
+                s->start = s->end = p->start;
+            }
+            p->memo_prefix = 0;
+            prev_read = saved;
+
+            //a pipeline that is all pure only has its output to copy.
+            if (first == p->numb_of_stages)
+            {
+                flush_output(saved, out_fd);
+                close(saved);
+                return 0;
+            }
+        }
+    }
+
+    for (int i = first; i < p->numb_of_stages; i++)
+    {
+        int pipe_fds[2] = {-1, out_fd};
+        int relay_fds[2] = {-1, -1};
+
+        //checks if pipe was successfull or not
+        if (i < p->numb_of_stages - 1 && (make_pipe(pipe_fds, opts) == -1 
+            || (opts->metered && make_pipe(relay_fds, opts) == -1)))
+        {
+            p->exit_code = EXIT_FAILURE;
+            break;
+        }
+
+        if (i == p->memo_prefix - 1)
+        {
+            start_recorder(p, opts, key, &pipe_fds[1], i == p->numb_of_stages - 1);
+        }
+
+        stage *s = &p->stages[i];
+        if (start_stage(s, prev_read, pipe_fds[1], opts) == 0)
+        {
+            p->numb_of_running++;
+        }
+        else
+        {
+            p->exit_code = EXIT_FAILURE;
+        }
+
+        //closes the pipe ends that now belong to the children.
+        if (prev_read != -1 && prev_read != in_fd)
+        {
+            close(prev_read);
+        }
+        if (pipe_fds[1] != -1 && pipe_fds[1] != out_fd)
+        {
+            close(pipe_fds[1]);
+        }
+        prev_read = pipe_fds[0];
+
+        //the relay thread owns the two inner pipe ends.
+        if (relay_fds[0] != -1)
+        {
+            boundary *b = &p->boundaries[i];
+
+            b->in_fd = pipe_fds[0];
+            b->out_fd = relay_fds[1];
+            prev_read = relay_fds[0];
+
+            if (pthread_create(&b->thread, NULL, relay, b) != 0)
+            {
+                perror("Thread create failed!");
+                exit(EXIT_FAILURE);
+            }
+            p->numb_of_relays++;
+        }
+    }
+
+    if (prev_read != -1 && prev_read != in_fd)
+    {
+        close(prev_read);
+    }
+
+    return p->numb_of_running;
+}
+
+/**
+ * @brief Function that finds the pure stages at the start of a linear
+ *        pipeline and makes the key of their output. The key is made of the
+ *        working directory, the environment, the argv of every pure stage
+ *        and the identity of the input and of every file named in the
+ *        arguments, so a changed file gives a new key without being read. A pipe, socket or
+ *        terminal as input can not be known, only /dev/null can.
+ * 
+ * @param p the pipeline
+ * @param opts the flags, with the directory of the stages
+ * @param in_fd stdin of the first stage, or -1 to inherit
+ * @param key set to the key
+ * @return number of pure stages, 0 if the output can not be memoized
+ */
+int pure_prefix(const pipeline *p, const options *opts, int in_fd, memo_key *key)
+{
+    const stage *first = &p->stages[0];
+    char cwd[PATH_MAX];
+    struct stat st;
+    int n = 0;
+
+    while (n < p->numb_of_stages && p->stages[n].pure && p->stages[n].output == NULL)
+    {
+        n++;
+    }
+    if (n == 0 || directory_path(opts->dir_fd, cwd, sizeof(cwd)) == -1)
+    {
+        return 0;
+    }
+
+    memo_key_init(key);
+    memo_key_add(key, cwd, strlen(cwd) + 1);
+
+    //the locale, PATH and the rest of the environment can change the output.
+    int numb_of_variables = 0;
+    for (char **variable = opts->env; *variable != NULL; variable++, numb_of_variables++)
+    {
+        memo_key_add(key, *variable, strlen(*variable) + 1);
+    }
+    memo_key_add(key, &numb_of_variables, sizeof(numb_of_variables));
+
+    if (first->input != NULL ? fstatat(opts->dir_fd, first->input, &st, 0) == -1 
+        : fstat(in_fd != -1 ? in_fd : STDIN_FILENO, &st) == -1)
+    {
+        return 0;
+    }
+    if (S_ISREG(st.st_mode))
+    {
+        //stdin can be a file that is already partly read.
+        off_t offset = first->input != NULL ? 0 : lseek(in_fd != -1 ? in_fd : STDIN_FILENO, 0, SEEK_CUR);
+
+        memo_key_add_file(key, &st);
+        memo_key_add(key, &offset, sizeof(offset));
+    }
+    else
+    {
+        //any other device than /dev/null, a terminal too, gives other bytes every time.
+        struct stat null;
+
+        if (!S_ISCHR(st.st_mode) || stat("/dev/null", &null) == -1 || st.st_rdev != null.st_rdev)
+        {
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const stage *s = &p->stages[i];
+        int numb_of_words = 0;
+
+        memo_key_add(key, &s->replicas, sizeof(s->replicas));
+        for (char **arg = s->argv; *arg != NULL; arg++, numb_of_words++)
+        {
+            memo_key_add(key, *arg, strlen(*arg) + 1);
+            if (fstatat(opts->dir_fd, *arg, &st, 0) == 0 && S_ISREG(st.st_mode))
+            {
+                memo_key_add_file(key, &st);
+            }
+        }
+        memo_key_add(key, &numb_of_words, sizeof(numb_of_words));
+    }
+
+    return n;
+}
+
+/**
+ * @brief Function that finds the path of a directory, the working directory
+ *        of mexec for AT_FDCWD.
+ * 
+ * @param dir_fd the directory
+ * @param path set to the path
+ * @param size size of path
+ * @return 0 on success, -1 if the path is not known or too long
+ */
+int directory_path(int dir_fd, char *path, size_t size)
+{
+    char link[64];
+    ssize_t length;
+
+    if (dir_fd == AT_FDCWD)
+    {
+        return getcwd(path, size) != NULL ? 0 : -1;
+    }
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dir_fd);
+    if ((length = readlink(link, path, size)) == -1 || (size_t)length == size || path[0] != '/')
+    {
+        return -1;
+    }
+    path[length] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Function that puts a recorder after the last pure stage. The stage
+ *        writes to a new pipe and the recorder copies it on to the next
+ *        stage, or stdout, and to the memo. If no recorder can be started
+ *        the stage writes where it would have.
+ * 
+ * @param p the pipeline
+ * @param opts the flags
+ * @param key the key of the output
+ * @param out_fd the fd the stage writes to, changed to the new pipe
+ * @param last true if the stage is the last one and out_fd is not its own
+ */
+void start_recorder(pipeline *p, const options *opts, memo_key key, int *out_fd, bool last)
+{
+    //the recorder closes the fd it writes to, so it gets its own stdout.
+    int next = last ? fcntl(*out_fd != -1 ? *out_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0) : *out_fd;
+    int record_fds[2];
+
+    if (next == -1 || make_pipe(record_fds, opts) == -1)
+    {
+        if (last && next != -1)
+        {
+            close(next);
+        }
+        return;
+    }
+
+    if ((p->recorder = memo_record(opts->memo_dir, key, record_fds[0], next)) == NULL)
+    {
+        close(record_fds[0]);
+        close(record_fds[1]);
+        if (last)
+        {
+            close(next);
+        }
+        return;
+    }
+
+    *out_fd = record_fds[1];
+}
+
+/**
+ * @brief Function that starts a stage as a process, as threads if it is
+ *        replicated or as a thread if it is a builtin.
+ * 
+ * @param s stage to start
+ * @param in_fd fd to use as stdin, or -1 to inherit
+ * @param out_fd fd to use as stdout, or -1 to inherit
+ * @param opts the flags
+ * @return 0 on success, -1 if the stage could not be started
+ */
+int start_stage(stage *s, int in_fd, int out_fd, const options *opts)
+{
+    int in = in_fd;
+    int out = out_fd;
+    int result;
+
+    if (open_redirections(s, opts->dir_fd, &in, &out) == -1)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &s->start);
+        s->status = 1 << 8;
+        return -1;
+    }
+
+    //a process or thread starts on the cpus of the thread that starts it.
+    if (s->pinned && pthread_setaffinity_np(pthread_self(), sizeof(s->cpus), &s->cpus) != 0)
+    {
+        fprintf(stderr, "mexec: stage %s not pinned\n", s->argv[0]);
+    }
+
+    if (s->replicas > 1)
+    {
+        result = start_replicas(s, in, out, opts);
+    }
+    else if (opts->builtins && builtin_supported(s->argv))
+    {
+        result = start_builtin(s, in, out, opts);
+    }
+    else
+    {
+        result = spawn_stage(s, in, out, opts);
+    }
+
+    if (s->pinned)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(opts->topology->allowed), &opts->topology->allowed);
+    }
+
+    if (result == 0 && s->probe != NULL)
+    {
+        probe_attach(s->probe, in != -1 ? in : STDIN_FILENO);
+    }
+
+    //the stage has its own copies of the files.
+    if (in != in_fd)
+    {
+        close(in);
+    }
+    if (out != out_fd)
+    {
+        close(out);
+    }
+    return result;
+}
+
+/**
+ * @brief Function that starts a pipeline where stages have names and read
+ *        from several stages. Every producer to consumer edge is a pipe. A
+ *        producer with several consumers writes to a tee junction and a
+ *        consumer with several producers reads from a merge junction. When
+ *        there are several last stages they are merged too, so their lines
+ *        are not mixed on stdout.
+ * 
+ * @param p the pipeline
+ * @param opts the flags
+ * @param in_fd stdin of the stages without producers, or -1 to inherit
+ * @param out_fd stdout of the stages without consumers, or -1 to inherit
+ * @return number of stages that were started
+ */
+int start_graph(pipeline *p, const options *opts, int in_fd, int out_fd)
+{
+    static bool warned = false;
+    int n = p->numb_of_stages;
+    int numb_of_edges = 0;
+    int numb_of_sinks = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        numb_of_edges += p->stages[i].numb_of_producers;
+    }
+
+    int (*edges)[2] = malloc(sizeof(*edges) * (numb_of_edges + n));
+    int *from = malloc(sizeof(*from) * (numb_of_edges + 1));
+    int *fds = malloc(sizeof(*fds) * (numb_of_edges + n));
+    int *consumers = calloc(n, sizeof(*consumers));
+    int *stage_in = malloc(sizeof(*stage_in) * n);
+    int *stage_out = malloc(sizeof(*stage_out) * n);
+    p->junctions = malloc(sizeof(*p->junctions) * (2 * n + 1));
+    if (edges == NULL || from == NULL || fds == NULL || consumers == NULL || stage_in == NULL 
+        || stage_out == NULL || p->junctions == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts->metered && !warned)
+    {
+        fprintf(stderr, "mexec: --metered is not used for pipelines with named stages\n");
+        warned = true;
+    }
+
+    //one pipe per edge, numbered in the order of the consumers.
+    int e = 0;
+    for (int i = 0; i < n; i++)
+    {
+        for (int k = 0; k < p->stages[i].numb_of_producers; k++, e++)
+        {
+            from[e] = p->stages[i].producers[k];
+            consumers[from[e]]++;
+            if (make_pipe(edges[e], opts) == -1)
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    //the output side of every stage.
+    for (int i = 0; i < n; i++)
+    {
+        int count = 0;
+        int tee_fds[2];
+
+        for (int k = 0; k < numb_of_edges; k++)
+        {
+            if (from[k] == i)
+            {
+                fds[count++] = edges[k][1];
+            }
+        }
+
+        if (count == 0)
+        {
+            stage_out[i] = out_fd;
+            numb_of_sinks += p->stages[i].output == NULL;
+        }
+        else if (count == 1)
+        {
+            stage_out[i] = fds[0];
+        }
+        else
+        {
+            if (make_pipe(tee_fds, opts) == -1)
+            {
+                exit(EXIT_FAILURE);
+            }
+            stage_out[i] = tee_fds[1];
+            p->junctions[p->numb_of_junctions++] = junction_tee(tee_fds[0], fds, count);
+        }
+    }
+
+    //the input side of every stage.
+    e = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int count = p->stages[i].numb_of_producers;
+        int merge_fds[2];
+
+        if (count == 0)
+        {
+            stage_in[i] = in_fd;
+        }
+        else if (count == 1)
+        {
+            stage_in[i] = edges[e][0];
+        }
+        else
+        {
+            for (int k = 0; k < count; k++)
+            {
+                fds[k] = edges[e + k][0];
+            }
+            if (make_pipe(merge_fds, opts) == -1)
+            {
+                exit(EXIT_FAILURE);
+            }
+            stage_in[i] = merge_fds[0];
+            p->junctions[p->numb_of_junctions++] = junction_merge(fds, count, merge_fds[1]);
+        }
+        e += count;
+    }
+
+    //several last stages share stdout through a merge junction.
+    if (numb_of_sinks > 1)
+    {
+        int count = 0;
+        int out = fcntl(out_fd != -1 ? out_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+
+        if (out == -1)
+        {
+            perror("Dup failed!");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (stage_out[i] == out_fd && consumers[i] == 0 && p->stages[i].output == NULL)
+            {
+                if (make_pipe(edges[numb_of_edges + count], opts) == -1)
+                {
+                    exit(EXIT_FAILURE);
+                }
+                stage_out[i] = edges[numb_of_edges + count][1];
+                fds[count] = edges[numb_of_edges + count][0];
+                count++;
+            }
+        }
+        p->junctions[p->numb_of_junctions++] = junction_merge(fds, count, out);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (start_stage(&p->stages[i], stage_in[i], stage_out[i], opts) == 0)
+        {
+            p->numb_of_running++;
+        }
+        else
+        {
+            p->exit_code = EXIT_FAILURE;
+        }
+    }
+
+    //the stage ends belong to the children now, the junctions keep their own.
+    for (int i = 0; i < n; i++)
+    {
+        if (stage_in[i] != in_fd)
+        {
+            close(stage_in[i]);
+        }
+        if (stage_out[i] != out_fd)
+        {
+            close(stage_out[i]);
+        }
+    }
+
+    free(edges);
+    free(from);
+    free(fds);
+    free(consumers);
+    free(stage_in);
+    free(stage_out);
+    return p->numb_of_running;
+}
+
+/**
+ * @brief Function that reaps one stage whose pidfd is readable, so the exit
+ *        status and resource usage are stored in the stage that finished. A
+ *        stage that fails stops the pipeline with --fail-fast. A stage killed
+ *        by SIGPIPE does not, its reader is done and that is not an error.
+ * 
+ * @param p the pipeline of the stage
+ * @param s the stage
+ * @param opts the flags
+ */
+void reap_stage(pipeline *p, stage *s, const options *opts)
+{
+    if (s->set != NULL)
+    {
+        //the fd is the one of the replicated stage and is closed with it.
+        s->status = replicas_wait(s->set, &s->usage);
+        s->set = NULL;
+    }
+    else if (s->builtin != NULL)
+    {
+        s->status = builtin_wait(s->builtin, &s->usage);
+        s->builtin = NULL;
+    }
+    else
+    {
+        while (wait4(s->pid, &s->status, 0, &s->usage) < 0)
+        {
+            if (errno != EINTR)
+            {
+                perror("Wait failed!");
+                exit(EXIT_FAILURE);
+            }
+        }
+        close(s->pidfd);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &s->end);
+    s->pidfd = -1;
+    p->numb_of_running--;
+
+    //the copy of the input pipe must not keep its writer from getting EPIPE.
+    if (s->probe != NULL)
+    {
+        probe_detach(s->probe);
+    }
+
+    if (s->status != 0 && !(WIFSIGNALED(s->status) && WTERMSIG(s->status) == SIGPIPE))
+    {
+        fail_pipeline(p, s - p->stages, opts);
+    }
+}
+
+/**
+ * @brief Function that stops every stage of a pipeline that is still
+ *        running when a stage has failed and --fail-fast is used. Processes
+ *        get the signal through their pidfd, so a pid that was reused can
+ *        never be hit. Threads stop reading and report the same signal.
+ * 
+ * @param p the pipeline
+ * @param index the stage that failed
+ * @param opts the flags
+ */
+void fail_pipeline(pipeline *p, int index, const options *opts)
+{
+    if (opts->fail_signal == 0 || p->failed_stage != -1)
+    {
+        return;
+    }
+    p->failed_stage = index;
+
+    for (int i = 0; i < p->numb_of_stages; i++)
+    {
+        stage *s = &p->stages[i];
+
+        if (s->pidfd == -1)
+        {
+            continue;
+        }
+        if (s->set != NULL)
+        {
+            replicas_kill(s->set, opts->fail_signal);
+        }
+        else if (s->builtin != NULL)
+        {
+            builtin_kill(s->builtin, opts->fail_signal);
+        }
+        else if (syscall(SYS_pidfd_send_signal, s->pidfd, opts->fail_signal, NULL, 0) == -1 && errno != ESRCH)
+        {
+            perror("Signal failed!");
+        }
+    }
+}
+
+/**
+ * @brief Function that returns the exit status of a stage the way the shell
+ *        shows it, 128 + the signal for a stage that was killed.
+ * 
+ * @param s the stage
+ * @return the exit status
+ */
+int exit_status(const stage *s)
+{
+    return WIFSIGNALED(s->status) ? 128 + WTERMSIG(s->status) : WEXITSTATUS(s->status);
+}
+
+/**
+ * @brief Function that returns the exit status of a pipeline like the shell
+ *        does with pipefail: the status of the last stage that failed. When
+ *        --fail-fast stopped the pipeline it is the status of the stage that
+ *        failed first, not of the stages that were killed because of it.
+ * 
+ * @param p the pipeline
+ * @return the exit status, 0 if every stage succeeded
+ */
+int pipefail_status(const pipeline *p)
+{
+    if (p->failed_stage != -1)
+    {
+        return exit_status(&p->stages[p->failed_stage]);
+    }
+
+    for (int i = p->numb_of_stages - 1; i >= 0; i--)
+    {
+        if (exit_status(&p->stages[i]) != 0)
+        {
+            return exit_status(&p->stages[i]);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that finishes a pipeline whose stages have all been reaped:
+ *        waits for the relays, prints the buffered output and the reports.
+ * 
+ * @param p the pipeline
+ * @param opts the flags
+ */
+void finish_pipeline(pipeline *p, const options *opts)
+{
+    int status = pipefail_status(p);
+
+    clock_gettime(CLOCK_MONOTONIC, &p->end);
+
+    if (p->monitor != NULL)
+    {
+        monitor_stop(p->monitor);
+        p->monitor = NULL;
+    }
+
+    //a pipe that could not be made leaves the status at EXIT_FAILURE.
+    if (status != 0)
+    {
+        p->exit_code = status;
+    }
+
+    //the relays are done when the stages around them have closed the pipes.
+    for (int i = 0; i < p->numb_of_relays; i++)
+    {
+        pthread_join(p->boundaries[i].thread, NULL);
+        if (opts->stats == STATS_NONE)
+        {
+            fprintf(stderr, "mexec: stage %d -> %d: %llu bytes\n", i + 1, i + 2, p->boundaries[i].bytes);
+        }
+    }
+
+    //the output of the pure stages is only kept if every one of them succeeded.
+    if (p->recorder != NULL)
+    {
+        bool keep = true;
+
+        for (int i = 0; i < p->memo_prefix; i++)
+        {
+            keep = keep && exit_status(&p->stages[i]) == 0;
+        }
+        memo_finish(p->recorder, keep, opts->memo_size);
+        p->recorder = NULL;
+    }
+
+    //the junctions are done when every stage around them has exited.
+    for (int i = 0; i < p->numb_of_junctions; i++)
+    {
+        junction_join(p->junctions[i]);
+    }
+    free(p->junctions);
+    p->junctions = NULL;
+
+    if (p->output_fd != -1)
+    {
+        flush_output(p->output_fd, -1);
+        close(p->output_fd);
+        p->output_fd = -1;
+    }
+
+    if (opts->batch_delimiter != NULL)
+    {
+        print_status(p);
+    }
+
+    if (opts->stats != STATS_NONE)
+    {
+        print_stats(p, opts);
+    }
+
+    if (opts->profile)
+    {
+        print_profile(p);
+    }
+
+    if (opts->trace != NULL)
+    {
+        print_trace(p, opts);
+    }
+}
+
+/**
+ * @brief Function that prints how a pipeline in batch mode ended.
+ * 
+ * @param p the pipeline
+ */
+void print_status(const pipeline *p)
+{
+    double wall = elapsed_ms(&p->start, &p->end);
+
+    //the stage that stopped the pipeline is the one to show.
+    for (int i = p->failed_stage != -1 ? p->failed_stage : 0; i < p->numb_of_stages; i++)
+    {
+        const stage *s = &p->stages[i];
+
+        if (s->pid == -1)
+        {
+            fprintf(stderr, "mexec: pipeline %d (line %d): stage %d not started (%.1f ms)\n", 
+                p->index, p->line, i + 1, wall);
+            return;
+        }
+        if (WIFSIGNALED(s->status))
+        {
+            fprintf(stderr, "mexec: pipeline %d (line %d): stage %d killed by signal %d (%.1f ms)\n", 
+                p->index, p->line, i + 1, WTERMSIG(s->status), wall);
+            return;
+        }
+        if (WEXITSTATUS(s->status) != 0)
+        {
+            fprintf(stderr, "mexec: pipeline %d (line %d): stage %d exit %d (%.1f ms)\n", 
+                p->index, p->line, i + 1, WEXITSTATUS(s->status), wall);
+            return;
+        }
+    }
+
+    fprintf(stderr, "mexec: pipeline %d (line %d): ok (%.1f ms)\n", p->index, p->line, wall);
+}
+
+/**
+ * @brief Function that creates an unlinked temporary file that the output of
+ *        a pipeline in batch mode is collected in.
+ * 
+ * @return the fd of the file
+ */
+int open_output_buffer(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char template[PATH_MAX];
+
+    snprintf(template, sizeof(template), "%s/mexec.XXXXXX", dir != NULL ? dir : "/tmp");
+
+    int fd = mkostemp(template, O_CLOEXEC);
+    if (fd == -1)
+    {
+        perror(template);
+        exit(EXIT_FAILURE);
+    }
+    unlink(template);
+
+    return fd;
+}
+
+/**
+ * @brief Function that copies the collected output of a pipeline to stdout
+ *        in one piece, with sendfile so it is not copied through mexec.
+ * 
+ * @param fd the file with the output
+ * @param out_fd where to copy it, or -1 for stdout
+ */
+void flush_output(int fd, int out_fd)
+{
+    char buffer[65536];
+    off_t offset = 0;
+    ssize_t n;
+
+    fflush(stdout);
+    if (out_fd == -1)
+    {
+        out_fd = STDOUT_FILENO;
+    }
+
+    //EPIPE from a daemon, where SIGPIPE is blocked, means the reader is gone and ends the output.
+    while ((n = sendfile(out_fd, fd, &offset, SPLICE_CHUNK)) > 0)
+    {
+        continue;
+    }
+
+    //sendfile does not work to every kind of stdout, copy the rest.
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+    {
+        while ((n = pread(fd, buffer, sizeof(buffer), offset)) > 0)
+        {
+            if (write(out_fd, buffer, n) != n)
+            {
+                break;
+            }
+            offset += n;
+        }
+    }
+}
 
 /**
- * @brief Main function that runs the pipeline program.
+ * @brief Function that runs the pipelines with at most opts->jobs of them at
+ *        the same time. Every started stage gets a pidfd and the loop sleeps
+ *        in poll until one of them exits, so it knows which stage of which
+ *        pipeline ended without a blocking wait.
  * 
- * @param argc argument
- * @param argv number of arguments
- * @return Exit success if nothing went wrong. 
+ * @param pipelines the pipelines to run
+ * @param count number of pipelines
+ * @param opts the flags
+ * @return EXIT_SUCCESS if every pipeline succeeded, else the pipefail status
+ *         of the first one that failed
  */
-int main(int argc, char *argv[])
-{   
-    //allocate memory and check if allocation was succsessfull for buffers
-    char *buffer = malloc(sizeof(*buffer)*MAX_LENGTH_WITH_TERMINATORS);
-    char *string_buffer = NULL;
-    if (buffer == NULL)
+int run_jobs(pipeline **pipelines, int count, const options *opts)
+{
+    int next = 0;
+    int numb_of_active = 0;
+    pipeline **active = calloc(opts->jobs, sizeof(*active));
+    struct pollfd *fds = NULL;
+    stage **owners = NULL;
+    int *owner_pipelines = NULL;
+    size_t capacity = 0;
+    int devnull = -1;
+
+    if (active == NULL)
     {
         fprintf(stderr, "Memory allocation failed!\n");
-        return EXIT_FAILURE;
+        exit(EXIT_FAILURE);
     }
 
-    //Calling number of commands function and returns the number of commands to a variable.
-    int numb_of_commands = number_of_commands(argc, argv, buffer, &string_buffer);
-    
-    //check if file is empty or not.
-    if (numb_of_commands == 0)
+    //in batch mode the pipelines do not share stdin and get their own stdout.
+    if (opts->batch_delimiter != NULL && (devnull = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1)
     {
-        fprintf(stderr, "File is empty\n");
-        free(buffer);
-        free(string_buffer);
-        return EXIT_FAILURE;
+        perror("/dev/null");
+        exit(EXIT_FAILURE);
     }
-    
-    // init of pipe and fork
-    int pipes[numb_of_commands - 1][2];
-    pid_t p[numb_of_commands];
 
-    //checks if pipe was successfull or not
-    for (int i = 0; i < numb_of_commands - 1; i++)
+    while (next < count || numb_of_active > 0)
     {
-        if (pipe(pipes[i]) == -1)
+        //start pipelines until the pool is full.
+        while (next < count && numb_of_active < opts->jobs)
         {
-            perror("Pipe failed!");
-            free(buffer);
-            free(string_buffer);
-            return EXIT_FAILURE;
+            pipeline *p = pipelines[next++];
+
+            p->output_fd = opts->batch_delimiter != NULL ? open_output_buffer() : -1;
+            start_pipeline(p, opts, devnull != -1 ? devnull : opts->input_fd, 
+                p->output_fd != -1 ? p->output_fd : opts->output_fd);
+            active[numb_of_active++] = p;
+
+            if (opts->profile)
+            {
+                p->monitor = monitor_start(p->probes, p->numb_of_stages);
+            }
+
+            //a stage that could not be started has failed too.
+            for (int j = 0; p->exit_code != EXIT_SUCCESS && j < p->numb_of_stages; j++)
+            {
+                if (p->stages[j].pid == -1)
+                {
+                    fail_pipeline(p, j, opts);
+                    break;
+                }
+            }
         }
-    }
-    
-    //checks if fork was successfull or not
-    for (int i = 0; i < numb_of_commands; i++)
-    {   
-        if ((p[i] = fork()) < 0)
+
+        //collect the pidfds of every running stage.
+        size_t n = 0;
+        for (int i = 0; i < numb_of_active; i++)
         {
-            perror("Fork failed!");
-            free(buffer);
-            free(string_buffer);
-            return EXIT_FAILURE;
+            for (int j = 0; j < active[i]->numb_of_stages; j++)
+            {
+                stage *s = &active[i]->stages[j];
+
+                if (s->pidfd == -1)
+                {
+                    continue;
+                }
+                if (n == capacity)
+                {
+                    capacity = capacity == 0 ? 64 : capacity * 2;
+                    fds = realloc(fds, capacity * sizeof(*fds));
+                    owners = realloc(owners, capacity * sizeof(*owners));
+                    owner_pipelines = realloc(owner_pipelines, capacity * sizeof(*owner_pipelines));
+                    if (fds == NULL || owners == NULL || owner_pipelines == NULL)
+                    {
+                        fprintf(stderr, "Memory allocation failed!\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                fds[n].fd = s->pidfd;
+                fds[n].events = POLLIN;
+                owners[n] = s;
+                owner_pipelines[n] = i;
+                n++;
+            }
+        }
+
+        //wait until a stage exits, a pipeline without running stages is done at once.
+        if (n > 0 && poll(fds, n, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Poll failed!");
+            exit(EXIT_FAILURE);
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (fds[i].revents != 0)
+            {
+                reap_stage(active[owner_pipelines[i]], owners[i], opts);
+            }
+        }
+
+        //finish the pipelines that have no running stages left.
+        for (int i = 0; i < numb_of_active; )
+        {
+            if (active[i]->numb_of_running > 0)
+            {
+                i++;
+                continue;
+            }
+
+            finish_pipeline(active[i], opts);
+            active[i] = active[--numb_of_active];
         }
-        //child process
-        if (p[i] == 0)
-        {   
-            child_process(pipes, p, numb_of_commands, &string_buffer, buffer, i);
-        }   
     }
-    
-    //closes pipes
-    for (int i = 0; i < numb_of_commands - 1; i++)
+
+    if (devnull != -1)
     {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+        close(devnull);
     }
+    free(active);
+    free(fds);
+    free(owners);
+    free(owner_pipelines);
 
-    //wait until process has finished running.
-    int wait_check;
-    for (int i = 0; i < numb_of_commands; i++)
-    {   
-        wait(&wait_check);
-        if (wait_check > 0)
+    //the status of the first pipeline in the file that failed.
+    for (int i = 0; i < count; i++)
+    {
+        if (pipelines[i]->exit_code != EXIT_SUCCESS)
         {
-            free(buffer);
-            free(string_buffer);
-            return EXIT_FAILURE;
+            return pipelines[i]->exit_code;
         }
     }
-    
-    //de-allocate memory and exit program.
-    free(buffer);
-    free(string_buffer);            
     return EXIT_SUCCESS;
 }
+
+/**
+ * @brief Function that returns the time between two points in milliseconds.
+ * 
+ * @param start the first point
+ * @param end the last point
+ * @return the time in milliseconds
+ */
+double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
 /**
- * @brief Function that tokenizes the commandlist into commands
+ * @brief Function that prints the time, cpu, memory and, in metered mode,
+ *        the bytes of every stage to stderr as a table or as JSON.
  * 
- * @param command_list list of commands
- * @param i number of commands
- * @param command pointer to the command that will be used.
+ * @param p the pipeline
+ * @param opts the flags
  */
-void tokenizing(char command_list[][MAX_LENGTH], int i, char *command[])
+void print_stats(const pipeline *p, const options *opts)
 {
-    char *p = command_list[i];
-    char *token = strtok(p, " ");
+    if (opts->stats == STATS_TABLE)
+    {
+        fprintf(stderr, "%-5s %10s %10s %10s %10s %8s %8s %12s %12s %6s  %s\n", "stage", "wall_ms", 
+            "user_ms", "sys_ms", "maxrss_kb", "vcsw", "ivcsw", "bytes_in", "bytes_out", "status", "command");
+    }
+    else
+    {
+        fprintf(stderr, "[\n");
+    }
+
+    for (int i = 0; i < p->numb_of_stages; i++)
+    {
+        const stage *s = &p->stages[i];
+        const struct rusage *u = &s->usage;
+        double wall = s->pid != -1 ? elapsed_ms(&s->start, &s->end) : 0;
+        double user = u->ru_utime.tv_sec * 1e3 + u->ru_utime.tv_usec / 1e3;
+        double sys = u->ru_stime.tv_sec * 1e3 + u->ru_stime.tv_usec / 1e3;
+        //the bytes are only known when mexec sits between the stages.
+        long long bytes_in = opts->metered && !p->graph && i > 0 ? (long long)p->boundaries[i - 1].bytes : -1;
+        long long bytes_out = opts->metered && !p->graph && i < p->numb_of_stages - 1 ? (long long)p->boundaries[i].bytes : -1;
+        //exit status, or 128 + signal like the shell, -1 if it never started.
+        int status = s->pid == -1 ? -1 : exit_status(s);
+        char in[24];
+        char out[24];
+
+        //unknown byte counts are "-" in the table and null in JSON.
+        snprintf(in, sizeof(in), bytes_in < 0 ? (opts->stats == STATS_TABLE ? "-" : "null") : "%lld", bytes_in);
+        snprintf(out, sizeof(out), bytes_out < 0 ? (opts->stats == STATS_TABLE ? "-" : "null") : "%lld", bytes_out);
+
+        if (opts->stats == STATS_TABLE)
+        {
+            fprintf(stderr, "%-5d %10.1f %10.1f %10.1f %10ld %8ld %8ld %12s %12s %6d ", i + 1, wall, 
+                user, sys, u->ru_maxrss, u->ru_nvcsw, u->ru_nivcsw, in, out, status);
+            for (char **arg = s->argv; *arg != NULL; arg++)
+            {
+                fprintf(stderr, " %s", *arg);
+            }
+            fprintf(stderr, "\n");
+            continue;
+        }
+
+        fprintf(stderr, "  {\"stage\": %d, \"wall_ms\": %.3f, \"user_ms\": %.3f, \"sys_ms\": %.3f, "
+            "\"maxrss_kb\": %ld, \"vcsw\": %ld, \"ivcsw\": %ld, \"bytes_in\": %s, \"bytes_out\": %s, "
+            "\"status\": %d, \"argv\": [", i + 1, wall, user, sys, u->ru_maxrss, u->ru_nvcsw, u->ru_nivcsw, 
+            in, out, status);
+        for (char **arg = s->argv; *arg != NULL; arg++)
+        {
+            fprintf(stderr, "%s\"", arg == s->argv ? "" : ", ");
+            print_json_chars(stderr, *arg);
+            fprintf(stderr, "\"");
+        }
+        fprintf(stderr, "]}%s\n", i < p->numb_of_stages - 1 ? "," : "");
+    }
 
-    int j = 0;
-    while (token != NULL)
+    if (opts->stats == STATS_JSON)
     {
-        command[j] = token;
-        token = strtok(NULL, " ");
-        j++;
+        fprintf(stderr, "]\n");
     }
-    //adding null at the end of the commands. 
-    command[j] = NULL;
 }
 
 /**
- * @brief Function that makes a command list from string_buffer
+ * @brief Function that writes a string with the characters JSON does not
+ *        allow in a string escaped, without the quotes.
  * 
- * @param string_buffer the old list of commands
- * @param command_list the new list of commands
+ * @param f where to write
+ * @param str the string
  */
-void command_list_func(char *string_buffer, char command_list[][MAX_LENGTH])
-{   
-    int index = 0;
-    int numb_of_commands_check = 0;
-    
-    for (size_t i = 0; i <= strlen(string_buffer); i++)
+void print_json_chars(FILE *f, const char *str)
+{
+    for (const unsigned char *c = (const unsigned char *)str; *c != '\0'; c++)
     {
-        if (string_buffer[i] == '\n' || string_buffer[i] == '\0')
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(f, "\\%c", *c);
+        }
+        else if (*c < 0x20)
         {
-            command_list[numb_of_commands_check][index] = '\0';
-            
-            numb_of_commands_check++;
-            index = 0;
+            fprintf(f, "\\u%04x", *c);
         }
         else
-        { 
-            command_list[numb_of_commands_check][index] = string_buffer[i];
-            index++;
+        {
+            fputc(*c, f);
         }
     }
 }
 
 /**
- * @brief Function that calculates the number of commands in file. 
+ * @brief Function that adds a pipeline to the --trace file as Chrome trace
+ *        events, for chrome://tracing or Perfetto. The pipeline is a process
+ *        and every stage a thread with its lifetime, the time posix_spawn
+ *        took, exec, the first byte and the eof of its output and its exit.
+ *        The output is only seen at a boundary, so the last stage has none.
+ *        Daemon threads share the file, it is locked while one is written.
  * 
- * @param argc number of arguments, ie file or commands
- * @param argv the actual command
- * @param buffer that holds commands
- * @param string_buffer the buffer that the @buffer sends commands to so it doesn't overwrite it. 
- * @return number of commands. 
+ * @param p the pipeline
+ * @param opts the flags
  */
-int number_of_commands(int argc, char *argv[], char *buffer, char **string_buffer)
+void print_trace(const pipeline *p, const options *opts)
 {
-    size_t size_of_string = 1;
-    *string_buffer = malloc(sizeof(**string_buffer) * size_of_string);
+    static int numb_of_events = 0;
+    FILE *f = opts->trace;
+    const struct timespec *zero = &opts->trace_start;
+    int pid = p->index;
 
-    if (*string_buffer == NULL)
+    flockfile(f);
+
+    fprintf(f, "%s{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": "
+        "{\"name\": \"pipeline %d (line %d)\"}}", numb_of_events++ > 0 ? ",\n" : "", pid, p->index, p->line);
+
+    for (int i = 0; i < p->numb_of_stages; i++)
     {
-        fprintf(stderr, "Memory allocation failed!\n");
-        exit(EXIT_FAILURE);
+        const stage *s = &p->stages[i];
+        const boundary *b = &p->boundaries[i];
+        int tid = i + 1;
+
+        if (s->pid == -1)
+        {
+            continue;
+        }
+
+        fprintf(f, ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, "
+            "\"args\": {\"name\": \"%d:", pid, tid, tid);
+        for (char **arg = s->argv; *arg != NULL; arg++)
+        {
+            fputc(' ', f);
+            print_json_chars(f, *arg);
+        }
+        fprintf(f, "\"}}");
+
+        fprintf(f, ",\n{\"ph\": \"X\", \"name\": \"stage\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, "
+            "\"dur\": %.3f, \"args\": {\"status\": %d}}", pid, tid, elapsed_ms(zero, &s->start) * 1e3, 
+            elapsed_ms(&s->start, &s->end) * 1e3, exit_status(s));
+        //a thread stage has no spawn, its exec is its start.
+        if (s->exec.tv_sec != s->start.tv_sec || s->exec.tv_nsec != s->start.tv_nsec)
+        {
+            fprintf(f, ",\n{\"ph\": \"X\", \"name\": \"spawn\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, "
+                "\"dur\": %.3f}", pid, tid, elapsed_ms(zero, &s->start) * 1e3, elapsed_ms(&s->start, &s->exec) * 1e3);
+        }
+        fprintf(f, ",\n{\"ph\": \"i\", \"s\": \"t\", \"name\": \"exec\", \"pid\": %d, \"tid\": %d, "
+            "\"ts\": %.3f}", pid, tid, elapsed_ms(zero, &s->exec) * 1e3);
+
+        //a relay that never moved a byte has no first byte.
+        if (i < p->numb_of_relays && b->bytes > 0)
+        {
+            fprintf(f, ",\n{\"ph\": \"i\", \"s\": \"t\", \"name\": \"first byte\", \"pid\": %d, "
+                "\"tid\": %d, \"ts\": %.3f}", pid, tid, elapsed_ms(zero, &b->first) * 1e3);
+            fprintf(f, ",\n{\"ph\": \"X\", \"name\": \"output\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, "
+                "\"dur\": %.3f, \"args\": {\"bytes\": %llu}}", pid, tid, elapsed_ms(zero, &b->first) * 1e3, 
+                elapsed_ms(&b->first, &b->last) * 1e3, b->bytes);
+        }
+        if (i < p->numb_of_relays)
+        {
+            fprintf(f, ",\n{\"ph\": \"i\", \"s\": \"t\", \"name\": \"%s\", \"pid\": %d, \"tid\": %d, "
+                "\"ts\": %.3f}", b->eof ? "eof" : "reader gone", pid, tid, elapsed_ms(zero, &b->last) * 1e3);
+        }
+
+        fprintf(f, ",\n{\"ph\": \"i\", \"s\": \"t\", \"name\": \"exit\", \"pid\": %d, \"tid\": %d, "
+            "\"ts\": %.3f}", pid, tid, elapsed_ms(zero, &s->end) * 1e3);
     }
 
-   *string_buffer[0] = '\0';
+    fflush(f);
+    funlockfile(f);
+}
+
+/**
+ * @brief Function that prints how much of the time the input pipe of every
+ *        stage was full or empty, and ranks the stages by how likely they
+ *        are to be the bottleneck. A stage is a bottleneck when its input
+ *        waits for it and the stages after it wait for it too, so the score
+ *        is the mean of the time its input was full and the time the inputs
+ *        of its consumers were empty. A stage that does not read a pipe
+ *        counts as always having input, one without consumers as always
+ *        having someone waiting for its output.
+ * 
+ * @param p the pipeline
+ */
+void print_profile(const pipeline *p)
+{
+    int n = p->numb_of_stages;
+    double *full = malloc(sizeof(*full) * n);
+    double *empty = malloc(sizeof(*empty) * n);
+    double *score = malloc(sizeof(*score) * n);
+    int *rank = malloc(sizeof(*rank) * n);
 
-    int lines = 0;
-     
-    //checks amount of arguments sent in. Maximum of 2. 
-    if(argc > 2)
+    if (full == NULL || empty == NULL || score == NULL || rank == NULL)
     {
-        fprintf(stderr, "usage: ./mexec [FILE]\n");
-        free(buffer);
-        free(*string_buffer);
+        fprintf(stderr, "Memory allocation failed!\n");
         exit(EXIT_FAILURE);
     }
-    //checks if file is empty or not without the "<". 
-    else if(argc == 2)
-    {   
-        //opens file to check if file is empty or not. 
-        FILE *fp = fopen(argv[1], "r");
-    
-        //check if file exists.
-        if (fp == NULL)
+
+    for (int i = 0; i < n; i++)
+    {
+        const probe *pr = &p->probes[i];
+
+        full[i] = pr->samples > 0 ? 100.0 * pr->full / pr->samples : -1;
+        empty[i] = pr->samples > 0 ? 100.0 * pr->empty / pr->samples : -1;
+    }
+
+    fprintf(stderr, "%-5s %10s %10s %10s %8s  %s\n", "stage", "samples", "in_full%", "in_empty%", "score", "command");
+    for (int i = 0; i < n; i++)
+    {
+        double waiting = 0;
+        int numb_of_consumers = 0;
+        char in_full[16] = "-";
+        char in_empty[16] = "-";
+
+        //the consumers are the next stage, or the stages that name this one.
+        for (int j = i + 1; j < n; j++)
         {
-            perror(argv[1]);
-            free(buffer);
-            free(*string_buffer);     
-            exit(EXIT_FAILURE);
+            bool consumes = !p->graph && j == i + 1;
+
+            for (int k = 0; p->graph && k < p->stages[j].numb_of_producers; k++)
+            {
+                consumes = consumes || p->stages[j].producers[k] == i;
+            }
+            if (consumes && empty[j] >= 0)
+            {
+                waiting += empty[j];
+                numb_of_consumers++;
+            }
         }
-        else
-        {    
-            lines = number_of_commands_counter(buffer, string_buffer, size_of_string, fp);
+
+        score[i] = ((full[i] >= 0 ? full[i] : 100) + (numb_of_consumers > 0 ? waiting / numb_of_consumers : 100)) / 2;
+        rank[i] = i;
+
+        if (full[i] >= 0)
+        {
+            snprintf(in_full, sizeof(in_full), "%.1f", full[i]);
+            snprintf(in_empty, sizeof(in_empty), "%.1f", empty[i]);
         }
+        fprintf(stderr, "%-5d %10lu %10s %10s %8.1f ", i + 1, p->probes[i].samples, in_full, in_empty, score[i]);
+        for (char **arg = p->stages[i].argv; *arg != NULL; arg++)
+        {
+            fprintf(stderr, " %s", *arg);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    //insertion sort, a pipeline has few stages.
+    for (int i = 1; i < n; i++)
+    {
+        int r = rank[i];
+        int j = i;
 
-        fclose(fp);
+        while (j > 0 && score[rank[j - 1]] < score[r])
+        {
+            rank[j] = rank[j - 1];
+            j--;
+        }
+        rank[j] = r;
     }
-    //with the "<"
-    else
-    {   
-        lines = number_of_commands_counter(buffer, string_buffer, size_of_string, stdin);
+
+    fprintf(stderr, "mexec: bottlenecks:");
+    for (int i = 0; i < n; i++)
+    {
+        fprintf(stderr, "%s stage %d (%s) %.1f", i > 0 ? "," : "", rank[i] + 1, p->stages[rank[i]].argv[0], score[rank[i]]);
     }
+    fprintf(stderr, "\n");
 
-    return lines;
+    free(full);
+    free(empty);
+    free(score);
+    free(rank);
 }
 
 /**
- * @brief Function that runs everything in the child process.
+ * @brief Function that chooses the cpus of every stage for --affinity. In
+ *        batch mode the pipelines that run at the same time get different
+ *        cpus, or different caches with the cache policy, by their index.
+ *        Replicated stages are always spread out, their instances share no
+ *        pipe with each other.
  * 
- * @param pipes the pipes in use
- * @param p the forks
- * @param numb_of_commands the number of commands in the file 
- * @param string_buffer buffer that stores the strings
- * @param buffer first buffer that stores all data from file
- * @param i index
+ * @param p the pipeline
+ * @param opts the flags
  */
-void child_process(int pipes[][2], pid_t p[], int numb_of_commands, char **string_buffer, char *buffer, int i)
+void place_stages(pipeline *p, const options *opts)
 {
-    //closes the pipes that are not in use.
-    for (int j = 0; j < numb_of_commands - 1; j++)
+    const topology *t = opts->topology;
+    //a daemon numbers its pipelines without end, only the place in the cpu order matters.
+    int base = (long long)(p->index - 1) * p->numb_of_stages % t->numb_of_cpus;
+
+    for (int i = 0; i < p->numb_of_stages; i++)
     {
-        if (i != j)
-        {
-            close(pipes[j][1]);
-        }
-        if (i - 1 != j)
+        stage *s = &p->stages[i];
+
+        CPU_ZERO(&s->cpus);
+        s->first_cpu = base + i;
+        s->pinned = s->replicas == 1;
+
+        switch (opts->affinity)
         {
-            close(pipes[j][0]);
+        case AFFINITY_COMPACT:
+            CPU_SET(t->compact[(base + i) % t->numb_of_cpus], &s->cpus);
+            break;
+        case AFFINITY_CACHE:
+            s->cpus = t->domains[(p->index - 1) % t->numb_of_domains];
+            break;
+        case AFFINITY_SPREAD:
+            CPU_SET(t->spread[(base + i) % t->numb_of_cpus], &s->cpus);
+            break;
+        default:
+            s->pinned = false;
+            break;
         }
     }
-    
-    char command_list[numb_of_commands][MAX_LENGTH];
+}
 
-    //calling function to get a list of commands.
-    command_list_func(*string_buffer, command_list);
-    
-    char *command[MAX_LENGTH];
+/**
+ * @brief Function that runs mexec as a daemon that takes pipelines on a
+ *        Unix socket, so a launch costs no exec of mexec and no reading of
+ *        a file. Every connection is handled by its own thread, the stages
+ *        are started and reaped there like in a normal run.
+ * 
+ * @param path path of the socket, an old socket there is replaced
+ * @param opts the flags, used for every pipeline
+ * @return EXIT_FAILURE if the socket could not be made, else it never returns
+ */
+int serve(const char *path, const options *opts)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    pthread_attr_t attr;
+    unsigned int numb_of_clients = 0;
+    sigset_t set;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "%s: Socket path too long\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (sock == -1 || bind(sock, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(sock, SOMAXCONN) == -1)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    if (pthread_attr_init(&attr) != 0 || pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0)
+    {
+        perror("Thread create failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    //a client whose reader is gone must not kill the daemon, every thread gets EPIPE instead.
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;)
+    {
+        int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        pthread_t thread;
 
-    //checks if there are more than just one command that has to run.
-    if (numb_of_commands > 1)
-    {   
-        //dup for first child
-        if (i == 0)
+        if (fd == -1)
         {
-            if (dup2(pipes[i][1], STDOUT_FILENO) < 0)
+            if (errno != EINTR && errno != ECONNABORTED)
             {
-                perror("Dup failed!");
-                close(pipes[i][1]);
-                free(buffer);
-                free(*string_buffer);
-                exit(EXIT_FAILURE);
+                perror("Accept failed!");
             }
+            continue;
         }
-        //dup for last child
-        else if (i == (numb_of_commands - 1))
+
+        client *c = malloc(sizeof(*c));
+        if (c == NULL)
         {
-            if (dup2(pipes[i-1][0], STDIN_FILENO) < 0)
-            {
-                perror("Dup failed!");
-                close(pipes[i-1][0]);
-                free(buffer);
-                free(*string_buffer);
-                exit(EXIT_FAILURE);
-            }
+            fprintf(stderr, "Memory allocation failed!\n");
+            exit(EXIT_FAILURE);
         }
-        //dup for every other child
-        else
-        {   
-            if (dup2(pipes[i-1][0], STDIN_FILENO) < 0)
+        c->fd = fd;
+        c->index = numb_of_clients++ % INT_MAX + 1;
+        c->opts = opts;
+
+        if (pthread_create(&thread, &attr, serve_client, c) != 0)
+        {
+            perror("Thread create failed!");
+            close(fd);
+            free(c);
+        }
+    }
+}
+
+/**
+ * @brief Function that runs in the thread of one connection to the daemon.
+ *        It runs the pipeline with the fds, the working directory and the
+ *        environment of the client and replies with
+ *        the exit status of the pipeline and of every stage. Errors in the
+ *        spec are printed by the daemon, the client gets exit status 1.
+ * 
+ * @param ptr the client
+ * @return NULL
+ */
+void *serve_client(void *ptr)
+{
+    client *c = ptr;
+    int fds[SERVE_NUMB_OF_FDS] = {-1, -1, -1, -1};
+    char *text;
+    size_t length;
+    char *env_text = NULL;
+    char **env = NULL;
+    serve_reply reply = {EXIT_FAILURE, 0};
+    int32_t *statuses = NULL;
+    spec sp;
+
+    if (receive_request(c->fd, fds, &text, &length, &env_text, &env) == 0 && spec_parse(text, length, &sp) == 0)
+    {
+        pipeline *p = sp.numb_of_lines > 0 ? parse_pipeline(&sp, 0, sp.numb_of_lines) : NULL;
+
+        if (p != NULL)
+        {
+            options opts = *c->opts;
+
+            p->index = c->index;
+            opts.input_fd = fds[0];
+            opts.output_fd = fds[1];
+            opts.error_fd = fds[2];
+            opts.dir_fd = fds[3];
+            opts.env = env;
+            reply.exit_code = run_jobs(&p, 1, &opts);
+            reply.numb_of_stages = p->numb_of_stages;
+
+            if ((statuses = malloc(sizeof(*statuses) * p->numb_of_stages)) == NULL)
             {
-                perror("Dup failed!");
-                close(pipes[i-1][0]);
-                free(buffer);
-                free(*string_buffer);
+                fprintf(stderr, "Memory allocation failed!\n");
                 exit(EXIT_FAILURE);
             }
-            if (dup2(pipes[i][1], STDOUT_FILENO) < 0)
+            for (int i = 0; i < p->numb_of_stages; i++)
             {
-                perror("Dup failed!");
-                close(pipes[i][1]);
-                free(buffer);
-                free(string_buffer);
-                exit(EXIT_FAILURE);
+                statuses[i] = p->stages[i].pid == -1 ? -1 : exit_status(&p->stages[i]);
             }
+            pipeline_del(p);
+        }
+        spec_free(&sp);
+    }
+
+    //the reader after the client gets its EOF when the client exits.
+    for (int i = 0; i < SERVE_NUMB_OF_FDS; i++)
+    {
+        if (fds[i] != -1)
+        {
+            close(fds[i]);
+        }
+    }
+
+    //a client that is gone must not kill the daemon with SIGPIPE.
+    if (send(c->fd, &reply, sizeof(reply), MSG_NOSIGNAL) == sizeof(reply) && statuses != NULL)
+    {
+        send(c->fd, statuses, sizeof(*statuses) * reply.numb_of_stages, MSG_NOSIGNAL);
+    }
+
+    free(statuses);
+    free(env);
+    free(env_text);
+    close(c->fd);
+    free(c);
+    return NULL;
+}
+
+/**
+ * @brief Function that receives the request of a client: the header with
+ *        the stdin, stdout, stderr and working directory of the client, then
+ *        the spec and the environment.
+ * 
+ * @param sock the connection
+ * @param fds set to the fds of the client, -1 for the ones not received
+ * @param text set to the spec, length + 1 bytes from malloc
+ * @param length set to the length of the spec
+ * @param env_text set to the variables of the environment, from malloc
+ * @param env set to the environment, pointing into env_text
+ * @return 0 on success, -1 if the request is not valid
+ */
+int receive_request(int sock, int fds[SERVE_NUMB_OF_FDS], char **text, size_t *length, char **env_text, char ***env)
+{
+    serve_request request;
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int) * SERVE_NUMB_OF_FDS)];
+    } control;
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, 
+        .msg_controllen = sizeof(control.buffer)};
+
+    *text = NULL;
+    ssize_t n = recvmsg(sock, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&message); cm != NULL; cm = CMSG_NXTHDR(&message, cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+        {
+            int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cm), sizeof(int) * (count < SERVE_NUMB_OF_FDS ? count : SERVE_NUMB_OF_FDS));
         }
     }
 
-    //tokenizing commands and sending them to a new array.
-    tokenizing(command_list, i, command);
+    bool missing = false;
+    for (int i = 0; i < SERVE_NUMB_OF_FDS; i++)
+    {
+        missing = missing || fds[i] == -1;
+    }
+
+    if (n != sizeof(request) || request.magic != SERVE_MAGIC || request.length > SERVE_MAX_SPEC 
+        || request.env_length > SERVE_MAX_ENV || missing || (message.msg_flags & MSG_CTRUNC))
+    {
+        fprintf(stderr, "mexec: invalid request\n");
+        return -1;
+    }
 
-    //check if exec returned any errors after running.
-    if (execvp(command[0], command) < 0)
+    if ((*text = malloc(request.length + 1)) == NULL || (*env_text = malloc(request.env_length + 1)) == NULL)
     {
-        perror(command[0]);
-        free(buffer);
-        free(*string_buffer);
+        fprintf(stderr, "Memory allocation failed!\n");
         exit(EXIT_FAILURE);
     }
+    if (receive_all(sock, *text, request.length) == -1 || receive_all(sock, *env_text, request.env_length) == -1)
+    {
+        fprintf(stderr, "mexec: request cut short\n");
+        free(*text);
+        *text = NULL;
+        return -1;
+    }
+
+    *env = split_environment(*env_text, request.env_length);
+    *length = request.length;
+    return 0;
 }
+
 /**
- * @brief helper function that helps with the counting of lines in number_of_commands function
+ * @brief Function that reads exactly length bytes from a client.
  * 
- * @param buffer buffer that holds commands
- * @param string_buffer buffer that @buffer sends strings to so it doesn't get overwritten.
- * @param size_of_string checks the size of string
- * @param fp file to check or stdin
- * @return lines
+ * @param sock the connection
+ * @param buffer where to put the bytes
+ * @param length number of bytes
+ * @return 0 on success, -1 if the client closed the connection
  */
-int number_of_commands_counter(char *buffer, char **string_buffer, size_t size_of_string, FILE *fp)
+int receive_all(int sock, char *buffer, size_t length)
 {
-    int lines = 0;
+    for (size_t done = 0; done < length; )
+    {
+        ssize_t n = recv(sock, buffer + done, length - done, MSG_WAITALL);
 
-    //count amount of commands in the file.     
-    while (fgets(buffer, MAX_LENGTH_WITH_TERMINATORS, fp) != NULL)
-    {    
-        //check the maximum amout of characters.
-        if (strlen(buffer) <= MAX_LENGTH_WITH_TERMINATORS)
+        if (n < 0 && errno == EINTR)
         {
-            *string_buffer = realloc(*string_buffer, sizeof(**string_buffer)*strlen(buffer)+size_of_string);
-            if (*string_buffer == NULL)
-            {
-                fprintf(stderr, "Memory allocation failed!\n");
-                exit(EXIT_FAILURE);
-            }
-            size_of_string = sizeof(**string_buffer)*strlen(buffer)+size_of_string;
-            strcat(*string_buffer, buffer);
-            lines++;
+            continue;
         }
-        else
+        if (n <= 0)
         {
-            fprintf(stderr, "Command length longer than 1024 characters\n");
-            free(buffer);
-            free(*string_buffer);      
-            exit(EXIT_FAILURE);
-        } 
+            return -1;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that makes an environment of variables that each end with
+ *        a '\0'. A last variable without one is ended too.
+ * 
+ * @param text the variables, length + 1 bytes
+ * @param length number of bytes of the variables
+ * @return NULL terminated array pointing into text, from malloc
+ */
+char **split_environment(char *text, size_t length)
+{
+    size_t count = 0;
+
+    text[length] = '\0';
+    for (size_t i = 0; i < length; i++)
+    {
+        count += text[i] == '\0' || i == length - 1;
     }
 
-    return lines;      
-}
\ No newline at end of file
+    char **env = malloc(sizeof(*env) * (count + 1));
+    if (env == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    count = 0;
+    for (size_t i = 0; i < length; i += strlen(text + i) + 1)
+    {
+        env[count++] = text + i;
+    }
+    env[count] = NULL;
+    return env;
+}
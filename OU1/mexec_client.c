@@ -0,0 +1,247 @@
+/**
+ * @file mexec_client.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief Program that runs a pipeline in a mexec --serve daemon. It sends
+ *        the spec, its stdin, stdout and stderr, its working directory and
+ *        its environment to the daemon and exits with the exit status of the
+ *        pipeline.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "serve.h"
+
+#define USAGE "usage: ./mexec_client SOCKET [FILE]\n"
+
+//bytes read at a time from the spec.
+#define READ_SIZE (64 * 1024)
+
+extern char **environ;
+
+/**
+ * @brief Function that reads a whole file into a buffer that doubles when
+ *        it is full.
+ *
+ * @param fd the file
+ * @param length set to the number of bytes
+ * @return the bytes
+ */
+static char *read_spec(int fd, size_t *length)
+{
+    size_t capacity = READ_SIZE;
+    char *text = malloc(capacity);
+    ssize_t n;
+
+    *length = 0;
+    while (text != NULL && (n = read(fd, text + *length, capacity - *length)) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            perror("Read failed!");
+            exit(EXIT_FAILURE);
+        }
+        *length += n;
+        if (*length == capacity)
+        {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+
+    if (text == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    return text;
+}
+
+/**
+ * @brief Function that puts the environment after the spec, every variable
+ *        ended by a '\0'.
+ *
+ * @param text the spec, grown to hold the environment too
+ * @param length length of the spec
+ * @param env_length set to the number of bytes of the environment
+ * @return the spec followed by the environment
+ */
+static char *append_environment(char *text, size_t length, size_t *env_length)
+{
+    *env_length = 0;
+    for (char **var = environ; *var != NULL; var++)
+    {
+        *env_length += strlen(*var) + 1;
+    }
+
+    char *grown = realloc(text, length + *env_length);
+    if (grown == NULL && length + *env_length > 0)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *end = grown + length;
+    for (char **var = environ; *var != NULL; var++)
+    {
+        size_t size = strlen(*var) + 1;
+
+        memcpy(end, *var, size);
+        end += size;
+    }
+
+    return grown;
+}
+
+/**
+ * @brief Function that reads exactly length bytes from the daemon.
+ *
+ * @param sock the connection
+ * @param buffer where to put the bytes
+ * @param length number of bytes
+ * @return 0 on success, -1 if the daemon closed the connection
+ */
+static int receive_all(int sock, void *buffer, size_t length)
+{
+    for (size_t done = 0; done < length; )
+    {
+        ssize_t n = recv(sock, (char *)buffer + done, length - done, MSG_WAITALL);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Main function that sends the pipeline to the daemon and waits for
+ *        it to finish.
+ *
+ * @param argc number of arguments
+ * @param argv the socket and the file with the spec, stdin without one
+ * @return the exit status of the pipeline
+ */
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    if (argc < 2 || argc > 3 || strlen(argv[1]) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, argv[1]);
+
+    int fd = argc == 3 ? open(argv[2], O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+    if (fd == -1)
+    {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    size_t length;
+    size_t env_length;
+    char *text = read_spec(fd, &length);
+    if (fd != STDIN_FILENO)
+    {
+        close(fd);
+    }
+    text = append_environment(text, length, &env_length);
+
+    //the stages open relative paths from here, it only has to be found again.
+    int dir_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1)
+    {
+        perror(".");
+        return EXIT_FAILURE;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    //the header carries stdin, stdout, stderr and the directory, the spec and environment follow it.
+    serve_request request = {SERVE_MAGIC, length, env_length};
+    int fds[SERVE_NUMB_OF_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, dir_fd};
+    size_t body = length + env_length;
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct iovec iov[2] = {{&request, sizeof(request)}, {text, body}};
+    struct msghdr message = {.msg_iov = iov, .msg_iovlen = 2, .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer)};
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&message);
+
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    ssize_t sent = sendmsg(sock, &message, MSG_NOSIGNAL);
+    while (sent >= 0 && (size_t)sent < sizeof(request) + body)
+    {
+        size_t done = sent - sizeof(request);
+        ssize_t n = send(sock, text + done, body - done, MSG_NOSIGNAL);
+
+        sent = n < 0 ? n : sent + n;
+    }
+    free(text);
+    close(dir_fd);
+
+    serve_reply reply;
+    if (sent < 0 || receive_all(sock, &reply, sizeof(reply)) == -1)
+    {
+        fprintf(stderr, "mexec_client: no reply from %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    //the failed stages are shown like mexec shows them in batch mode.
+    for (int i = 0; i < reply.numb_of_stages; i++)
+    {
+        int32_t status;
+
+        if (receive_all(sock, &status, sizeof(status)) == -1)
+        {
+            break;
+        }
+        if (status == -1)
+        {
+            fprintf(stderr, "mexec: stage %d not started\n", i + 1);
+        }
+        else if (status != 0 && reply.exit_code != 0)
+        {
+            fprintf(stderr, "mexec: stage %d exit %d\n", i + 1, status);
+        }
+    }
+
+    close(sock);
+    return reply.exit_code;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file profile.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of the sampling of pipes for --profile.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "profile.h"
+
+//time between two samples, 1000 samples a second.
+#define SAMPLE_INTERVAL_NS 1000000
+
+// ===========INTERNAL DATA TYPES============
+
+struct monitor
+{
+    probe *probes;
+    int count;
+    atomic_bool running;
+    pthread_t thread;
+};
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that runs in the monitor thread. It wakes at a fixed rate,
+ *        not a fixed time after the last sample, so a slow sample does not
+ *        lower the rate.
+ *
+ * @param ptr the monitor
+ * @return NULL
+ */
+static void *sample(void *ptr)
+{
+    monitor *m = ptr;
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (m->running)
+    {
+        for (int i = 0; i < m->count; i++)
+        {
+            probe *pr = &m->probes[i];
+            int queued;
+
+            if (pr->fd == -1)
+            {
+                continue;
+            }
+            if (pr->done)
+            {
+                close(pr->fd);
+                pr->fd = -1;
+                continue;
+            }
+            if (ioctl(pr->fd, FIONREAD, &queued) == 0)
+            {
+                pr->samples++;
+                pr->empty += queued == 0;
+                pr->full += queued >= pr->full_at;
+            }
+        }
+
+        next.tv_nsec += SAMPLE_INTERVAL_NS;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+        {
+            continue;
+        }
+    }
+
+    return NULL;
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that makes a probe that watches nothing.
+ *
+ * @param pr the probe
+ */
+void probe_init(probe *pr)
+{
+    pr->fd = -1;
+    pr->full_at = 0;
+    atomic_init(&pr->done, false);
+    pr->samples = 0;
+    pr->full = 0;
+    pr->empty = 0;
+}
+
+/**
+ * @brief Function that lets a probe watch the pipe fd is an end of. Nothing
+ *        is watched if fd is not a pipe.
+ *
+ * @param pr the probe
+ * @param fd end of the pipe, the probe keeps a copy of it
+ */
+void probe_attach(probe *pr, int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || !S_ISFIFO(st.st_mode))
+    {
+        return;
+    }
+
+    //a pipe is full when its last page can not take more, not at the last byte.
+    int capacity = fcntl(fd, F_GETPIPE_SZ);
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (capacity <= 0 || (pr->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1)
+    {
+        pr->fd = -1;
+        return;
+    }
+    pr->full_at = capacity > page ? capacity - page : capacity;
+}
+
+/**
+ * @brief Function that tells the monitor that the reader of the pipe is
+ *        gone, so the copy of the pipe is closed.
+ *
+ * @param pr the probe
+ */
+void probe_detach(probe *pr)
+{
+    pr->done = true;
+}
+
+/**
+ * @brief Function that starts a thread that samples every probe in the
+ *        array until monitor_stop.
+ *
+ * @param probes the probes, attached before the monitor is started
+ * @param count number of probes
+ * @return monitor* that was started
+ */
+monitor *monitor_start(probe *probes, int count)
+{
+    monitor *m = malloc(sizeof(*m));
+
+    if (m == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+
+    m->probes = probes;
+    m->count = count;
+    atomic_init(&m->running, true);
+
+    if (pthread_create(&m->thread, NULL, sample, m) != 0)
+    {
+        perror("Thread create failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    return m;
+}
+
+/**
+ * @brief Function that stops a monitor, closes the pipes of the probes and
+ *        frees it. The counts of the probes can be read after this.
+ *
+ * @param m the monitor
+ */
+void monitor_stop(monitor *m)
+{
+    m->running = false;
+    pthread_join(m->thread, NULL);
+
+    for (int i = 0; i < m->count; i++)
+    {
+        if (m->probes[i].fd != -1)
+        {
+            close(m->probes[i].fd);
+            m->probes[i].fd = -1;
+        }
+    }
+
+    free(m);
+}
@@ -0,0 +1,79 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * A probe watches the pipe a stage reads from. A monitor thread looks at
+ * how many bytes are queued in every probed pipe with FIONREAD at a fixed
+ * rate. A pipe that is full most of the time has a slow reader, one that
+ * is empty most of the time has a reader that waits for its writer.
+ *
+ * The probe holds a copy of the read end, so a writer would not see its
+ * reader exit. probe_detach is called when the reader is gone and the
+ * monitor closes the copy at its next sample.
+ */
+
+// Probe type.
+typedef struct probe
+{
+    int fd;
+    //queued bytes from which the pipe counts as full.
+    int full_at;
+    atomic_bool done;
+    unsigned long samples;
+    unsigned long full;
+    unsigned long empty;
+} probe;
+
+// Monitor type.
+typedef struct monitor monitor;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that makes a probe that watches nothing.
+ *
+ * @param pr the probe
+ */
+void probe_init(probe *pr);
+
+/**
+ * @brief Function that lets a probe watch the pipe fd is an end of. Nothing
+ *        is watched if fd is not a pipe.
+ *
+ * @param pr the probe
+ * @param fd end of the pipe, the probe keeps a copy of it
+ */
+void probe_attach(probe *pr, int fd);
+
+/**
+ * @brief Function that tells the monitor that the reader of the pipe is
+ *        gone, so the copy of the pipe is closed.
+ *
+ * @param pr the probe
+ */
+void probe_detach(probe *pr);
+
+/**
+ * @brief Function that starts a thread that samples every probe in the
+ *        array until monitor_stop.
+ *
+ * @param probes the probes, attached before the monitor is started
+ * @param count number of probes
+ * @return monitor* that was started
+ */
+monitor *monitor_start(probe *probes, int count);
+
+/**
+ * @brief Function that stops a monitor, closes the pipes of the probes and
+ *        frees it. The counts of the probes can be read after this.
+ *
+ * @param m the monitor
+ */
+void monitor_stop(monitor *m);
+
+#endif
@@ -0,0 +1,576 @@
+/**
+ * @file replicate.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of stages that run in several instances at once.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "replicate.h"
+
+//bytes read for one block before it is cut at the last newline.
+#define BLOCK_SIZE (1 << 20)
+
+// ===========INTERNAL DATA TYPES============
+
+struct replica_set
+{
+    char **argv;
+    char *path;
+    int replicas;
+    bool ordered;
+    int dir_fd;
+    char **env;
+    int in_fd;
+    int out_fd;
+    int done_fd;
+    pthread_t *threads;
+    int live;
+    //guards the input, the counters and the result.
+    pthread_mutex_t mutex;
+    //guards the output so blocks are never mixed.
+    pthread_mutex_t write_mutex;
+    pthread_cond_t turn;
+    char *carry;
+    size_t carry_length;
+    bool eof;
+    //set when the next stage is gone.
+    atomic_bool stop;
+    //pids of the running instances, 0 in a free slot.
+    pid_t *pids;
+    pthread_mutex_t pid_mutex;
+    //signal given to replicas_kill, 0 while the stage may run.
+    int killed;
+    unsigned long long next_block;
+    unsigned long long next_output;
+    bool succeeded;
+    //true for grep, whose exit 1 only means no line was selected.
+    bool grep_like;
+    int failed_status;
+    int error_status;
+    struct rusage usage;
+};
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that reads the next block of input. The block ends after
+ *        the last newline that was read, the rest is kept for the next block.
+ *        The caller holds the mutex.
+ *
+ * @param r the replicated stage
+ * @param block set to the block, freed by the caller
+ * @param length set to the length of the block
+ * @param seq set to the number of the block
+ * @return true if a block was read, false at the end of the input
+ */
+static bool read_block(replica_set *r, char **block, size_t *length, unsigned long long *seq)
+{
+    if (r->stop || (r->eof && r->carry_length == 0))
+    {
+        return false;
+    }
+
+    size_t capacity = r->carry_length + BLOCK_SIZE;
+    size_t used = r->carry_length;
+    char *buffer = malloc(capacity);
+    char *newline = NULL;
+
+    if (buffer == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(buffer, r->carry, r->carry_length);
+
+    //reads until the block is full and has a newline, or the input ends.
+    while (!r->eof && (used < BLOCK_SIZE || (newline = memrchr(buffer, '\n', used)) == NULL))
+    {
+        if (used == capacity)
+        {
+            capacity *= 2;
+            if ((buffer = realloc(buffer, capacity)) == NULL)
+            {
+                perror("Failed to allocate");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        ssize_t n = read(r->in_fd, buffer + used, capacity - used);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            perror("Read failed!");
+        }
+        if (n <= 0)
+        {
+            r->eof = true;
+            break;
+        }
+        used += n;
+    }
+
+    //at the end of the input the last line does not need a newline.
+    size_t cut = r->eof || newline == NULL ? used : (size_t)(newline - buffer) + 1;
+
+    r->carry_length = used - cut;
+    if ((r->carry = realloc(r->carry, r->carry_length + 1)) == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(r->carry, buffer + cut, r->carry_length);
+
+    if (cut == 0)
+    {
+        free(buffer);
+        return false;
+    }
+
+    *block = buffer;
+    *length = cut;
+    *seq = r->next_block++;
+    return true;
+}
+
+/**
+ * @brief Function that writes all of a buffer to an fd.
+ *
+ * @param fd fd to write to
+ * @param buffer the data
+ * @param length length of the data
+ * @return 0 on success, -1 on failure
+ */
+static int write_all(int fd, const char *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, buffer, length);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        buffer += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that runs one instance on one block. The block and the
+ *        output are kept in memory files, so the instance never waits for
+ *        mexec and the output can be written whole afterwards.
+ *
+ * @param r the replicated stage
+ * @param block the input of the instance
+ * @param length length of the input
+ * @param output set to a memory file with the output, or -1
+ * @param usage set to the resource usage of the instance
+ * @return wait status of the instance
+ */
+static int run_instance(replica_set *r, const char *block, size_t length, int *output, struct rusage *usage)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+    pid_t pid;
+    int status = 0;
+    int input = memfd_create("mexec-block", MFD_CLOEXEC);
+
+    *output = memfd_create("mexec-output", MFD_CLOEXEC);
+    memset(usage, 0, sizeof(*usage));
+
+    if (input == -1 || *output == -1 || write_all(input, block, length) == -1 || lseek(input, 0, SEEK_SET) == -1)
+    {
+        perror("Block failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    //the thread blocks SIGPIPE, the instance must not inherit that.
+    sigemptyset(&none);
+    if (posix_spawn_file_actions_init(&actions) != 0 || posix_spawnattr_init(&attr) != 0
+        || posix_spawnattr_setsigmask(&attr, &none) != 0 || posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK) != 0
+        || posix_spawn_file_actions_adddup2(&actions, input, STDIN_FILENO) != 0
+        || posix_spawn_file_actions_adddup2(&actions, *output, STDOUT_FILENO) != 0
+        || (r->dir_fd != AT_FDCWD && posix_spawn_file_actions_addfchdir_np(&actions, r->dir_fd) != 0))
+    {
+        perror("Spawn failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    int error = posix_spawn(&pid, r->path, &actions, &attr, r->argv, r->env);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(input);
+
+    //a command that cannot be started fails like it does in the shell.
+    if (error != 0)
+    {
+        fprintf(stderr, "%s: %s\n", r->argv[0], strerror(error));
+        r->stop = true;
+        return 127 << 8;
+    }
+
+    //the pid is known to replicas_kill while the instance runs.
+    int slot = 0;
+    pthread_mutex_lock(&r->pid_mutex);
+    while (r->pids[slot] != 0)
+    {
+        slot++;
+    }
+    r->pids[slot] = pid;
+    if (r->killed != 0)
+    {
+        kill(pid, r->killed);
+    }
+    pthread_mutex_unlock(&r->pid_mutex);
+
+    //the slot is freed before the instance is reaped, so its pid can not be reused while it is there.
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR)
+    {
+        continue;
+    }
+    pthread_mutex_lock(&r->pid_mutex);
+    r->pids[slot] = 0;
+    pthread_mutex_unlock(&r->pid_mutex);
+
+    while (wait4(pid, &status, 0, usage) < 0)
+    {
+        if (errno != EINTR)
+        {
+            perror("Wait failed!");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return status;
+}
+
+/**
+ * @brief Function that copies the output of one instance to the next stage
+ *        when it is its turn. In ordered mode block n waits for block n - 1.
+ *
+ * @param r the replicated stage
+ * @param output memory file with the output
+ * @param seq number of the block
+ */
+static void write_output(replica_set *r, int output, unsigned long long seq)
+{
+    struct stat st;
+    off_t offset = 0;
+
+    pthread_mutex_lock(&r->write_mutex);
+    while (r->ordered && r->next_output != seq)
+    {
+        pthread_cond_wait(&r->turn, &r->write_mutex);
+    }
+
+    if (output != -1 && fstat(output, &st) == 0)
+    {
+        while (!r->stop && offset < st.st_size)
+        {
+            ssize_t n = sendfile(r->out_fd, output, &offset, st.st_size - offset);
+
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            //EPIPE means the next stage is gone, there is no use reading more.
+            if (n <= 0)
+            {
+                if (errno != EPIPE)
+                {
+                    perror("Write failed!");
+                }
+                r->stop = true;
+            }
+        }
+    }
+
+    r->next_output++;
+    pthread_cond_broadcast(&r->turn);
+    pthread_mutex_unlock(&r->write_mutex);
+}
+
+/**
+ * @brief Function that tells if a command is grep, found by the last part of
+ *        argv[0].
+ *
+ * @param command argv[0] of the command
+ * @return true for grep, egrep and fgrep
+ */
+static bool is_grep(const char *command)
+{
+    const char *slash = strrchr(command, '/');
+    const char *name = slash != NULL ? slash + 1 : command;
+
+    return strcmp(name, "grep") == 0 || strcmp(name, "egrep") == 0 || strcmp(name, "fgrep") == 0;
+}
+
+/**
+ * @brief Function that adds the result of one instance to the stage. Any
+ *        instance that fails makes the stage fail, except that for grep an
+ *        instance that exits with 1 only makes the stage fail if no other
+ *        instance succeeded, so `@4 grep X` reports like one grep would.
+ *
+ * @param r the replicated stage
+ * @param status wait status of the instance
+ * @param usage resource usage of the instance
+ */
+static void add_result(replica_set *r, int status, const struct rusage *usage)
+{
+    pthread_mutex_lock(&r->mutex);
+
+    if (status == 0)
+    {
+        r->succeeded = true;
+    }
+    else if (r->grep_like && WIFEXITED(status) && WEXITSTATUS(status) == 1)
+    {
+        r->failed_status = r->failed_status != 0 ? r->failed_status : status;
+    }
+    else if (r->error_status == 0)
+    {
+        r->error_status = status;
+    }
+
+    timeradd(&r->usage.ru_utime, &usage->ru_utime, &r->usage.ru_utime);
+    timeradd(&r->usage.ru_stime, &usage->ru_stime, &r->usage.ru_stime);
+    r->usage.ru_maxrss = usage->ru_maxrss > r->usage.ru_maxrss ? usage->ru_maxrss : r->usage.ru_maxrss;
+    r->usage.ru_nvcsw += usage->ru_nvcsw;
+    r->usage.ru_nivcsw += usage->ru_nivcsw;
+
+    pthread_mutex_unlock(&r->mutex);
+}
+
+/**
+ * @brief Function that runs in every thread of the stage. It takes the next
+ *        block, runs an instance on it and writes the output, until the
+ *        input ends. The last thread closes the fds and signals done_fd.
+ *
+ * @param ptr the replicated stage
+ * @return NULL
+ */
+static void *replica_worker(void *ptr)
+{
+    replica_set *r = ptr;
+    sigset_t set;
+
+    //a next stage that exits gives EPIPE here instead of killing mexec.
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;)
+    {
+        char *block;
+        size_t length;
+        unsigned long long seq;
+        struct rusage usage;
+        int output;
+
+        pthread_mutex_lock(&r->mutex);
+        bool more = read_block(r, &block, &length, &seq);
+        pthread_mutex_unlock(&r->mutex);
+
+        if (!more)
+        {
+            break;
+        }
+
+        int status = run_instance(r, block, length, &output, &usage);
+        free(block);
+        write_output(r, output, seq);
+        add_result(r, status, &usage);
+        close(output);
+    }
+
+    pthread_mutex_lock(&r->mutex);
+    bool last = --r->live == 0;
+    pthread_mutex_unlock(&r->mutex);
+
+    //closing the fds at once gives the next stage its EOF.
+    if (last)
+    {
+        close(r->in_fd);
+        close(r->out_fd);
+        eventfd_write(r->done_fd, 1);
+    }
+
+    return NULL;
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that starts the threads of a replicated stage. The set
+ *        takes over in_fd and out_fd and closes them when it is done.
+ *
+ * @param argv the command
+ * @param path the program to run, argv[0] looked up in the PATH of env
+ * @param replicas number of instances that may run at the same time
+ * @param ordered true if the outputs are written in input order
+ * @param dir_fd working directory of the instances, or AT_FDCWD
+ * @param env environment of the instances
+ * @param in_fd fd to read the input from
+ * @param out_fd fd to write the output to
+ * @param cpus one cpu set per thread, its instances run there, or NULL
+ * @return replica_set* whose done_fd becomes readable when the stage is done
+ */
+replica_set *replicas_start(char **argv, const char *path, int replicas, bool ordered, int dir_fd, char **env, int in_fd, int out_fd,
+    const cpu_set_t *cpus)
+{
+    replica_set *r = calloc(1, sizeof(*r));
+
+    if (r == NULL || (r->threads = calloc(replicas, sizeof(*r->threads))) == NULL
+        || (r->pids = calloc(replicas, sizeof(*r->pids))) == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+
+    r->argv = argv;
+    if ((r->path = strdup(path)) == NULL)
+    {
+        perror("Failed to allocate");
+        exit(EXIT_FAILURE);
+    }
+    r->replicas = replicas;
+    r->ordered = ordered;
+    r->grep_like = is_grep(argv[0]);
+    r->dir_fd = dir_fd;
+    r->env = env;
+    r->in_fd = in_fd;
+    r->out_fd = out_fd;
+    r->live = replicas;
+
+    if ((r->done_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+    {
+        perror("Eventfd failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pthread_mutex_init(&r->mutex, NULL) != 0 || pthread_mutex_init(&r->write_mutex, NULL) != 0
+        || pthread_mutex_init(&r->pid_mutex, NULL) != 0 || pthread_cond_init(&r->turn, NULL) != 0)
+    {
+        perror("Mutex failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    //an instance is spawned by its thread and starts on the cpus of the thread.
+    for (int i = 0; i < replicas; i++)
+    {
+        pthread_attr_t attr;
+
+        if (pthread_attr_init(&attr) != 0
+            || (cpus != NULL && pthread_attr_setaffinity_np(&attr, sizeof(cpus[i]), &cpus[i]) != 0)
+            || pthread_create(&r->threads[i], &attr, replica_worker, r) != 0)
+        {
+            perror("Thread create failed!");
+            exit(EXIT_FAILURE);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    return r;
+}
+
+/**
+ * @brief Function that returns an fd that becomes readable when every
+ *        instance has ended and all output is written.
+ *
+ * @param r the replicated stage
+ * @return the fd
+ */
+int replicas_done_fd(const replica_set *r)
+{
+    return r->done_fd;
+}
+
+/**
+ * @brief Function that stops a replicated stage. No more blocks are taken
+ *        and the running instances get the signal.
+ *
+ * @param r the replicated stage
+ * @param sig the signal
+ */
+void replicas_kill(replica_set *r, int sig)
+{
+    r->stop = true;
+
+    pthread_mutex_lock(&r->pid_mutex);
+    r->killed = r->killed != 0 ? r->killed : sig;
+    for (int i = 0; i < r->replicas; i++)
+    {
+        if (r->pids[i] != 0)
+        {
+            kill(r->pids[i], sig);
+        }
+    }
+    pthread_mutex_unlock(&r->pid_mutex);
+}
+
+/**
+ * @brief Function that waits for a replicated stage and frees it.
+ *
+ * @param r the replicated stage
+ * @param usage set to the summed resource usage of the instances
+ * @return wait status of the first instance that failed, or 0
+ */
+int replicas_wait(replica_set *r, struct rusage *usage)
+{
+    for (int i = 0; i < r->replicas; i++)
+    {
+        pthread_join(r->threads[i], NULL);
+    }
+
+    int status = r->error_status != 0 ? r->error_status : r->succeeded || r->next_block == 0 ? 0 : r->failed_status;
+
+    //a killed stage reports the signal, like a process would.
+    status = r->killed != 0 ? r->killed : status;
+
+    *usage = r->usage;
+    close(r->done_fd);
+    pthread_mutex_destroy(&r->mutex);
+    pthread_mutex_destroy(&r->write_mutex);
+    pthread_mutex_destroy(&r->pid_mutex);
+    pthread_cond_destroy(&r->turn);
+    free(r->carry);
+    free(r->path);
+    free(r->pids);
+    free(r->threads);
+    free(r);
+    return status;
+}
@@ -0,0 +1,68 @@
+#ifndef __REPLICATE_H
+#define __REPLICATE_H
+
+#include <stdbool.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * A replicated stage runs its command in several instances at once. The
+ * input is cut into blocks that end on a newline and each block is given to
+ * the next free instance. An instance is started per block so the end of
+ * its output is known, which lets the outputs be written whole and, if
+ * asked for, in the same order as the input.
+ */
+
+// Replicated stage type.
+typedef struct replica_set replica_set;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that starts the threads of a replicated stage. The set
+ *        takes over in_fd and out_fd and closes them when it is done.
+ *
+ * @param argv the command
+ * @param path the program to run, argv[0] looked up in the PATH of env
+ * @param replicas number of instances that may run at the same time
+ * @param ordered true if the outputs are written in input order
+ * @param dir_fd working directory of the instances, or AT_FDCWD
+ * @param env environment of the instances
+ * @param in_fd fd to read the input from
+ * @param out_fd fd to write the output to
+ * @param cpus one cpu set per thread, its instances run there, or NULL
+ * @return replica_set* whose done_fd becomes readable when the stage is done
+ */
+replica_set *replicas_start(char **argv, const char *path, int replicas, bool ordered, int dir_fd, char **env, int in_fd, int out_fd,
+    const cpu_set_t *cpus);
+
+/**
+ * @brief Function that returns an fd that becomes readable when every
+ *        instance has ended and all output is written.
+ *
+ * @param r the replicated stage
+ * @return the fd
+ */
+int replicas_done_fd(const replica_set *r);
+
+/**
+ * @brief Function that stops a replicated stage. No more blocks are taken
+ *        and the running instances get the signal.
+ *
+ * @param r the replicated stage
+ * @param sig the signal
+ */
+void replicas_kill(replica_set *r, int sig);
+
+/**
+ * @brief Function that waits for a replicated stage and frees it.
+ *
+ * @param r the replicated stage
+ * @param usage set to the summed resource usage of the instances
+ * @return wait status of the first instance that failed, or 0
+ */
+int replicas_wait(replica_set *r, struct rusage *usage);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __SERVE_H
+#define __SERVE_H
+
+#include <stdint.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * The protocol between mexec --serve SOCKET and mexec_client, over a Unix
+ * stream socket. One connection runs one pipeline:
+ *
+ *	client: serve_request, with stdin, stdout, stderr and the working
+ *		directory of the client attached as SCM_RIGHTS, then length
+ *		bytes of pipeline spec, then env_length bytes of environment,
+ *		every variable ended by a '\0'
+ *	daemon: serve_reply, then numb_of_stages int32_t, the exit status of
+ *		every stage or -1 for a stage that was not started
+ *
+ * The stages get the fds, the working directory and the environment of the
+ * client, so they read and write where the client would have, and the
+ * client exits with exit_code. Commands are looked up in the PATH of the
+ * client as well.
+ */
+
+//first field of every request.
+#define SERVE_MAGIC 0x6d786563
+
+//the largest spec the daemon takes.
+#define SERVE_MAX_SPEC (64 * 1024 * 1024)
+
+//the largest environment the daemon takes.
+#define SERVE_MAX_ENV (1024 * 1024)
+
+//fds attached to a request.
+#define SERVE_NUMB_OF_FDS 4
+
+// Request type.
+typedef struct serve_request
+{
+    uint32_t magic;
+    uint32_t length;
+    uint32_t env_length;
+} serve_request;
+
+// Reply type.
+typedef struct serve_reply
+{
+    int32_t exit_code;
+    int32_t numb_of_stages;
+} serve_reply;
+
+#endif
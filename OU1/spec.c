@@ -0,0 +1,422 @@
+/**
+ * @file spec.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of the reader of pipeline files.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spec.h"
+
+//bytes read at a time when the file can not be mapped.
+#define READ_SIZE (64 * 1024)
+
+// ===========INTERNAL DATA TYPES============
+
+//growing arrays used while the words are found.
+typedef struct builder
+{
+    char **words;
+    //true for the words that had quotes or backslashes.
+    bool *quoted;
+    size_t numb_of_words;
+    size_t words_capacity;
+    //index in words of the first word of every line.
+    size_t *starts;
+    int *numbers;
+    int numb_of_lines;
+    int lines_capacity;
+} builder;
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that maps a regular file with one byte more than its
+ *        size, so the text can be terminated and tokenized in place. The
+ *        mapping is private, writing to it never changes the file.
+ *
+ * @param fd the file
+ * @param size size of the file
+ * @param s the spec
+ * @return 0 on success, -1 if the file could not be mapped
+ */
+static int map_file(int fd, size_t size, spec *s)
+{
+    //an anonymous mapping holds the place, the file is mapped over its start.
+    char *text = mmap(NULL, size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (text == MAP_FAILED)
+    {
+        return -1;
+    }
+    if (size > 0 && mmap(text, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(text, size + 1);
+        return -1;
+    }
+
+    text[size] = '\0';
+    s->text = text;
+    s->length = size;
+    s->mapped = true;
+    return 0;
+}
+
+/**
+ * @brief Function that reads a file that can not be mapped, like a pipe,
+ *        into a buffer that doubles when it is full.
+ *
+ * @param fd the file
+ * @param s the spec
+ * @return 0 on success, -1 on a read error
+ */
+static int read_file(int fd, spec *s)
+{
+    size_t capacity = READ_SIZE;
+    size_t used = 0;
+    char *text = malloc(capacity + 1);
+    ssize_t n;
+
+    if (text == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while ((n = read(fd, text + used, capacity - used)) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            free(text);
+            return -1;
+        }
+
+        used += n;
+        if (used == capacity)
+        {
+            capacity *= 2;
+            if ((text = realloc(text, capacity + 1)) == NULL)
+            {
+                fprintf(stderr, "Memory allocation failed!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    text[used] = '\0';
+    s->text = text;
+    s->length = used;
+    s->mapped = false;
+    return 0;
+}
+
+/**
+ * @brief Function that adds a word, or the NULL that ends a line.
+ *
+ * @param b the arrays
+ * @param word the word
+ * @param quoted true if the word had quotes or backslashes
+ */
+static void add_word(builder *b, char *word, bool quoted)
+{
+    if (b->numb_of_words == b->words_capacity)
+    {
+        b->words_capacity = b->words_capacity == 0 ? 256 : b->words_capacity * 2;
+        b->words = realloc(b->words, sizeof(*b->words) * b->words_capacity);
+        b->quoted = realloc(b->quoted, sizeof(*b->quoted) * b->words_capacity);
+        if (b->words == NULL || b->quoted == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    b->quoted[b->numb_of_words] = quoted;
+    b->words[b->numb_of_words++] = word;
+}
+
+/**
+ * @brief Function that starts a new line.
+ *
+ * @param b the arrays
+ * @param number line number in the file
+ */
+static void add_line(builder *b, int number)
+{
+    if (b->numb_of_lines == b->lines_capacity)
+    {
+        b->lines_capacity = b->lines_capacity == 0 ? 64 : b->lines_capacity * 2;
+        b->starts = realloc(b->starts, sizeof(*b->starts) * b->lines_capacity);
+        b->numbers = realloc(b->numbers, sizeof(*b->numbers) * b->lines_capacity);
+        if (b->starts == NULL || b->numbers == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    b->starts[b->numb_of_lines] = b->numb_of_words;
+    b->numbers[b->numb_of_lines++] = number;
+}
+
+/**
+ * @brief Function that splits the text into words in one pass. A word with
+ *        quotes or backslashes is shorter than its text, so the word is
+ *        copied to the left as it is read and never overwrites text that is
+ *        not read yet.
+ *
+ * @param s the spec
+ * @param b the arrays to fill in
+ * @return 0 on success, -1 if a quote is not closed
+ */
+static int tokenize(spec *s, builder *b)
+{
+    char *in = s->text;
+    char *out = s->text;
+    char *end = s->text + s->length;
+    int number = 1;
+    bool in_line = false;
+
+    while (in < end)
+    {
+        if (!in_line)
+        {
+            add_line(b, number);
+            in_line = true;
+        }
+
+        if (*in == '\n')
+        {
+            add_word(b, NULL, false);
+            in_line = false;
+            number++;
+            in++;
+            continue;
+        }
+        if (*in == ' ' || *in == '\t' || *in == '\r')
+        {
+            in++;
+            continue;
+        }
+
+        char *word = out;
+        int first = number;
+        bool quoted = false;
+
+        while (in < end && *in != ' ' && *in != '\t' && *in != '\r' && *in != '\n')
+        {
+            if (*in == '\'' || *in == '"')
+            {
+                char quote = *in++;
+
+                quoted = true;
+                while (in < end && *in != quote)
+                {
+                    //only \" and \\ are escapes between double quotes.
+                    if (quote == '"' && *in == '\\' && in + 1 < end && (in[1] == '"' || in[1] == '\\'))
+                    {
+                        in++;
+                    }
+                    number += *in == '\n';
+                    *out++ = *in++;
+                }
+                if (in == end)
+                {
+                    fprintf(stderr, "Unterminated quote on line %d\n", first);
+                    return -1;
+                }
+                in++;
+            }
+            else if (*in == '\\' && in + 1 < end)
+            {
+                //a backslash before a newline continues the line.
+                if (*++in == '\n')
+                {
+                    number++;
+                    in++;
+                    continue;
+                }
+                quoted = true;
+                *out++ = *in++;
+            }
+            else
+            {
+                *out++ = *in++;
+            }
+        }
+
+        //the separator is read before the terminator can overwrite it.
+        char separator = in < end ? *in : '\0';
+        *out++ = '\0';
+        add_word(b, word, quoted);
+
+        if (separator == '\n')
+        {
+            add_word(b, NULL, false);
+            in_line = false;
+            number++;
+        }
+        in += separator != '\0';
+    }
+
+    if (in_line)
+    {
+        add_word(b, NULL, false);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function that splits the text of a spec into words and lines.
+ *
+ * @param s the spec, with its text
+ * @return 0 on success, -1 if a quote is not closed
+ */
+static int spec_split(spec *s)
+{
+    builder b = {NULL, NULL, 0, 0, NULL, NULL, 0, 0};
+
+    if (tokenize(s, &b) == -1)
+    {
+        free(b.words);
+        free(b.quoted);
+        free(b.starts);
+        free(b.numbers);
+        spec_free(s);
+        return -1;
+    }
+
+    //the words array does not move any more, the lines can point into it.
+    s->words = b.words;
+    s->quoted = b.quoted;
+    s->numb_of_lines = b.numb_of_lines;
+    s->lines = malloc(sizeof(*s->lines) * (b.numb_of_lines + 1));
+    if (s->lines == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < b.numb_of_lines; i++)
+    {
+        s->lines[i].argv = b.words + b.starts[i];
+        s->lines[i].number = b.numbers[i];
+    }
+
+    free(b.starts);
+    free(b.numbers);
+    return 0;
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that reads a pipeline file and splits it into words.
+ *
+ * @param file_name file to read, or NULL to read stdin
+ * @param s the spec to fill in
+ * @return 0 on success, -1 if the file could not be read or has a quote
+ *         that is not closed
+ */
+int spec_read(const char *file_name, spec *s)
+{
+    struct stat st;
+    int fd = file_name != NULL ? open(file_name, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+
+    memset(s, 0, sizeof(*s));
+
+    if (fd == -1)
+    {
+        perror(file_name);
+        return -1;
+    }
+
+    //a regular file is mapped, anything else is read.
+    if ((fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || map_file(fd, st.st_size, s) == -1)
+        && read_file(fd, s) == -1)
+    {
+        perror(file_name != NULL ? file_name : "stdin");
+        if (fd != STDIN_FILENO)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    if (fd != STDIN_FILENO)
+    {
+        close(fd);
+    }
+
+    return spec_split(s);
+}
+
+/**
+ * @brief Function that makes a spec of text that is already in memory, like
+ *        a pipeline sent to mexec --serve.
+ *
+ * @param text the text, length + 1 bytes from malloc, the spec takes it over
+ * @param length length of the text
+ * @param s the spec to fill in
+ * @return 0 on success, -1 if a quote is not closed
+ */
+int spec_parse(char *text, size_t length, spec *s)
+{
+    memset(s, 0, sizeof(*s));
+    text[length] = '\0';
+    s->text = text;
+    s->length = length;
+    s->mapped = false;
+
+    return spec_split(s);
+}
+
+/**
+ * @brief Function that frees the memory of a spec.
+ *
+ * @param s the spec
+ */
+void spec_free(spec *s)
+{
+    if (s->mapped)
+    {
+        munmap(s->text, s->length + 1);
+    }
+    else
+    {
+        free(s->text);
+    }
+
+    free(s->words);
+    free(s->quoted);
+    free(s->lines);
+    memset(s, 0, sizeof(*s));
+}
+
+/**
+ * @brief Function that checks if a word of the spec was quoted or had a
+ *        backslash, so a quoted '<' is an argument and not a redirection.
+ *
+ * @param s the spec
+ * @param word pointer to the word in the argv of one of the lines
+ * @return true if the word was quoted
+ */
+bool spec_quoted(const spec *s, char *const *word)
+{
+    return s->quoted[word - s->words];
+}
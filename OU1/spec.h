@@ -0,0 +1,83 @@
+#ifndef __SPEC_H
+#define __SPEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * A spec is the pipeline file split into words. The file is mapped or read
+ * in one piece and the words are terminated in place, so no word or line
+ * has a maximum length. Words are separated by spaces or tabs and can be
+ * quoted like in the shell:
+ *
+ *	'...'	everything up to the next ' is one word
+ *	"..."	the same, but \" and \\ are a quote and a backslash
+ *	\c	the character c, a backslash before a newline joins two lines
+ */
+
+//one line of the spec.
+typedef struct spec_line
+{
+    //the words of the line, terminated by NULL.
+    char **argv;
+    //line number in the file, for error messages.
+    int number;
+} spec_line;
+
+// Spec type.
+typedef struct spec
+{
+    char *text;
+    size_t length;
+    bool mapped;
+    //every argv of every line in one array.
+    char **words;
+    //true for the words that had quotes or backslashes.
+    bool *quoted;
+    spec_line *lines;
+    int numb_of_lines;
+} spec;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that reads a pipeline file and splits it into words.
+ *
+ * @param file_name file to read, or NULL to read stdin
+ * @param s the spec to fill in
+ * @return 0 on success, -1 if the file could not be read or has a quote
+ *         that is not closed
+ */
+int spec_read(const char *file_name, spec *s);
+
+/**
+ * @brief Function that makes a spec of text that is already in memory, like
+ *        a pipeline sent to mexec --serve.
+ *
+ * @param text the text, length + 1 bytes from malloc, the spec takes it over
+ * @param length length of the text
+ * @param s the spec to fill in
+ * @return 0 on success, -1 if a quote is not closed
+ */
+int spec_parse(char *text, size_t length, spec *s);
+
+/**
+ * @brief Function that frees the memory of a spec.
+ *
+ * @param s the spec
+ */
+void spec_free(spec *s);
+
+/**
+ * @brief Function that checks if a word of the spec was quoted or had a
+ *        backslash, so a quoted '<' is an argument and not a redirection.
+ *
+ * @param s the spec
+ * @param word pointer to the word in the argv of one of the lines
+ * @return true if the word was quoted
+ */
+bool spec_quoted(const spec *s, char *const *word);
+
+#endif
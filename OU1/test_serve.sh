@@ -0,0 +1,49 @@
+#!/bin/bash
+# Checks that a mexec --serve daemon outlives a client whose reader closes
+# its pipe early. The output of an all pure pipeline is put in the memo by
+# one client and copied from there to the next, which is read by head -c.
+# Every later client must still be served.
+# usage: ./test_serve.sh
+
+DIR=$(mktemp -d)
+SOCKET="$DIR/mexec.sock"
+
+./mexec --memo-dir "$DIR/memo" --serve "$SOCKET" 2> "$DIR/daemon.err" &
+DAEMON=$!
+trap 'kill $DAEMON 2> /dev/null; rm -rf "$DIR"' EXIT
+
+seq 1 200000 > "$DIR/numbers"
+printf '@pure cat %s\n@pure cat\n' "$DIR/numbers" > "$DIR/spec"
+
+while [ ! -S "$SOCKET" ]
+do
+    sleep 0.01
+done
+
+FAILED=0
+
+# reports a check, "name" and the result of the command that was run.
+check() {
+    if [ "$2" -eq 0 ]
+    then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        FAILED=1
+    fi
+}
+
+./mexec_client "$SOCKET" "$DIR/spec" < /dev/null | cmp -s - "$DIR/numbers"
+check "first run fills the memo" $?
+
+for ((i = 0; i < 5; i++))
+do
+    ./mexec_client "$SOCKET" "$DIR/spec" < /dev/null | head -c 10 > /dev/null
+done
+kill -0 $DAEMON 2> /dev/null
+check "daemon lives after early close" $?
+
+./mexec_client "$SOCKET" "$DIR/spec" < /dev/null | cmp -s - "$DIR/numbers"
+check "later client is served" $?
+
+exit $FAILED
@@ -0,0 +1,267 @@
+/**
+ * @file topology.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of the reading of the cpu topology for --affinity.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "topology.h"
+
+// ===========INTERNAL DATA TYPES============
+
+//where one cpu is.
+typedef struct cpu
+{
+    int id;
+    //lowest cpu of the domain and of the core, used to group them.
+    int domain;
+    int core;
+    //places in the spread order.
+    int thread_rank;
+    int core_rank;
+    int domain_rank;
+} cpu;
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that reads a sysfs cpu list like "0-3,8,10-11".
+ *
+ * @param path the file
+ * @param set set to the cpus in the list
+ * @return 0 on success, -1 if the file could not be read
+ */
+static int read_cpu_list(const char *path, cpu_set_t *set)
+{
+    FILE *file = fopen(path, "r");
+    int first;
+    int last;
+    char separator;
+
+    CPU_ZERO(set);
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    while (fscanf(file, "%d", &first) == 1)
+    {
+        last = first;
+        separator = fgetc(file);
+        if (separator == '-')
+        {
+            if (fscanf(file, "%d", &last) != 1)
+            {
+                break;
+            }
+            separator = fgetc(file);
+        }
+        for (int i = first; i <= last && i < CPU_SETSIZE; i++)
+        {
+            CPU_SET(i, set);
+        }
+        if (separator != ',')
+        {
+            break;
+        }
+    }
+
+    fclose(file);
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Function that returns the lowest cpu of a set that is also allowed.
+ *
+ * @param set the set
+ * @param allowed the allowed cpus
+ * @param fallback returned if no cpu is in both
+ * @return the cpu
+ */
+static int lowest_cpu(const cpu_set_t *set, const cpu_set_t *allowed, int fallback)
+{
+    for (int i = 0; i < CPU_SETSIZE; i++)
+    {
+        if (CPU_ISSET(i, set) && CPU_ISSET(i, allowed))
+        {
+            return i;
+        }
+    }
+
+    return fallback;
+}
+
+/**
+ * @brief Function that reads the cpus a cpu shares its L3 cache with, or
+ *        its package with if there is no L3 cache in sysfs.
+ *
+ * @param id the cpu
+ * @param set set to the cpus
+ */
+static void read_domain(int id, cpu_set_t *set)
+{
+    char path[128];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", id);
+    if (read_cpu_list(path, set) == 0)
+    {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_siblings_list", id);
+    if (read_cpu_list(path, set) == -1)
+    {
+        CPU_SET(id, set);
+    }
+}
+
+/**
+ * @brief Function that orders cpus in the compact order.
+ *
+ * @param a first cpu
+ * @param b second cpu
+ * @return less than, equal to or greater than 0
+ */
+static int compare_compact(const void *a, const void *b)
+{
+    const cpu *x = a;
+    const cpu *y = b;
+
+    if (x->domain != y->domain)
+    {
+        return x->domain - y->domain;
+    }
+    if (x->core != y->core)
+    {
+        return x->core - y->core;
+    }
+    return x->id - y->id;
+}
+
+/**
+ * @brief Function that orders cpus in the spread order.
+ *
+ * @param a first cpu
+ * @param b second cpu
+ * @return less than, equal to or greater than 0
+ */
+static int compare_spread(const void *a, const void *b)
+{
+    const cpu *x = a;
+    const cpu *y = b;
+
+    if (x->thread_rank != y->thread_rank)
+    {
+        return x->thread_rank - y->thread_rank;
+    }
+    if (x->core_rank != y->core_rank)
+    {
+        return x->core_rank - y->core_rank;
+    }
+    return x->domain_rank - y->domain_rank;
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that reads the cpus the process may run on and how they
+ *        share cores and caches.
+ *
+ * @param t the topology to fill in
+ * @return 0 on success, -1 if the cpus could not be read
+ */
+int topology_read(topology *t)
+{
+    memset(t, 0, sizeof(*t));
+
+    if (sched_getaffinity(0, sizeof(t->allowed), &t->allowed) == -1)
+    {
+        perror("sched_getaffinity");
+        return -1;
+    }
+
+    int n = CPU_COUNT(&t->allowed);
+    cpu *cpus = malloc(sizeof(*cpus) * n);
+    t->compact = malloc(sizeof(*t->compact) * n);
+    t->spread = malloc(sizeof(*t->spread) * n);
+    t->domains = malloc(sizeof(*t->domains) * n);
+    if (cpus == NULL || t->compact == NULL || t->spread == NULL || t->domains == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int id = 0; id < CPU_SETSIZE && t->numb_of_cpus < n; id++)
+    {
+        cpu *c = &cpus[t->numb_of_cpus];
+        cpu_set_t set;
+        char path[128];
+
+        if (!CPU_ISSET(id, &t->allowed))
+        {
+            continue;
+        }
+
+        c->id = id;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", id);
+        c->core = read_cpu_list(path, &set) == 0 ? lowest_cpu(&set, &t->allowed, id) : id;
+        read_domain(id, &set);
+        c->domain = lowest_cpu(&set, &t->allowed, id);
+        t->numb_of_cpus++;
+    }
+
+    qsort(cpus, n, sizeof(*cpus), compare_compact);
+
+    //ranks for the spread order and one set per domain, walking the compact order.
+    for (int i = 0; i < n; i++)
+    {
+        cpu *c = &cpus[i];
+
+        t->compact[i] = c->id;
+        if (i == 0 || c->domain != cpus[i - 1].domain)
+        {
+            c->domain_rank = t->numb_of_domains++;
+            c->core_rank = 0;
+            c->thread_rank = 0;
+            CPU_ZERO(&t->domains[c->domain_rank]);
+        }
+        else
+        {
+            c->domain_rank = cpus[i - 1].domain_rank;
+            c->core_rank = cpus[i - 1].core_rank + (c->core != cpus[i - 1].core);
+            c->thread_rank = c->core != cpus[i - 1].core ? 0 : cpus[i - 1].thread_rank + 1;
+        }
+        CPU_SET(c->id, &t->domains[c->domain_rank]);
+    }
+
+    qsort(cpus, n, sizeof(*cpus), compare_spread);
+    for (int i = 0; i < n; i++)
+    {
+        t->spread[i] = cpus[i].id;
+    }
+
+    free(cpus);
+    return 0;
+}
+
+/**
+ * @brief Function that frees the memory of a topology.
+ *
+ * @param t the topology
+ */
+void topology_free(topology *t)
+{
+    free(t->compact);
+    free(t->spread);
+    free(t->domains);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,48 @@
+#ifndef __TOPOLOGY_H
+#define __TOPOLOGY_H
+
+#include <sched.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * The topology is the cpus mexec may run on, read from sysfs, in two
+ * orders. In the compact order hyperthreads of one core are next to each
+ * other, then the cores that share an L3 cache, then the rest of the
+ * package. In the spread order cpus far from each other come first: the
+ * first thread of a core in every L3 domain in turn, the second threads
+ * last. A domain is the cpus that share an L3 cache, or a package when the
+ * cache is not known.
+ */
+
+// Topology type.
+typedef struct topology
+{
+    //the cpus mexec was started with.
+    cpu_set_t allowed;
+    int numb_of_cpus;
+    int *compact;
+    int *spread;
+    cpu_set_t *domains;
+    int numb_of_domains;
+} topology;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that reads the cpus the process may run on and how they
+ *        share cores and caches.
+ *
+ * @param t the topology to fill in
+ * @return 0 on success, -1 if the cpus could not be read
+ */
+int topology_read(topology *t);
+
+/**
+ * @brief Function that frees the memory of a topology.
+ *
+ * @param t the topology
+ */
+void topology_free(topology *t);
+
+#endif
@@ -0,0 +1,93 @@
+#!/bin/bash
+# Times how fast ./mmake parses a generated makefile and appends one CSV row
+# per makefile to track regressions. The makefile has rules with PREREQS
+# prerequisites each, named from a pool of names, until it is MB megabytes.
+# mmake is asked for a file the makefile does not name, so only the parse
+# and the check that the file exists are timed:
+#   ms, mb_per_s  the makefile is parsed, its cache is removed before each run
+#   cached_ms     the makefile is loaded from its cache
+# The median of the runs is used.
+# usage: ./bench_parser.sh [-r RUNS] [-s MB] [-p PREREQS] [-b MMAKE] [-o CSV]
+
+RUNS=5
+MB=16
+PREREQS="1 16 256"
+MMAKE=./mmake
+CSV=bench_parser.csv
+
+while getopts "r:s:p:b:o:" flag
+do
+    case $flag in
+    r) RUNS=$OPTARG ;;
+    s) MB=$OPTARG ;;
+    p) PREREQS=$OPTARG ;;
+    b) MMAKE=$OPTARG ;;
+    o) CSV=$OPTARG ;;
+    *) echo "usage: $0 [-r RUNS] [-s MB] [-p PREREQS] [-b MMAKE] [-o CSV]" >&2; exit 1 ;;
+    esac
+done
+
+MMAKE=$(realpath "$MMAKE") || exit 1
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# writes MB megabytes of rules with N prerequisites each to stdout.
+generate() {
+    awk -v bytes=$((MB * 1024 * 1024)) -v n="$1" 'BEGIN {
+        srand(1)
+        for (r = 0; bytes > 0; r++) {
+            line = "target" r ":"
+            for (i = 0; i < n; i++) line = line " file" int(rand() * 100000) ".o"
+            line = line "\n\tgcc -std=gnu11 -Wall -o target" r " main.c"
+            print line
+            bytes -= length(line) + 1
+        }
+    }'
+}
+
+# prints the median of a list of numbers, one per line.
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+DATE=$(date +%Y-%m-%dT%H:%M:%S)
+touch "$DIR/src"
+
+if [ ! -s "$CSV" ]
+then
+    echo "date,commit,prereqs,bytes,ms,mb_per_s,cached_ms" > "$CSV"
+fi
+
+echo "$MB MB, median of $RUNS runs"
+printf '  %7s %10s %9s %9s %9s\n' prereqs bytes ms mb_per_s cached_ms
+for n in $PREREQS
+do
+    generate "$n" > "$DIR/big.mk" || exit 1
+    bytes=$(stat -c %s "$DIR/big.mk")
+
+    # the first run reads the file into the page cache.
+    (cd "$DIR" && "$MMAKE" -f big.mk src) || exit 1
+    for ((r = 0; r < RUNS; r++))
+    do
+        rm -f "$DIR/.big.mk.cache"
+        start=$EPOCHREALTIME
+        (cd "$DIR" && "$MMAKE" -f big.mk src)
+        end=$EPOCHREALTIME
+        awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f\n", (e - s) * 1000 }'
+    done > "$DIR/times"
+    ms=$(median < "$DIR/times")
+
+    for ((r = 0; r < RUNS; r++))
+    do
+        start=$EPOCHREALTIME
+        (cd "$DIR" && "$MMAKE" -f big.mk src)
+        end=$EPOCHREALTIME
+        awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f\n", (e - s) * 1000 }'
+    done > "$DIR/times"
+    cached=$(median < "$DIR/times")
+    rate=$(awk -v b="$bytes" -v ms="$ms" 'BEGIN { printf "%.1f", b / 1048576 / (ms / 1000) }')
+
+    printf '  %7s %10s %9s %9s %9s\n' "$n" "$bytes" "$ms" "$rate" "$cached"
+    echo "$DATE,$COMMIT,$n,$bytes,$ms,$rate,$cached" >> "$CSV"
+done
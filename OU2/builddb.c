@@ -0,0 +1,653 @@
+/**
+ * @file builddb.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of the build database of mmake.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include "builddb.h"
+
+//first line of a database file, the number is the version of the format.
+#define DB_HEADER "mmake-db 1\n"
+//bytes read at a time when a file is hashed, a multiple of STRIPE.
+#define HASH_BUFFER (64 * 1024)
+//bytes hashed at a time by the four lanes.
+#define STRIPE 32
+
+//multipliers of the hash, odd numbers with well mixed bits.
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+
+// ===========INTERNAL DATA TYPES============
+
+//what the database knows about one name.
+typedef struct record
+{
+    char *name;
+    //the contents of the file and what it looked like when it was hashed.
+    bool has_file;
+    long long size;
+    long long mtime_sec;
+    long long mtime_nsec;
+    unsigned long long ino;
+    uint64_t file_hash;
+    //what the target was last built from.
+    db_target_state target;
+    uint64_t target_hash;
+} record;
+
+struct build_db
+{
+    char *path;
+    //open addressing table, name is NULL in empty slots.
+    record *records;
+    size_t size;
+    size_t count;
+    bool changed;
+};
+
+//a hash of bytes that are read a buffer at a time.
+typedef struct hasher
+{
+    uint64_t lane[4];
+    uint64_t length;
+} hasher;
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that rotates the bits of a word to the left.
+ *
+ * @param x the word
+ * @param r number of bits
+ * @return the rotated word
+ */
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * @brief Function that mixes a word of input into a lane.
+ *
+ * @param acc the lane
+ * @param input the word
+ * @return the new lane
+ */
+static uint64_t mix(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+/**
+ * @brief Function that reads a word that does not have to be aligned.
+ *
+ * @param p where to read
+ * @return the word
+ */
+static uint64_t read_word(const unsigned char *p)
+{
+    uint64_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief Function that starts a hash.
+ *
+ * @param h the hash
+ * @param seed the hash to continue from
+ */
+static void hasher_init(hasher *h, uint64_t seed)
+{
+    h->lane[0] = seed + PRIME1 + PRIME2;
+    h->lane[1] = seed + PRIME2;
+    h->lane[2] = seed;
+    h->lane[3] = seed - PRIME1;
+    h->length = 0;
+}
+
+/**
+ * @brief Function that hashes whole stripes. The four lanes do not depend
+ *        on each other, so the processor works on them at the same time.
+ *
+ * @param h the hash
+ * @param p the bytes
+ * @param length number of bytes, the part after the last whole stripe is
+ *        not hashed
+ * @return number of bytes hashed
+ */
+static size_t hasher_stripes(hasher *h, const unsigned char *p, size_t length)
+{
+    size_t done = length - length % STRIPE;
+
+    for (size_t i = 0; i < done; i += STRIPE)
+    {
+        h->lane[0] = mix(h->lane[0], read_word(p + i));
+        h->lane[1] = mix(h->lane[1], read_word(p + i + 8));
+        h->lane[2] = mix(h->lane[2], read_word(p + i + 16));
+        h->lane[3] = mix(h->lane[3], read_word(p + i + 24));
+    }
+    h->length += done;
+    return done;
+}
+
+/**
+ * @brief Function that hashes the last bytes and returns the hash.
+ *
+ * @param h the hash
+ * @param p the bytes
+ * @param length number of bytes
+ * @return the hash
+ */
+static uint64_t hasher_final(hasher *h, const unsigned char *p, size_t length)
+{
+    size_t done = hasher_stripes(h, p, length);
+    uint64_t acc = rotl(h->lane[0], 1) + rotl(h->lane[1], 7) + rotl(h->lane[2], 12)
+        + rotl(h->lane[3], 18) + h->length + (length - done);
+
+    for (; done + 8 <= length; done += 8)
+    {
+        acc = rotl(acc ^ mix(0, read_word(p + done)), 27) * PRIME1 + PRIME3;
+    }
+    for (; done < length; done++)
+    {
+        acc = rotl(acc ^ (p[done] * PRIME3), 11) * PRIME1;
+    }
+
+    //every bit of the input changes about half of the bits of the hash.
+    acc ^= acc >> 33;
+    acc *= PRIME2;
+    acc ^= acc >> 29;
+    acc *= PRIME3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+/**
+ * @brief Function that hashes the contents of a file.
+ *
+ * @param name the file
+ * @param hash set to the hash
+ * @return 0 on success, -1 if the file could not be read
+ */
+static int hash_file(const char *name, uint64_t *hash)
+{
+    unsigned char buffer[HASH_BUFFER];
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    size_t filled = 0;
+    hasher h;
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    hasher_init(&h, 0);
+    for (;;)
+    {
+        ssize_t n = read(fd, buffer + filled, sizeof(buffer) - filled);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+
+        //only full buffers are hashed before the end, they are whole stripes.
+        filled += n;
+        if (filled == sizeof(buffer))
+        {
+            hasher_stripes(&h, buffer, filled);
+            filled = 0;
+        }
+    }
+
+    close(fd);
+    *hash = hasher_final(&h, buffer, filled);
+    return 0;
+}
+
+/**
+ * @brief Function that hashes a name for the table, FNV-1a.
+ *
+ * @param name the name
+ * @return the hash
+ */
+static size_t hash_name(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *name != '\0'; name++)
+    {
+        h = (h ^ (unsigned char)*name) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Function that allocates memory or exits.
+ *
+ * @param size number of bytes
+ * @return the memory, zeroed
+ */
+static void *allocate(size_t size)
+{
+    void *ptr = calloc(1, size);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/**
+ * @brief Function that finds the slot of a name, the one holding its record
+ *        or the empty one where it would go.
+ *
+ * @param db the database
+ * @param name the name
+ * @return the slot
+ */
+static record *find(build_db *db, const char *name)
+{
+    size_t mask = db->size - 1;
+    size_t i = hash_name(name) & mask;
+
+    while (db->records[i].name != NULL && strcmp(db->records[i].name, name) != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    return &db->records[i];
+}
+
+/**
+ * @brief Function that returns the record of a name, a new empty one if it
+ *        has none. The table is made twice as big when it is half full.
+ *
+ * @param db the database
+ * @param name the name
+ * @return the record
+ */
+static record *get(build_db *db, const char *name)
+{
+    record *r = find(db, name);
+
+    if (r->name != NULL)
+    {
+        return r;
+    }
+
+    if (2 * (db->count + 1) > db->size)
+    {
+        record *old = db->records;
+        size_t old_size = db->size;
+
+        db->size *= 2;
+        db->records = allocate(db->size * sizeof(*db->records));
+        for (size_t i = 0; i < old_size; i++)
+        {
+            if (old[i].name != NULL)
+            {
+                *find(db, old[i].name) = old[i];
+            }
+        }
+        free(old);
+        r = find(db, name);
+    }
+
+    if ((r->name = strdup(name)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    db->count++;
+    return r;
+}
+
+/**
+ * @brief Function that reads a number after a space in a line.
+ *
+ * @param p where to read, moved past the number
+ * @param base 10 or 16
+ * @param value set to the number
+ * @return true if there was a number
+ */
+static bool read_number(char **p, int base, unsigned long long *value)
+{
+    char *end;
+
+    if (**p != ' ')
+    {
+        return false;
+    }
+
+    errno = 0;
+    *value = strtoull(*p + 1, &end, base);
+    if (end == *p + 1 || errno != 0)
+    {
+        return false;
+    }
+
+    *p = end;
+    return true;
+}
+
+/**
+ * @brief Function that reads the records of a database file. Lines that
+ *        can not be read are skipped, they are written again when the file
+ *        is saved.
+ *
+ * @param db the database
+ * @param fp the file
+ */
+static void read_records(build_db *db, FILE *fp)
+{
+    char *line = NULL;
+    size_t length = 0;
+    ssize_t n;
+
+    if ((n = getline(&line, &length, fp)) < 0 || strcmp(line, DB_HEADER) != 0)
+    {
+        free(line);
+        return;
+    }
+
+    while ((n = getline(&line, &length, fp)) > 0)
+    {
+        unsigned long long field[5];
+        char *p = line + 1;
+        int i = 0;
+
+        if (line[n - 1] == '\n')
+        {
+            line[n - 1] = '\0';
+        }
+
+        //a file has its size, mtime, inode and hash, a target its hash and a
+        //target whose command failed only its name.
+        int count = line[0] == 'f' ? 5 : line[0] == 't' ? 1 : 0;
+        while (i < count && read_number(&p, i == count - 1 ? 16 : 10, &field[i]))
+        {
+            i++;
+        }
+        if ((count == 0 && line[0] != 'x') || i < count || *p != ' ' || p[1] == '\0')
+        {
+            continue;
+        }
+
+        record *found = get(db, p + 1);
+        if (line[0] == 'f')
+        {
+            found->has_file = true;
+            found->size = field[0];
+            found->mtime_sec = field[1];
+            found->mtime_nsec = field[2];
+            found->ino = field[3];
+            found->file_hash = field[4];
+        }
+        else if (line[0] == 't')
+        {
+            found->target = DB_BUILT;
+            found->target_hash = field[0];
+        }
+        else if (line[0] == 'x')
+        {
+            found->target = DB_FAILED;
+        }
+    }
+
+    free(line);
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that reads a database. A file that does not exist or is
+ *        not a database gives an empty database.
+ *
+ * @param path the file of the database
+ * @return build_db* that was read
+ */
+build_db *db_open(const char *path)
+{
+    build_db *db = allocate(sizeof(*db));
+    FILE *fp = fopen(path, "r");
+
+    if ((db->path = strdup(path)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    db->size = 64;
+    db->records = allocate(db->size * sizeof(*db->records));
+
+    if (fp != NULL)
+    {
+        read_records(db, fp);
+        fclose(fp);
+    }
+
+    return db;
+}
+
+/**
+ * @brief Function that hashes bytes, continuing from another hash.
+ *
+ * @param seed the hash to continue from, 0 to start
+ * @param data the bytes
+ * @param length number of bytes
+ * @return the hash
+ */
+uint64_t db_hash(uint64_t seed, const void *data, size_t length)
+{
+    hasher h;
+
+    hasher_init(&h, seed);
+    return hasher_final(&h, data, length);
+}
+
+/**
+ * @brief Function that returns the hash of the contents of a file. The hash
+ *        in the database is used if the file has the same size,
+ *        modification time and inode as when it was hashed, else the file
+ *        is read and hashed again.
+ *
+ * @param db the database
+ * @param name the file
+ * @param st the stat of the file
+ * @param hash set to the hash
+ * @return true on success, false if the file could not be read
+ */
+bool db_file_hash(build_db *db, const char *name, const struct stat *st, uint64_t *hash)
+{
+    record *r = get(db, name);
+
+    //the common case, the file looks the same and is not read.
+    if (r->has_file && r->size == st->st_size && r->mtime_sec == st->st_mtim.tv_sec
+        && r->mtime_nsec == st->st_mtim.tv_nsec && r->ino == st->st_ino)
+    {
+        *hash = r->file_hash;
+        return true;
+    }
+
+    if (hash_file(name, hash) == -1)
+    {
+        return false;
+    }
+
+    r->has_file = true;
+    r->size = st->st_size;
+    r->mtime_sec = st->st_mtim.tv_sec;
+    r->mtime_nsec = st->st_mtim.tv_nsec;
+    r->ino = st->st_ino;
+    r->file_hash = *hash;
+    db->changed = true;
+    return true;
+}
+
+/**
+ * @brief Function that returns the hash a target was last built from.
+ *
+ * @param db the database
+ * @param name the target
+ * @param hash set to the hash if the target was built
+ * @return what the database knows about the target
+ */
+db_target_state db_target_get(build_db *db, const char *name, uint64_t *hash)
+{
+    record *r = find(db, name);
+
+    if (r->name == NULL)
+    {
+        return DB_NEVER_BUILT;
+    }
+
+    *hash = r->target_hash;
+    return r->target;
+}
+
+/**
+ * @brief Function that sets the hash a target was built from.
+ *
+ * @param db the database
+ * @param name the target
+ * @param hash the hash
+ */
+void db_target_set(build_db *db, const char *name, uint64_t hash)
+{
+    record *r = get(db, name);
+
+    if (r->target != DB_BUILT || r->target_hash != hash)
+    {
+        r->target = DB_BUILT;
+        r->target_hash = hash;
+        db->changed = true;
+    }
+}
+
+/**
+ * @brief Function that marks a target whose command failed, so it is built
+ *        again whatever it is built from.
+ *
+ * @param db the database
+ * @param name the target
+ */
+void db_target_failed(build_db *db, const char *name)
+{
+    record *r = get(db, name);
+
+    if (r->target != DB_FAILED)
+    {
+        r->target = DB_FAILED;
+        db->changed = true;
+    }
+}
+
+/**
+ * @brief Function that writes a database that has changed. It is written
+ *        to a new file that replaces the old one, so it is never seen half
+ *        written.
+ *
+ * @param db the database
+ * @return 0 on success, -1 on failure
+ */
+int db_save(build_db *db)
+{
+    char temp[PATH_MAX];
+    FILE *fp;
+    int fd;
+
+    if (!db->changed)
+    {
+        return 0;
+    }
+
+    if (snprintf(temp, sizeof(temp), "%s.XXXXXX", db->path) >= (int)sizeof(temp)
+        || (fd = mkostemp(temp, O_CLOEXEC)) == -1)
+    {
+        perror(db->path);
+        return -1;
+    }
+    if ((fp = fdopen(fd, "w")) == NULL)
+    {
+        perror(db->path);
+        close(fd);
+        unlink(temp);
+        return -1;
+    }
+
+    fputs(DB_HEADER, fp);
+    for (size_t i = 0; i < db->size; i++)
+    {
+        const record *r = &db->records[i];
+
+        if (r->name != NULL && r->has_file)
+        {
+            fprintf(fp, "f %lld %lld %lld %llu %016" PRIx64 " %s\n", r->size, r->mtime_sec,
+                r->mtime_nsec, r->ino, r->file_hash, r->name);
+        }
+        if (r->name != NULL && r->target == DB_BUILT)
+        {
+            fprintf(fp, "t %016" PRIx64 " %s\n", r->target_hash, r->name);
+        }
+        if (r->name != NULL && r->target == DB_FAILED)
+        {
+            fprintf(fp, "x %s\n", r->name);
+        }
+    }
+
+    bool failed = ferror(fp) != 0;
+    if (fclose(fp) != 0 || failed || rename(temp, db->path) == -1)
+    {
+        perror(db->path);
+        unlink(temp);
+        return -1;
+    }
+
+    db->changed = false;
+    return 0;
+}
+
+/**
+ * @brief Function that frees a database.
+ *
+ * @param db the database
+ */
+void db_free(build_db *db)
+{
+    for (size_t i = 0; i < db->size; i++)
+    {
+        free(db->records[i].name);
+    }
+    free(db->records);
+    free(db->path);
+    free(db);
+}
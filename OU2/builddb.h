@@ -0,0 +1,114 @@
+#ifndef __BUILDDB_H
+#define __BUILDDB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * The build database remembers what every target was built from, so a
+ * target is only built again when the contents of its prerequisites or its
+ * command changed, not when only their times did. For every file it keeps
+ * the hash of its contents with the size, modification time and inode it
+ * had when it was hashed, so a file is only read again when one of those
+ * changed. For every target it keeps one hash of its command and the names
+ * and contents of its prerequisites. It is kept in a text file that is
+ * read when mmake starts and written again when something changed.
+ */
+
+// Database type.
+typedef struct build_db build_db;
+
+// Target state type, what the database knows about a target.
+typedef enum db_target_state
+{
+    DB_NEVER_BUILT,
+    DB_BUILT,
+    //the last command failed, the target is built again.
+    DB_FAILED
+} db_target_state;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that reads a database. A file that does not exist or is
+ *        not a database gives an empty database.
+ *
+ * @param path the file of the database
+ * @return build_db* that was read
+ */
+build_db *db_open(const char *path);
+
+/**
+ * @brief Function that hashes bytes, continuing from another hash.
+ *
+ * @param seed the hash to continue from, 0 to start
+ * @param data the bytes
+ * @param length number of bytes
+ * @return the hash
+ */
+uint64_t db_hash(uint64_t seed, const void *data, size_t length);
+
+/**
+ * @brief Function that returns the hash of the contents of a file. The hash
+ *        in the database is used if the file has the same size,
+ *        modification time and inode as when it was hashed, else the file
+ *        is read and hashed again.
+ *
+ * @param db the database
+ * @param name the file
+ * @param st the stat of the file
+ * @param hash set to the hash
+ * @return true on success, false if the file could not be read
+ */
+bool db_file_hash(build_db *db, const char *name, const struct stat *st, uint64_t *hash);
+
+/**
+ * @brief Function that returns the hash a target was last built from.
+ *
+ * @param db the database
+ * @param name the target
+ * @param hash set to the hash if the target was built
+ * @return what the database knows about the target
+ */
+db_target_state db_target_get(build_db *db, const char *name, uint64_t *hash);
+
+/**
+ * @brief Function that sets the hash a target was built from.
+ *
+ * @param db the database
+ * @param name the target
+ * @param hash the hash
+ */
+void db_target_set(build_db *db, const char *name, uint64_t hash);
+
+/**
+ * @brief Function that marks a target whose command failed, so it is built
+ *        again whatever it is built from.
+ *
+ * @param db the database
+ * @param name the target
+ */
+void db_target_failed(build_db *db, const char *name);
+
+/**
+ * @brief Function that writes a database that has changed. It is written
+ *        to a new file that replaces the old one, so it is never seen half
+ *        written.
+ *
+ * @param db the database
+ * @return 0 on success, -1 on failure
+ */
+int db_save(build_db *db);
+
+/**
+ * @brief Function that frees a database.
+ *
+ * @param db the database
+ */
+void db_free(build_db *db);
+
+#endif
@@ -0,0 +1,334 @@
+/**
+ * @file graph.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of the dependency graph of mmake.
+ * @version 1
+ * @date 2021-09-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "graph.h"
+
+// ===========INTERNAL DATA TYPES============
+
+//how far the depth-first walk has come with a node.
+typedef enum mark
+{
+    UNSEEN,
+    //on the walk stack, seeing it again is a cycle.
+    ACTIVE,
+    FINISHED
+} mark;
+
+//a name while the graph is made, before it has its number.
+typedef struct vertex
+{
+    rule *rule;
+    mark mark;
+    //its number in the graph once it is finished.
+    int id;
+    //a file without a rule is stat'ed when it is seen, the node keeps it.
+    bool stat_done;
+    int stat_error;
+    struct stat st;
+} vertex;
+
+//a vertex on the walk stack and the next prerequisite to visit.
+typedef struct frame
+{
+    int vertex;
+    int next;
+} frame;
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that allocates memory or exits.
+ *
+ * @param ptr memory to grow, or NULL
+ * @param size new size
+ * @return the memory
+ */
+static void *grow(void *ptr, size_t size)
+{
+    if ((ptr = realloc(ptr, size)) == NULL && size > 0)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/**
+ * @brief Function that prints a cycle, the part of the walk stack from the
+ *        vertex that was seen again.
+ *
+ * @param m the makefile
+ * @param stack the walk stack
+ * @param depth number of frames on it
+ * @param again the vertex that was seen again
+ */
+static void print_cycle(makefile *m, const frame *stack, int depth, int again)
+{
+    int first = depth - 1;
+
+    while (stack[first].vertex != again)
+    {
+        first--;
+    }
+
+    fprintf(stderr, "mmake: circular dependency:");
+    for (int i = first; i < depth; i++)
+    {
+        fprintf(stderr, " %s ->", makefile_name(m, stack[i].vertex));
+    }
+    fprintf(stderr, " %s\n", makefile_name(m, again));
+}
+
+/**
+ * @brief Function that walks the graph from one target depth first and
+ *        numbers every vertex when all its prerequisites are finished. The
+ *        vertices are indexed by the name ids of the makefile. The walk has
+ *        its own stack, a long chain of rules can not overflow the C stack.
+ *
+ * @param vertices a vertex for every name id
+ * @param m the makefile
+ * @param root name id of the target
+ * @param numb_of_finished the next number, counted up
+ * @return 0 on success, -1 on a cycle or a missing file
+ */
+static int walk(vertex *vertices, makefile *m, int root, int *numb_of_finished)
+{
+    frame *stack = NULL;
+    int depth = 0;
+    int capacity = 0;
+    int result = 0;
+
+    if (vertices[root].mark == FINISHED)
+    {
+        return 0;
+    }
+
+    stack = grow(stack, sizeof(*stack) * (capacity = 64));
+    stack[depth++] = (frame){root, 0};
+    vertices[root].mark = ACTIVE;
+    vertices[root].rule = makefile_rule_id(m, root);
+
+    while (depth > 0)
+    {
+        frame *top = &stack[depth - 1];
+        vertex *v = &vertices[top->vertex];
+
+        //a file without a rule has to exist already.
+        if (v->rule == NULL && !v->stat_done)
+        {
+            const char *name = makefile_name(m, top->vertex);
+
+            v->stat_done = true;
+            v->stat_error = stat(name, &v->st) == 0 ? 0 : errno;
+            if (v->stat_error == ENOENT)
+            {
+                fprintf(stderr, "%s: No target!\n", name);
+                result = -1;
+                break;
+            }
+        }
+
+        const int *prereq = v->rule != NULL ? rule_prereq_ids(v->rule) : NULL;
+        if (prereq == NULL || prereq[top->next] == -1)
+        {
+            v->mark = FINISHED;
+            v->id = (*numb_of_finished)++;
+            depth--;
+            continue;
+        }
+
+        int next = prereq[top->next++];
+
+        if (vertices[next].mark == ACTIVE)
+        {
+            print_cycle(m, stack, depth, next);
+            result = -1;
+            break;
+        }
+        if (vertices[next].mark == UNSEEN)
+        {
+            if (depth == capacity)
+            {
+                stack = grow(stack, sizeof(*stack) * (capacity *= 2));
+            }
+            stack[depth++] = (frame){next, 0};
+            vertices[next].mark = ACTIVE;
+            vertices[next].rule = makefile_rule_id(m, next);
+        }
+    }
+
+    free(stack);
+    return result;
+}
+
+// ===========EXTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that makes the graph of some targets. A cycle or a file
+ *        without a rule that does not exist is printed and fails the whole
+ *        graph, before anything is built.
+ *
+ * @param g the graph to fill in
+ * @param m the makefile
+ * @param targets the targets to build
+ * @param count number of targets
+ * @return 0 on success, -1 on a cycle or a missing file
+ */
+int graph_build(graph *g, makefile *m, const char **targets, int count)
+{
+    int numb_of_names = makefile_names(m);
+    vertex *vertices = calloc(numb_of_names, sizeof(*vertices));
+    int numb_of_finished = 0;
+
+    g->nodes = NULL;
+    g->numb_of_nodes = 0;
+
+    if (vertices == NULL && numb_of_names > 0)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int root = makefile_name_id(m, targets[i]);
+
+        //a name the makefile does not use can only be a file that exists.
+        if (root == -1 && access(targets[i], F_OK) != 0)
+        {
+            fprintf(stderr, "%s: No target!\n", targets[i]);
+            free(vertices);
+            return -1;
+        }
+        if (root != -1 && walk(vertices, m, root, &numb_of_finished) == -1)
+        {
+            free(vertices);
+            return -1;
+        }
+    }
+
+    //the finished vertices become the nodes, in finish order.
+    g->numb_of_nodes = numb_of_finished;
+    g->nodes = grow(NULL, numb_of_finished * sizeof(*g->nodes));
+    for (int i = 0; i < numb_of_names; i++)
+    {
+        const vertex *v = &vertices[i];
+
+        if (v->mark == FINISHED)
+        {
+            g->nodes[v->id] = (node){.name = makefile_name(m, i), .rule = v->rule, .state = NODE_PENDING, 
+                .stat_done = v->stat_done, .stat_error = v->stat_error, .st = v->st};
+        }
+    }
+
+    for (int i = 0; i < numb_of_names; i++)
+    {
+        if (vertices[i].mark != FINISHED)
+        {
+            continue;
+        }
+
+        node *n = &g->nodes[vertices[i].id];
+        const int *prereq = n->rule != NULL ? rule_prereq_ids(n->rule) : NULL;
+
+        for (int j = 0; prereq != NULL && prereq[j] != -1; j++)
+        {
+            n->numb_of_prereqs++;
+        }
+        n->prereqs = grow(NULL, n->numb_of_prereqs * sizeof(*n->prereqs));
+        for (int j = 0; j < n->numb_of_prereqs; j++)
+        {
+            node *p = &g->nodes[vertices[prereq[j]].id];
+
+            n->prereqs[j] = p - g->nodes;
+            p->numb_of_dependents++;
+        }
+    }
+
+    //a prerequisite named twice is waited for twice, pending counts edges.
+    for (int i = 0; i < g->numb_of_nodes; i++)
+    {
+        node *n = &g->nodes[i];
+
+        n->dependents = grow(NULL, n->numb_of_dependents * sizeof(*n->dependents));
+        n->numb_of_dependents = 0;
+    }
+    for (int i = 0; i < g->numb_of_nodes; i++)
+    {
+        node *n = &g->nodes[i];
+
+        n->pending = n->numb_of_prereqs;
+        for (int j = 0; j < n->numb_of_prereqs; j++)
+        {
+            node *p = &g->nodes[n->prereqs[j]];
+
+            p->dependents[p->numb_of_dependents++] = i;
+        }
+    }
+
+    free(vertices);
+    return 0;
+}
+
+/**
+ * @brief Function that returns the stat of the file of a node. The file is
+ *        only stat'ed the first time and after graph_changed.
+ *
+ * @param g the graph
+ * @param index the node
+ * @return the stat, or NULL with errno set if the file could not be stat'ed
+ */
+const struct stat *graph_stat(graph *g, int index)
+{
+    node *n = &g->nodes[index];
+
+    if (!n->stat_done)
+    {
+        n->stat_done = true;
+        n->stat_error = stat(n->name, &n->st) == 0 ? 0 : errno;
+    }
+
+    errno = n->stat_error;
+    return n->stat_error == 0 ? &n->st : NULL;
+}
+
+/**
+ * @brief Function that forgets the stat of a node whose file was built.
+ *
+ * @param g the graph
+ * @param index the node
+ */
+void graph_changed(graph *g, int index)
+{
+    g->nodes[index].stat_done = false;
+}
+
+/**
+ * @brief Function that frees a graph.
+ *
+ * @param g the graph
+ */
+void graph_free(graph *g)
+{
+    for (int i = 0; i < g->numb_of_nodes; i++)
+    {
+        free(g->nodes[i].prereqs);
+        free(g->nodes[i].dependents);
+    }
+    free(g->nodes);
+    g->nodes = NULL;
+    g->numb_of_nodes = 0;
+}
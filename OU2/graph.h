@@ -0,0 +1,95 @@
+#ifndef __GRAPH_H
+#define __GRAPH_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "parser.h"
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * The targets to build and everything they depend on, as a DAG. Every
+ * target or file is one node, however many rules name it. The nodes are
+ * numbered in the order a depth-first build would finish them, so building
+ * the lowest numbered node that is ready gives the same order as building
+ * one target at a time. Every node also keeps the stat of its file, so a
+ * file is stat'ed once however many targets depend on it.
+ */
+
+// State type, what the build has done with a node.
+typedef enum node_state
+{
+    NODE_PENDING,
+    NODE_UP_TO_DATE,
+    NODE_REBUILT,
+    NODE_FAILED
+} node_state;
+
+// Node type.
+typedef struct node
+{
+    const char *name;
+    //NULL for a file without a rule.
+    rule *rule;
+    //nodes this node depends on and nodes that depend on it.
+    int *prereqs;
+    int numb_of_prereqs;
+    int *dependents;
+    int numb_of_dependents;
+    //prerequisites that are not built yet, the node is ready at 0.
+    int pending;
+    node_state state;
+    //the stat of the file once stat_done is set, stat_error is the errno if it failed.
+    bool stat_done;
+    int stat_error;
+    struct stat st;
+} node;
+
+// Graph type.
+typedef struct graph
+{
+    node *nodes;
+    int numb_of_nodes;
+} graph;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that makes the graph of some targets. A cycle or a file
+ *        without a rule that does not exist is printed and fails the whole
+ *        graph, before anything is built.
+ *
+ * @param g the graph to fill in
+ * @param m the makefile
+ * @param targets the targets to build
+ * @param count number of targets
+ * @return 0 on success, -1 on a cycle or a missing file
+ */
+int graph_build(graph *g, makefile *m, const char **targets, int count);
+
+/**
+ * @brief Function that returns the stat of the file of a node. The file is
+ *        only stat'ed the first time and after graph_changed.
+ *
+ * @param g the graph
+ * @param index the node
+ * @return the stat, or NULL with errno set if the file could not be stat'ed
+ */
+const struct stat *graph_stat(graph *g, int index);
+
+/**
+ * @brief Function that forgets the stat of a node whose file was built.
+ *
+ * @param g the graph
+ * @param index the node
+ */
+void graph_changed(graph *g, int index);
+
+/**
+ * @brief Function that frees a graph.
+ *
+ * @param g the graph
+ */
+void graph_free(graph *g);
+
+#endif
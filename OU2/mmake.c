@@ -8,6 +8,7 @@
  * @copyright Copyright (c) 2021
  * 
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -18,14 +19,47 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
 #include "parser.h"
+#include "graph.h"
+#include "builddb.h"
+
+//the build database, used when it exists or with the H flag.
+#define DB_PATH ".mmake.db"
+
+//the most commands -j runs at the same time, each can hold two fds.
+#define MAX_JOBS 1024
+
+//a command that is running.
+typedef struct job
+{
+    pid_t pid;
+    int node;
+    //where the output of the command is kept with -j above 1, else -1.
+    int out_fd;
+    int err_fd;
+    //what the target is built from, set if there is a build database.
+    bool hashed;
+    uint64_t hash;
+} job;
 
 //decliration of functions.
-bool check_files(const char *target, const char **prereq);
-void target_builder(const char *target, makefile *m_file, int f, int B, int s);
+bool check_files(graph *g, int index);
+bool target_hash(graph *g, build_db *db, int index, uint64_t *hash);
+bool needs_build(graph *g, build_db *db, int index, int B, job *j);
 FILE *open_default(FILE *file);
-makefile *parse_makefile_func(FILE *file);
-void target_builder_func(makefile *m_file, int f, int B, int s, char *argv[]);
+makefile *parse_makefile_func(FILE *file, const char *path);
+int target_builder_func(makefile *m_file, build_db *db, int jobs, int B, int s, char *argv[]);
+int build_targets(graph *g, build_db *db, int jobs, int B, int s);
+bool start_target(graph *g, build_db *db, int index, int B, int s, bool buffered, job *j);
+void finish_target(graph *g, int index, node_state state, int *ready, int *numb_of_ready);
+void flush_job(job *j);
+int open_buffer(void);
+void copy_buffer(int fd, FILE *stream);
+void ready_push(int *ready, int *numb_of_ready, int index);
+int ready_pop(int *ready, int *numb_of_ready);
+int parse_jobs(const char *arg);
 
 /**
  * @brief Main function that runs the program
@@ -40,16 +74,21 @@ int main(int argc, char *argv[])
     int f = 0;
     int B = 0; 
     int s = 0;
+    int H = 0;
+    int jobs = 1;
     FILE *file;
+    const char *path = "mmakefile";
     makefile *m_file;
+    build_db *db = NULL;
     
     //loop to catch the correct flags
-    while ((flag = getopt(argc, argv, "f:Bs")) != -1)
+    while ((flag = getopt(argc, argv, "f:BsHj:")) != -1)
     {
         switch (flag)
         {
         case 'f':
             f = 1;
+            path = optarg;
 
             if ((file = fopen(optarg, "r")) == NULL)
             {
@@ -63,6 +102,12 @@ int main(int argc, char *argv[])
         case 's':
             s = 1;
             break;
+        case 'H':
+            H = 1;
+            break;
+        case 'j':
+            jobs = parse_jobs(optarg);
+            break;
         default:
             fprintf(stderr, "No valid flag!\n");
             return EXIT_FAILURE;
@@ -76,51 +121,64 @@ int main(int argc, char *argv[])
     }
     
     //parse the makefile
-    m_file = parse_makefile_func(file);
+    m_file = parse_makefile_func(file, path);
+
+    //once there is a build database it is always used, so it never misses a build.
+    if (H || access(DB_PATH, F_OK) == 0)
+    {
+        db = db_open(DB_PATH);
+    }
 
     //build the target
-    target_builder_func(m_file, f, B, s, argv);
+    int exit_code = target_builder_func(m_file, db, jobs, B, s, argv);
     
     //close files and close program
+    if (db != NULL)
+    {
+        db_save(db);
+        db_free(db);
+    }
     fclose(file);
     makefile_del(m_file);
-    return EXIT_SUCCESS;
+    return exit_code;
 }
 
 /**
- * @brief Function that checks if the target file has been edited
+ * @brief Function that checks if the target file has been edited. The
+ *        stats come from the graph, every file is only stat'ed once.
  * 
- * @param target target to check
- * @param prereq prerequsits to check
+ * @param g the graph
+ * @param index target to check
  * @return true 
  * @return false 
  */
-bool check_files(const char *target, const char **prereq)
+bool check_files(graph *g, int index)
 {
-    struct stat file_information;
+    const node *n = &g->nodes[index];
+    const struct stat *file_information;
 
     //check if target stats was returned correctly
-    if (stat(target, &file_information) < 0)
+    if ((file_information = graph_stat(g, index)) == NULL)
     {
-        perror(target);
+        perror(n->name);
         exit(EXIT_FAILURE);
     }
 
     //set time_target and time_prereq
-    time_t time_target = file_information.st_mtime;
+    time_t time_target = file_information->st_mtime;
     time_t time_prereq;
 
     //loop through every prerequisit
-    for (int i = 0; prereq[i] != NULL; i++)
+    for (int i = 0; i < n->numb_of_prereqs; i++)
     {
         //check if target stats was returned correctly
-        if (stat(prereq[i], &file_information) < 0)
+        if ((file_information = graph_stat(g, n->prereqs[i])) == NULL)
         {
-            perror(target);
+            perror(g->nodes[n->prereqs[i]].name);
             exit(EXIT_FAILURE);
         }
 
-        time_prereq = file_information.st_mtime;
+        time_prereq = file_information->st_mtime;
 
         //if there is a time differance in the files
         if (time_prereq > time_target)
@@ -131,6 +189,96 @@ bool check_files(const char *target, const char **prereq)
     return false;
 }
 
+/**
+ * @brief Function that hashes what a target is built from: its command and
+ *        the names and contents of its prerequisites. A file is only read
+ *        if it changed since it was hashed last.
+ * 
+ * @param g the graph
+ * @param db the build database
+ * @param index the target
+ * @param hash set to the hash
+ * @return true on success, false if a prerequisite could not be read
+ */
+bool target_hash(graph *g, build_db *db, int index, uint64_t *hash)
+{
+    const node *n = &g->nodes[index];
+    char **command = rule_cmd(n->rule);
+    uint64_t h = db_hash(0, &n->numb_of_prereqs, sizeof(n->numb_of_prereqs));
+
+    //the ending zero of every word keeps "a b" and "ab" apart.
+    for (int i = 0; command[i] != NULL; i++)
+    {
+        h = db_hash(h, command[i], strlen(command[i]) + 1);
+    }
+
+    for (int i = 0; i < n->numb_of_prereqs; i++)
+    {
+        const char *name = g->nodes[n->prereqs[i]].name;
+        const struct stat *file_information = graph_stat(g, n->prereqs[i]);
+        uint64_t content;
+
+        if (file_information == NULL || !db_file_hash(db, name, file_information, &content))
+        {
+            return false;
+        }
+        h = db_hash(h, name, strlen(name) + 1);
+        h = db_hash(h, &content, sizeof(content));
+    }
+
+    *hash = h;
+    return true;
+}
+
+/**
+ * @brief Function that checks if a target has to be built. It has to if it
+ *        does not exist or with the B flag. With a build database a target
+ *        that was built before is built again if what it is built from
+ *        changed and one whose command failed is always built again. Else
+ *        it is built if a prerequisite is newer than it.
+ * 
+ * @param g the graph
+ * @param db the build database, or NULL
+ * @param index the target
+ * @param B flag
+ * @param j hashed and hash are set to what the target is built from
+ * @return true if the target has to be built
+ */
+bool needs_build(graph *g, build_db *db, int index, int B, job *j)
+{
+    const char *name = g->nodes[index].name;
+    uint64_t built_from;
+    bool changed;
+
+    j->hashed = db != NULL && target_hash(g, db, index, &j->hash);
+
+    if (graph_stat(g, index) == NULL || B)
+    {
+        return true;
+    }
+
+    db_target_state state = db != NULL ? db_target_get(db, name, &built_from) : DB_NEVER_BUILT;
+    if (state == DB_FAILED)
+    {
+        changed = true;
+    }
+    else if (state == DB_BUILT && j->hashed)
+    {
+        changed = built_from != j->hash;
+    }
+    else
+    {
+        changed = check_files(g, index);
+    }
+
+    //a target that is up to date is built from what it has now.
+    if (!changed && j->hashed)
+    {
+        db_target_set(db, name, j->hash);
+    }
+    return changed;
+}
+
 /**
  * @brief Function that sets the default target if no target is set.
  * 
@@ -149,16 +297,18 @@ FILE *open_default(FILE *file)
 }
 
 /**
- * @brief Function that parses the makefile from file
+ * @brief Function that parses the makefile from file, or loads its cache
+ *        if the file has not changed since it was parsed last.
  * 
  * @param file to parse
+ * @param path name of the file
  * @return makefile* 
  */
-makefile *parse_makefile_func(FILE *file)
+makefile *parse_makefile_func(FILE *file, const char *path)
 {   
     makefile *m_file;
 
-    if ((m_file = parse_makefile(file)) == NULL)
+    if ((m_file = parse_makefile_cached(file, path)) == NULL)
     {
         fprintf(stderr, "mmakefile: Could not parse makefile\n");
         exit(EXIT_FAILURE);
@@ -168,112 +318,414 @@ makefile *parse_makefile_func(FILE *file)
 }
 
 /**
- * @brief Function that build the target
+ * @brief Function that builds the targets on the command line, or the
+ *        default target. The whole graph is made first, so a cycle or a
+ *        missing file stops mmake before anything is built.
  * 
  * @param m_file the makefile 
- * @param f flag
+ * @param db the build database, or NULL
+ * @param jobs largest number of commands that run at the same time
  * @param B flag
  * @param s flag
  * @param argv argument
+ * @return EXIT_SUCCESS if every target was built
  */
-void target_builder_func(makefile *m_file, int f, int B, int s, char *argv[])
+int target_builder_func(makefile *m_file, build_db *db, int jobs, int B, int s, char *argv[])
 {
-    int index = optind;
-    char *target = argv[index];
+    const char *default_target = makefile_default_target(m_file);
+    const char **targets = (const char **)argv + optind;
+    int count = 0;
+    graph g;
 
-    if (target == NULL)
+    while (targets[count] != NULL)
     {
-        target_builder(makefile_default_target(m_file), m_file, f, B, s);
+        count++;
     }
-    else
+    if (count == 0)
     {
-        while (target != NULL)
-        {
-            target_builder(target, m_file, f, B, s);
-            index++;
-            target = argv[index];
-        }
+        targets = &default_target;
+        count = 1;
+    }
+
+    if (graph_build(&g, m_file, targets, count) == -1)
+    {
+        return EXIT_FAILURE;
     }
+
+    int exit_code = build_targets(&g, db, jobs, B, s);
+    graph_free(&g);
+    return exit_code;
 }
 
 /**
- * @brief Function that builds the target from rules and prerequisit.
+ * @brief Function that builds the graph with at most jobs commands at the
+ *        same time. A target is ready when all its prerequisites are built
+ *        and the ready target with the lowest number goes first, so with one
+ *        job the order is the one of a depth-first build. wait sleeps until
+ *        any command exits. After a command fails no new ones are started,
+ *        the running ones are waited for. A target that was built is saved
+ *        in the build database with what it was built from.
  * 
- * @param target target to build
- * @param m_file the makefile 
- * @param f flag
+ * @param g the graph
+ * @param db the build database, or NULL
+ * @param jobs largest number of commands that run at the same time
  * @param B flag
  * @param s flag
+ * @return EXIT_SUCCESS if every target was built
  */
-void target_builder(const char *target, makefile *m_file, int f, int B, int s)
+int build_targets(graph *g, build_db *db, int jobs, int B, int s)
 {
-    rule *rules = makefile_rule(m_file, target);
+    int *ready = malloc(sizeof(*ready) * (g->numb_of_nodes + 1));
+    job *running = malloc(sizeof(*running) * jobs);
+    int numb_of_ready = 0;
+    int numb_of_running = 0;
+    bool failed = false;
 
-    //get the rules 
-    if (rules == NULL)
-    {   
-        //check if the target is accessable
-        if (!(access(target, F_OK) == 0))
-        {
-            fprintf(stderr, "No target!\n");
-            exit(EXIT_FAILURE);
-        }    
-       return; 
+    if (ready == NULL || running == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(EXIT_FAILURE);
     }
-    
-    const char **prereq = rule_prereq(rules);
 
-    //send in the prerequisits 
-    for (int i = 0; prereq[i] != NULL; i++)
+    for (int i = 0; i < g->numb_of_nodes; i++)
     {
-        target_builder(prereq[i], m_file, f, B, s);
+        if (g->nodes[i].pending == 0)
+        {
+            ready_push(ready, &numb_of_ready, i);
+        }
     }
 
-    //check if file is accessable or B flag or if file has been edited
-    if (!(access(target, F_OK) == 0) || B || check_files(target, prereq))
+    while (numb_of_ready > 0 || numb_of_running > 0)
     {
-        char **command = rule_cmd(rules);
+        //start ready targets until every job is used.
+        while (!failed && numb_of_ready > 0 && numb_of_running < jobs)
+        {
+            int index = ready_pop(ready, &numb_of_ready);
+
+            if (start_target(g, db, index, B, s, jobs > 1, &running[numb_of_running]))
+            {
+                numb_of_running++;
+            }
+            else
+            {
+                finish_target(g, index, NODE_UP_TO_DATE, ready, &numb_of_ready);
+            }
+        }
 
-        pid_t pid = fork();
+        if (numb_of_running == 0)
+        {
+            break;
+        }
 
-        //checks if fork failed or not
+        //wait for any command to exit.
+        int wait_check;
+        pid_t pid = wait(&wait_check);
         if (pid < 0)
         {
-            perror("Fork failed!\n");
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Wait failed!");
             exit(EXIT_FAILURE);
         }
 
-        //child process
-        else if (pid == 0)
+        for (int i = 0; i < numb_of_running; i++)
         {
-            //execute command
-            if (execvp(*command, command) < 0)
+            if (running[i].pid != pid)
             {
-                perror(*command);
-                exit(EXIT_FAILURE);
+                continue;
             }
-        }
-        if (s == 0)
-        {   
-            //print to stdout
-            for (int i = 0; command[i] != NULL; i++) 
+
+            job done = running[i];
+            running[i] = running[--numb_of_running];
+            flush_job(&done);
+
+            //the file has changed, its dependents stat it again.
+            graph_changed(g, done.node);
+            if (db != NULL && wait_check == 0 && done.hashed)
             {
-                if (i != 0)
-                {
-                    printf(" ");
-                }
+                db_target_set(db, g->nodes[done.node].name, done.hash);
+            }
+            else if (db != NULL)
+            {
+                db_target_failed(db, g->nodes[done.node].name);
+            }
 
-                printf("%s", command[i]);
+            if (wait_check != 0)
+            {
+                g->nodes[done.node].state = NODE_FAILED;
+                failed = true;
             }
-            printf("\n");
+            else
+            {
+                finish_target(g, done.node, NODE_REBUILT, ready, &numb_of_ready);
+            }
+            break;
         }
-        
-        //wait loop
-        int wait_check;
-        wait(&wait_check);
-        if (wait_check > 0)
+    }
+
+    free(ready);
+    free(running);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Function that starts the command of a target if it has to be
+ *        built, because it does not exist, the B flag or a prerequisite
+ *        that changed.
+ * 
+ * @param g the graph
+ * @param db the build database, or NULL
+ * @param index the target
+ * @param B flag
+ * @param s flag
+ * @param buffered true if the output is kept until the command is done
+ * @param j set to the started command
+ * @return true if a command was started, false if there was nothing to do
+ */
+bool start_target(graph *g, build_db *db, int index, int B, int s, bool buffered, job *j)
+{
+    node *n = &g->nodes[index];
+
+    //every node is only evaluated once.
+    if (n->rule == NULL || n->state != NODE_PENDING)
+    {
+        return false;
+    }
+
+    //check if file is accessable or B flag or if file has been edited
+    if (!needs_build(g, db, index, B, j))
+    {
+        return false;
+    }
+
+    char **command = rule_cmd(n->rule);
+    if (command[0] == NULL)
+    {
+        return false;
+    }
+
+    if (s == 0)
+    {   
+        //print to stdout
+        for (int i = 0; command[i] != NULL; i++) 
+        {
+            if (i != 0)
+            {
+                printf(" ");
+            }
+
+            printf("%s", command[i]);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+
+    j->node = index;
+    j->out_fd = buffered ? open_buffer() : -1;
+    j->err_fd = buffered ? open_buffer() : -1;
+    j->pid = fork();
+
+    //checks if fork failed or not
+    if (j->pid < 0)
+    {
+        perror("Fork failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //child process
+    else if (j->pid == 0)
+    {
+        if (buffered && (dup2(j->out_fd, STDOUT_FILENO) < 0 || dup2(j->err_fd, STDERR_FILENO) < 0))
         {
+            perror("Dup failed!");
             exit(EXIT_FAILURE);
         }
-    }  
-}
\ No newline at end of file
+
+        //execute command
+        if (execvp(*command, command) < 0)
+        {
+            perror(*command);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Function that marks a target as up to date or rebuilt, the
+ *        targets that only waited for it are ready.
+ * 
+ * @param g the graph
+ * @param index the target
+ * @param state what was done with the target
+ * @param ready the ready targets
+ * @param numb_of_ready number of ready targets
+ */
+void finish_target(graph *g, int index, node_state state, int *ready, int *numb_of_ready)
+{
+    node *n = &g->nodes[index];
+
+    n->state = state;
+
+    for (int i = 0; i < n->numb_of_dependents; i++)
+    {
+        int dependent = n->dependents[i];
+
+        if (--g->nodes[dependent].pending == 0)
+        {
+            ready_push(ready, numb_of_ready, dependent);
+        }
+    }
+}
+
+/**
+ * @brief Function that prints the kept output of a command that is done, in
+ *        one piece so the output of commands that ran at the same time is
+ *        not mixed.
+ * 
+ * @param j the command
+ */
+void flush_job(job *j)
+{
+    if (j->out_fd != -1)
+    {
+        copy_buffer(j->out_fd, stdout);
+        close(j->out_fd);
+    }
+    if (j->err_fd != -1)
+    {
+        copy_buffer(j->err_fd, stderr);
+        close(j->err_fd);
+    }
+}
+
+/**
+ * @brief Function that creates an unlinked temporary file that the output of
+ *        a command is kept in.
+ * 
+ * @return the fd of the file
+ */
+int open_buffer(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char template[PATH_MAX];
+
+    snprintf(template, sizeof(template), "%s/mmake.XXXXXX", dir != NULL ? dir : "/tmp");
+
+    int fd = mkostemp(template, O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(template);
+        exit(EXIT_FAILURE);
+    }
+    unlink(template);
+
+    return fd;
+}
+
+/**
+ * @brief Function that copies a file from its start to a stream.
+ * 
+ * @param fd the file
+ * @param stream where to copy it
+ */
+void copy_buffer(int fd, FILE *stream)
+{
+    char buffer[65536];
+    off_t offset = 0;
+    ssize_t n;
+
+    fflush(stream);
+    while ((n = pread(fd, buffer, sizeof(buffer), offset)) > 0)
+    {
+        if (write(fileno(stream), buffer, n) != n)
+        {
+            break;
+        }
+        offset += n;
+    }
+}
+
+/**
+ * @brief Function that adds a target to the ready targets, a heap with the
+ *        lowest number first.
+ * 
+ * @param ready the heap
+ * @param numb_of_ready number of targets in it
+ * @param index the target
+ */
+void ready_push(int *ready, int *numb_of_ready, int index)
+{
+    int i = (*numb_of_ready)++;
+
+    while (i > 0 && ready[(i - 1) / 2] > index)
+    {
+        ready[i] = ready[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    ready[i] = index;
+}
+
+/**
+ * @brief Function that takes the target with the lowest number from the
+ *        ready targets.
+ * 
+ * @param ready the heap
+ * @param numb_of_ready number of targets in it
+ * @return the target
+ */
+int ready_pop(int *ready, int *numb_of_ready)
+{
+    int first = ready[0];
+    int last = ready[--(*numb_of_ready)];
+    int i = 0;
+
+    for (;;)
+    {
+        int child = 2 * i + 1;
+
+        if (child >= *numb_of_ready)
+        {
+            break;
+        }
+        if (child + 1 < *numb_of_ready && ready[child + 1] < ready[child])
+        {
+            child++;
+        }
+        if (ready[child] >= last)
+        {
+            break;
+        }
+        ready[i] = ready[child];
+        i = child;
+    }
+    ready[i] = last;
+
+    return first;
+}
+
+/**
+ * @brief Function that parses the argument of -j, a number from 1 to
+ *        MAX_JOBS.
+ * 
+ * @param arg the flag argument
+ * @return the number of jobs
+ */
+int parse_jobs(const char *arg)
+{
+    char *rest;
+
+    errno = 0;
+    long number = strtol(arg, &rest, 10);
+
+    if (errno != 0 || rest == arg || *rest != '\0' || number < 1 || number > MAX_JOBS)
+    {
+        fprintf(stderr, "Invalid number of jobs: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return number;
+}
@@ -7,214 +7,852 @@
  * @author Elias Åström, Fredrik Peteri
  * @date 2020-09-04
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "parser.h"
 
-#define MAX_RULES 256
-#define MAX_LINE 1024
-#define MAX_PREREQ 32
-#define MAX_CMD 32
+// bytes read at a time from a makefile that can not be mapped
+#define READ_SIZE 65536
+
+// the first bytes of an image and the version of its layout
+#define IMAGE_MAGIC "mmakeimg"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304
+
+// round up to a multiple of 8, the start of every part of an image
+#define ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/*
+ * A parsed makefile is kept as an image: one block of memory which only
+ * holds offsets from its start, never pointers.  So the image can be written
+ * to a cache file as it is and be mapped again at any address, without
+ * being read or changed.  The parts of an image are the header, the text of
+ * the makefile with every word terminated, the rules, the words of the
+ * rules, the prerequisite ids, the names, the first rule of every name and
+ * the name index.
+ */
+struct image {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t word_size;
+	uint32_t int_size;
+
+	// the makefile the image was made from
+	uint64_t source_size;
+	uint64_t source_ino;
+	int64_t source_mtime_sec;
+	int64_t source_mtime_nsec;
+
+	// size of the whole image and the offsets of its parts
+	uint64_t size;
+	uint64_t n_rules;
+	uint64_t rules;
+	uint64_t ids;
+	uint64_t index_size;
+	uint64_t index;
+	uint64_t n_names;
+	uint64_t names;
+	uint64_t name_rules;
+};
+
+struct rule {
+	// offset of the rule in the image, the image is found from the rule
+	uint64_t self;
+	uint64_t target;
+	int32_t target_id;
+	uint32_t n_prereq;
+
+	// offset of the prerequisite ids, they end with -1
+	uint64_t prereq_id;
+
+	// offset of the prerequisites and the command, each list ends with
+	// NULL.  The words hold offsets in the text until the rule is first
+	// used, then they are changed to pointers.
+	uint64_t words;
+	uint32_t n_words;
+	uint32_t resolved;
+};
 
 struct makefile {
-	struct rule *rules;
+	struct image *image;
+	bool mapped;
+
+	// the parts of the image
+	rule *rules;
+	int *ids;
+	int *index;
+	size_t index_size;
+	uint64_t *names;
+	int *name_rules;
 };
 
-struct rule {
+// a rule while the text is parsed, before the image is made
+typedef struct draft {
 	char *target;
-	char **prereq;
-	char **cmd;
-	rule *next;
-};
+	// index of the first prerequisite in words
+	size_t word;
+	size_t n_prereq;
+	size_t n_words;
+} draft;
+
+// the text of a makefile and its rules while it is parsed
+typedef struct source {
+	char *text;
+	size_t text_size;
+	bool mapped;
+
+	draft *rules;
+	size_t n_rules;
+
+	// the prerequisites and the command of every rule, each ends with NULL
+	char **words;
+	size_t n_words;
+} source;
 
 /**
- * Check if line is blank.
+ * Check if c is whitespace, like isspace in the C locale.
  */
-static bool is_blank_line(const char *s)
+static bool is_space(char c)
 {
-	for (size_t i = 0; s[i] != '\0'; i++) {
-		if (!isspace(s[i]))
-			return false;
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * FNV-1a hash of a string.
+ */
+static uint64_t hash_name(const char *s)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *s != '\0'; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	return h;
+}
+
+/**
+ * Find the slot of a name in the index, either the slot holding its id or
+ * the empty slot where it would go.
+ */
+static size_t find_slot(const makefile *m, const char *name)
+{
+	const char *image = (const char *)m->image;
+	size_t mask = m->index_size - 1;
+	size_t i = hash_name(name) & mask;
+
+	while (m->index[i] != -1
+			&& strcmp(image + m->names[m->index[i]], name) != 0)
+		i = (i + 1) & mask;
+	return i;
+}
+
+/**
+ * Get the id of a name in the image, giving it a new id if it has none.
+ * The index and names are made big enough for every name before the first
+ * call.
+ *
+ * @param m     The makefile.
+ * @param name  Offset of a name in the image.
+ * @return      The id of the name.
+ */
+static int intern(makefile *m, uint64_t name)
+{
+	size_t slot = find_slot(m, (char *)m->image + name);
+
+	if (m->index[slot] == -1) {
+		m->names[m->image->n_names] = name;
+		m->index[slot] = m->image->n_names++;
 	}
+	return m->index[slot];
+}
+
+/**
+ * Set the pointers to the parts of the image of a makefile.
+ */
+static void attach(makefile *m)
+{
+	char *image = (char *)m->image;
+
+	m->rules = (rule *)(image + m->image->rules);
+	m->ids = (int *)(image + m->image->ids);
+	m->index = (int *)(image + m->image->index);
+	m->index_size = m->image->index_size;
+	m->names = (uint64_t *)(image + m->image->names);
+	m->name_rules = (int *)(image + m->image->name_rules);
+}
+
+/**
+ * Load the text of a makefile.  A regular file is mapped with private
+ * pages, so the words can be terminated in place without copying the file.
+ * A word at the very end needs a byte after the file, the rest of the last
+ * page.  When that page is full or the file can not be mapped it is read
+ * into memory instead.
+ *
+ * @param s     The source, text, text_size and mapped are set.
+ * @param fp    File to read from.
+ * @return      true on success.
+ */
+static bool load_text(source *s, FILE *fp)
+{
+	struct stat st;
+	int fd = fileno(fp);
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+			&& ftell(fp) == 0) {
+		char *text = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE, fd, 0);
+
+		if (text != MAP_FAILED && (st.st_size % page != 0
+					|| text[st.st_size - 1] == '\n')) {
+			s->text = text;
+			s->text_size = st.st_size;
+			s->mapped = true;
+			return true;
+		}
+		if (text != MAP_FAILED)
+			munmap(text, st.st_size);
+	}
+
+	size_t size = READ_SIZE;
+	size_t n;
+	s->text_size = 0;
+	s->text = malloc(size + 1);
+	while (s->text != NULL
+			&& (n = fread(s->text + s->text_size, 1,
+					size - s->text_size, fp)) > 0) {
+		s->text_size += n;
+		if (s->text_size == size) {
+			char *text = realloc(s->text, 2 * size + 1);
+			if (text == NULL) {
+				free(s->text);
+				s->text = NULL;
+				return false;
+			}
+			s->text = text;
+			size *= 2;
+		}
+	}
+	if (s->text == NULL || ferror(fp))
+		return false;
+
+	s->text[s->text_size] = '\0';
 	return true;
 }
 
 /**
- * Parse a word and update p to point to the first character after the word.
- * The word is delimited by whitespace and any character in delim.  The
- * returned string should be freed using free.
+ * Free the text and rules of a source.
+ */
+static void source_del(source *s)
+{
+	if (s->mapped)
+		munmap(s->text, s->text_size);
+	else
+		free(s->text);
+	free(s->rules);
+	free(s->words);
+}
+
+/**
+ * Find the next line which is not blank, searching for newlines with
+ * memchr.  Advances p past the line.
+ *
+ * @param p         Where to start, updated to the start of the next line.
+ * @param end       End of the text.
+ * @param line_end  Set to the newline or the end of the text.
+ * @return          The start of the line, or NULL if there is none.
+ */
+static char *next_line(char **p, char *end, char **line_end)
+{
+	while (*p < end) {
+		char *start = *p;
+		char *nl = memchr(start, '\n', end - start);
+		char *stop = nl != NULL ? nl : end;
+
+		*p = nl != NULL ? nl + 1 : end;
+		for (char *c = start; c < stop; c++) {
+			if (!is_space(*c)) {
+				*line_end = stop;
+				return start;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Advance p to the next character which is not a space, stops at stop.
+ */
+static char *skipwhite(char *p, char *stop)
+{
+	while (p < stop && is_space(*p))
+		p++;
+	return p;
+}
+
+/**
+ * Parse the words of a line up to stop into s->words and terminate each
+ * of them in place.  The list ends with NULL.
+ *
+ * @return      Number of words.
  */
-static char *parse_word(char **p, char *delim)
+static size_t parse_words(source *s, char *p, char *stop)
 {
 	size_t n = 0;
-	while (!isspace((*p)[n]) && strchr(delim, (*p)[n]) == NULL)
+
+	while ((p = skipwhite(p, stop)) < stop) {
+		s->words[s->n_words++] = p;
 		n++;
+		while (p < stop && !is_space(*p))
+			p++;
+		if (p < stop)
+			*p++ = '\0';
+	}
+	s->words[s->n_words++] = NULL;
+	*stop = '\0';
+	return n;
+}
 
-	if (n == 0)
-		return NULL;
+/**
+ * Parse a rule into s->rules.
+ *
+ * @param s     The source.
+ * @param p     Where to start, updated to after the rule.
+ * @param err   Pointer to flag which gets set to true on error.
+ * @return      true if a rule was parsed.
+ */
+static bool parse_rule(source *s, char **p, bool *err)
+{
+	char *end = s->text + s->text_size;
+	char *line_end;
+	char *q;
 
-	char *path = strndup(*p, n);
-	*p += n;
-	return path;
+	// read line with target and prerequisites
+	if ((q = next_line(p, end, &line_end)) == NULL)
+		return false;
+
+	// line cannot begin with whitespace
+	if (is_space(*q))
+		goto err;
+
+	char *target = q;
+	while (q < line_end && !is_space(*q) && *q != ':')
+		q++;
+	char *target_end = q;
+
+	q = skipwhite(q, line_end);
+
+	if (target_end == target || q == line_end || *q != ':')
+		goto err;
+
+	// parse prerequisites, the colon can be replaced once it is seen
+	draft *r = &s->rules[s->n_rules];
+	r->target = target;
+	r->word = s->n_words;
+	r->n_prereq = parse_words(s, q + 1, line_end);
+	*target_end = '\0';
+
+	// read line with command
+	if ((q = next_line(p, end, &line_end)) == NULL)
+		goto err;
+
+	// command has to begin with tab
+	if (*q != '\t')
+		goto err;
+
+	// parse command
+	parse_words(s, q + 1, line_end);
+	r->n_words = s->n_words - r->word;
+	s->n_rules++;
+	return true;
+
+err:
+	*err = true;
+	return false;
 }
 
 /**
- * Fills buf with the next line from fp.  Returns buf if a line was read and
- * NULL otherwise.
+ * Parse the text of a makefile into rules.  The text is scanned once.  The
+ * rules and words get arrays as big as the text could need, which are
+ * shrunk when the real numbers are known.
+ *
+ * @param s     The source, its text is loaded.
+ * @return      true if the text is a makefile with at least one rule.
  */
-static char *next_line(char buf[MAX_LINE], FILE *fp)
+static bool parse_source(source *s)
 {
-	do {
-		if (fgets(buf, MAX_LINE, fp) == NULL)
-			return NULL;
-	} while (is_blank_line(buf));
+	// a rule is at least "a:\n\t", a word at least one character and a space
+	size_t max_rules = s->text_size / 4 + 2;
+	size_t max_words = s->text_size / 2 + 2 * max_rules + 2;
+	s->rules = malloc(max_rules * sizeof *s->rules);
+	s->words = malloc(max_words * sizeof *s->words);
+	if (s->rules == NULL || s->words == NULL)
+		return false;
+
+	char *p = s->text;
+	bool err = false;
+	while (parse_rule(s, &p, &err))
+		;
 
-	return buf;
+	if (s->n_rules == 0 || err)
+		return false;
+
+	// the arrays only shrink, if that fails the bigger ones are kept
+	draft *rules = realloc(s->rules, s->n_rules * sizeof *s->rules);
+	if (rules != NULL)
+		s->rules = rules;
+	if (s->n_words > 0) {
+		char **words = realloc(s->words, s->n_words * sizeof *s->words);
+		if (words != NULL)
+			s->words = words;
+	}
+	return true;
 }
 
 /**
- * Duplicate an array of strings.
+ * Make the image of a parsed makefile.  The text is copied into the image
+ * and every pointer into it becomes an offset.  The names are found with an
+ * index big enough for every target and prerequisite, then the image gets
+ * an index just big enough for the names, so it stays small when names are
+ * used many times.
  *
- * @param n     Size of array to duplicate.
- * @param a     Array to duplicate.
- * @return      NULL-terminated array which should be freed using free.
+ * @param m     The makefile, its image is set.
+ * @param s     The parsed source.
+ * @param st    Status of the makefile, or NULL if it has none.
+ * @return      true on success.
  */
-static char **dupe_str_array(size_t n, char **a)
+static bool make_image(makefile *m, const source *s, const struct stat *st)
 {
-	char **ret = malloc((n + 1) * sizeof *ret);
+	// every target and prerequisite may be a new name
+	size_t n_ids = 0;
+	for (size_t i = 0; i < s->n_rules; i++)
+		n_ids += s->rules[i].n_prereq + 1;
+
+	size_t text = ALIGN(sizeof(struct image));
+	size_t rules = text + ALIGN(s->text_size + 1);
+	size_t words = rules + s->n_rules * sizeof(rule);
+	size_t ids = words + s->n_words * sizeof(char *);
+	size_t names = ids + ALIGN(n_ids * sizeof(int));
+
+	char *image = calloc(1, names);
+	uint64_t *found = malloc(n_ids * sizeof *found);
+	for (m->index_size = 2; m->index_size < 2 * n_ids; m->index_size *= 2)
+		;
+	int *index = malloc(m->index_size * sizeof *index);
+	if (image == NULL || found == NULL || index == NULL) {
+		free(image);
+		free(found);
+		free(index);
+		return false;
+	}
+
+	m->image = (struct image *)image;
+	memcpy(m->image->magic, IMAGE_MAGIC, sizeof m->image->magic);
+	m->image->version = IMAGE_VERSION;
+	m->image->byte_order = IMAGE_BYTE_ORDER;
+	m->image->word_size = sizeof(char *);
+	m->image->int_size = sizeof(int);
+	if (st != NULL) {
+		m->image->source_size = st->st_size;
+		m->image->source_ino = st->st_ino;
+		m->image->source_mtime_sec = st->st_mtim.tv_sec;
+		m->image->source_mtime_nsec = st->st_mtim.tv_nsec;
+	}
+	m->image->n_rules = s->n_rules;
+	m->image->rules = rules;
+	m->image->ids = ids;
+	m->rules = (rule *)(image + rules);
+	m->ids = (int *)(image + ids);
+	m->names = found;
+	m->index = index;
+	memset(index, -1, m->index_size * sizeof *index);
+
+	memcpy(image + text, s->text, s->text_size);
+	char **word = (char **)(image + words);
+	for (size_t i = 0; i < s->n_words; i++)
+		word[i] = s->words[i] == NULL ? NULL
+			: (char *)(uintptr_t)(text + (s->words[i] - s->text));
+
+	int *id = m->ids;
+	for (size_t i = 0; i < s->n_rules; i++) {
+		const draft *d = &s->rules[i];
+		rule *r = &m->rules[i];
+
+		r->self = rules + i * sizeof(rule);
+		r->target = text + (d->target - s->text);
+		r->n_prereq = d->n_prereq;
+		r->words = words + d->word * sizeof(char *);
+		r->n_words = d->n_words;
+		r->target_id = intern(m, r->target);
+		r->prereq_id = (char *)id - image;
+		for (size_t j = 0; j < d->n_prereq; j++)
+			*id++ = intern(m, (uintptr_t)word[d->word + j]);
+		*id++ = -1;
+	}
+	free(index);
+
+	// the names, the first rule of every name and the index are put last,
+	// when the number of names is known
+	size_t n_names = m->image->n_names;
+	size_t index_size;
+	for (index_size = 2; index_size < 2 * n_names; index_size *= 2)
+		;
+	size_t name_rules = names + n_names * sizeof(uint64_t);
+	size_t index_at = name_rules + ALIGN(n_names * sizeof(int));
+	size_t size = index_at + index_size * sizeof(int);
+	if ((image = realloc(image, size)) == NULL) {
+		free(found);
+		free(m->image);
+		m->image = NULL;
+		return false;
+	}
+	m->image = (struct image *)image;
+	m->image->size = size;
+	m->image->names = names;
+	m->image->name_rules = name_rules;
+	m->image->index_size = index_size;
+	m->image->index = index_at;
+	memset(image + names, 0, size - names);
+	attach(m);
+	memcpy(m->names, found, n_names * sizeof *found);
+	free(found);
+
+	// every name is unique now, it goes in the first free slot
+	memset(m->index, -1, index_size * sizeof *m->index);
+	for (size_t i = 0; i < n_names; i++)
+		m->index[find_slot(m, image + m->names[i])] = i;
+
+	// the first rule for a target is the one that is used
+	memset(m->name_rules, -1, n_names * sizeof *m->name_rules);
+	for (size_t i = m->image->n_rules; i-- > 0;)
+		m->name_rules[m->rules[i].target_id] = i;
+
+	return true;
+}
 
-	for (size_t i = 0; i < n; i++)
-		ret[i] = a[i];
-	ret[n] = NULL;
+/**
+ * Make the name of the cache of a makefile, the name of the makefile with
+ * a dot before it and .cache after it, in the same directory.
+ *
+ * @return      true if the name fits.
+ */
+static bool cache_path(const char *path, char *cache, size_t size)
+{
+	const char *slash = strrchr(path, '/');
+	int dir = slash != NULL ? slash - path + 1 : 0;
+	int n = snprintf(cache, size, "%.*s.%s.cache", dir, path, path + dir);
 
-	return ret;
+	return n >= 0 && (size_t)n < size;
 }
 
 /**
- * Advance pointer to the next character which is not a space, stops at
- * newline.
+ * Check that count elements of elem_size bytes at an offset in an image are
+ * aligned and lie between the offsets start and end.
  */
-static void skipwhite(char **p)
+static bool in_part(uint64_t offset, uint64_t count, size_t elem_size,
+		uint64_t start, uint64_t end)
 {
-	while (isspace(**p) && **p != '\n')
-		(*p)++;
+	// the parts are aligned to their elements, at most to 8 bytes
+	size_t align = elem_size < 8 ? elem_size : 8;
+
+	return offset % align == 0 && offset >= start && offset <= end
+		&& count <= (end - offset) / elem_size;
 }
 
 /**
- * Check that the character pointed to by p is c, and increment p if it is.
+ * Check that an offset in an image is in its text.  The text ends with
+ * '\0', so every name and word there ends inside it.
  */
-static bool expect(char **p, char c)
+static bool in_text(const struct image *image, uint64_t offset)
 {
-	if (**p != c)
-		return false;
+	return offset >= ALIGN(sizeof *image) && offset < image->rules;
+}
 
-	(*p)++;
+/**
+ * Check that every rule of an image is where it says it is, that its
+ * target, words and prerequisite ids are inside the image and its lists
+ * end where they should.  The words of the rules are changed to pointers
+ * when they are used, so they must not overlap.
+ */
+static bool rules_valid(const struct image *image)
+{
+	const char *base = (const char *)image;
+	const rule *rules = (const rule *)(base + image->rules);
+	uint64_t words_at = image->rules + image->n_rules * sizeof(rule);
+
+	for (uint64_t i = 0; i < image->n_rules; i++) {
+		const rule *r = &rules[i];
+
+		if (r->self != image->rules + i * sizeof(rule)
+				|| !in_text(image, r->target)
+				|| r->target_id < 0
+				|| (uint64_t)r->target_id >= image->n_names
+				|| r->resolved != 0
+				|| r->n_words < (uint64_t)r->n_prereq + 2
+				|| !in_part(r->words, r->n_words, sizeof(char *),
+					words_at, image->ids)
+				|| !in_part(r->prereq_id, (uint64_t)r->n_prereq + 1,
+					sizeof(int), image->ids, image->names))
+			return false;
+		words_at = r->words + r->n_words * sizeof(char *);
+
+		char *const *words = (char *const *)(base + r->words);
+		const int *ids = (const int *)(base + r->prereq_id);
+		if (words[r->n_prereq] != NULL || words[r->n_words - 1] != NULL
+				|| ids[r->n_prereq] != -1)
+			return false;
+		for (uint32_t j = 0; j < r->n_words; j++)
+			if (words[j] != NULL && !in_text(image, (uintptr_t)words[j]))
+				return false;
+		for (uint32_t j = 0; j < r->n_prereq; j++)
+			if (ids[j] < 0 || (uint64_t)ids[j] >= image->n_names)
+				return false;
+	}
 	return true;
 }
 
 /**
- * Parse a rule.
+ * Check that every name of an image is in its text, that the first rule
+ * of every name is a rule and that the index holds ids and has an empty
+ * slot, so a name that is not there is not searched for forever.
+ */
+static bool names_valid(const struct image *image)
+{
+	const char *base = (const char *)image;
+	const uint64_t *names = (const uint64_t *)(base + image->names);
+	const int *name_rules = (const int *)(base + image->name_rules);
+	const int *index = (const int *)(base + image->index);
+	bool empty = false;
+
+	for (uint64_t i = 0; i < image->n_names; i++)
+		if (!in_text(image, names[i]) || name_rules[i] < -1
+				|| (name_rules[i] != -1
+					&& (uint64_t)name_rules[i] >= image->n_rules))
+			return false;
+
+	for (uint64_t i = 0; i < image->index_size; i++) {
+		if (index[i] < -1 || (index[i] != -1
+					&& (uint64_t)index[i] >= image->n_names))
+			return false;
+		empty = empty || index[i] == -1;
+	}
+	return empty;
+}
+
+/**
+ * Check that a mapped cache is an image made by this program from the
+ * makefile as it is now, and that every offset and id in it is inside it,
+ * so a damaged cache is parsed again instead of used.
  *
- * @param fp    File to read from.
- * @param err   Pointer to flag which gets set to true on error.
- * @return      A parsed rule or NULL.
+ * @param image     The mapped cache.
+ * @param size      Size of the cache.
+ * @param st        Status of the makefile.
+ * @return          true if the image can be used.
  */
-static rule *parse_rule(FILE *fp, bool *err)
+static bool image_valid(const struct image *image, size_t size,
+		const struct stat *st)
 {
-	char buf[MAX_LINE];
-	char *p;
+	if (size < sizeof *image
+			|| memcmp(image->magic, IMAGE_MAGIC, sizeof image->magic) != 0
+			|| image->version != IMAGE_VERSION
+			|| image->byte_order != IMAGE_BYTE_ORDER
+			|| image->word_size != sizeof(char *)
+			|| image->int_size != sizeof(int)
+			|| image->size != size)
+		return false;
 
-	// read line with target and prerequisites
-	if ((p = next_line(buf, fp)) == NULL)
-		return NULL;
+	if (image->source_size != (uint64_t)st->st_size
+			|| image->source_ino != st->st_ino
+			|| image->source_mtime_sec != st->st_mtim.tv_sec
+			|| image->source_mtime_nsec != st->st_mtim.tv_nsec)
+		return false;
 
-	// line cannot begin with whitespace
-	if (isspace(*p))
-		goto err0;
+	// the parts follow each other in the order make_image puts them
+	if (image->n_rules == 0 || image->n_rules > INT_MAX
+			|| image->n_names > INT_MAX
+			|| !in_part(image->rules, image->n_rules, sizeof(rule),
+				ALIGN(sizeof *image) + 1, size)
+			|| ((const char *)image)[image->rules - 1] != '\0'
+			|| !in_part(image->ids, 0, sizeof(int), image->rules
+				+ image->n_rules * sizeof(rule), size)
+			|| !in_part(image->names, image->n_names, sizeof(uint64_t),
+				image->ids, size)
+			|| !in_part(image->name_rules, image->n_names, sizeof(int),
+				image->names + image->n_names * sizeof(uint64_t),
+				size)
+			|| image->index_size == 0
+			|| (image->index_size & (image->index_size - 1)) != 0
+			|| !in_part(image->index, image->index_size, sizeof(int),
+				image->name_rules + image->n_names * sizeof(int),
+				size))
+		return false;
 
-	char *target = parse_word(&p, ":");
+	return rules_valid(image) && names_valid(image);
+}
 
-	skipwhite(&p);
+/**
+ * Map the cache of a makefile if it was made from the makefile as it is
+ * now.  The pages are private, so the words of a rule can be changed to
+ * pointers when it is used without writing to the cache.
+ *
+ * @param m     The makefile, its image is set.
+ * @param cache Name of the cache.
+ * @param st    Status of the makefile.
+ * @return      true if the cache was mapped.
+ */
+static bool load_image(makefile *m, const char *cache, const struct stat *st)
+{
+	struct stat cache_st;
+	int fd = open(cache, O_RDONLY | O_CLOEXEC);
 
-	if (!expect(&p, ':'))
-		goto err1;
+	if (fd == -1)
+		return false;
 
-	skipwhite(&p);
+	void *image = MAP_FAILED;
+	if (fstat(fd, &cache_st) == 0 && cache_st.st_size > 0)
+		image = mmap(NULL, cache_st.st_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE, fd, 0);
+	close(fd);
 
-	// parse prerequisites
-	char *prereq[MAX_PREREQ];
-	size_t n_prereq = 0;
-	while (n_prereq < MAX_PREREQ
-			&& (prereq[n_prereq] = parse_word(&p, "")) != NULL) {
-		n_prereq++;
-		skipwhite(&p);
+	if (image == MAP_FAILED)
+		return false;
+	if (!image_valid(image, cache_st.st_size, st)) {
+		munmap(image, cache_st.st_size);
+		return false;
 	}
-	if (!expect(&p, '\n'))
-		goto err2;
 
-	// read line with command
-	if ((p = next_line(buf, fp)) == NULL)
-		goto err2;
+	m->image = image;
+	m->mapped = true;
+	attach(m);
+	return true;
+}
 
-	// command has to begin with tab
-	if (!expect(&p, '\t'))
-		goto err2;
+/**
+ * Write the image of a makefile to its cache.  It is written to a new file
+ * which replaces the cache when it is complete, so a cache is never seen
+ * half written.  A cache that can not be written is not an error.
+ *
+ * @param m     The makefile, no rule of it may have been used yet.
+ * @param cache Name of the cache.
+ */
+static void save_image(const makefile *m, const char *cache)
+{
+	char temp[PATH_MAX];
+	const char *image = (const char *)m->image;
+	size_t left = m->image->size;
+	int fd;
 
-	skipwhite(&p);
+	if (snprintf(temp, sizeof temp, "%s.XXXXXX", cache) >= (int)sizeof temp
+			|| (fd = mkostemp(temp, O_CLOEXEC)) == -1)
+		return;
 
-	// parse command
-	char *cmd[MAX_CMD];
-	size_t n_cmd = 0;
-	while (n_cmd < MAX_CMD && (cmd[n_cmd] = parse_word(&p, "")) != NULL) {
-		n_cmd++;
-		skipwhite(&p);
+	while (left > 0) {
+		ssize_t n = write(fd, image, left);
+
+		if (n <= 0)
+			break;
+		image += n;
+		left -= n;
 	}
 
-	// create rule
-	rule *r = malloc(sizeof *r);
-	r->target = target;
-	r->prereq = dupe_str_array(n_prereq, prereq);
-	r->cmd = dupe_str_array(n_cmd, cmd);
+	if (close(fd) != 0 || left > 0 || rename(temp, cache) != 0)
+		unlink(temp);
+}
+
+/**
+ * Parse a makefile into an image.
+ *
+ * @param fp    The file to parse.
+ * @param st    Status of the file, or NULL if it has none.
+ * @return      The makefile.
+ */
+static makefile *parse_image(FILE *fp, const struct stat *st)
+{
+	makefile *m = calloc(1, sizeof *m);
+	source s = {0};
 
-	return r;
+	if (m == NULL || !load_text(&s, fp) || !parse_source(&s)
+			|| !make_image(m, &s, st)) {
+		source_del(&s);
+		free(m);
+		return NULL;
+	}
 
-err2:
-	for (size_t i = 0; i < n_prereq; i++)
-		free(prereq[i]);
-err1:
-	free(target);
-err0:
-	*err = true;
-	return NULL;
+	source_del(&s);
+	return m;
 }
 
 /**
  * Parse a makefile.
  *
- * @param path  Path to makefile to parse.
+ * @param fp    The file to parse.
  * @return      The makefile.
  */
 makefile *parse_makefile(FILE *fp)
 {
-	makefile *m = malloc(sizeof *m);
-	rule **tailp = &m->rules;
+	struct stat st;
 
-	bool err = false;
-	while ((*tailp = parse_rule(fp, &err)) != NULL)
-		tailp = &(*tailp)->next;
-	*tailp = NULL;
+	return parse_image(fp, fstat(fileno(fp), &st) == 0 ? &st : NULL);
+}
 
-	if (m->rules == NULL || err) {
-		makefile_del(m);
-		return NULL;
-	}
+/**
+ * Parse a makefile, or map its cache if the makefile has not changed since
+ * the cache was written.  A new cache is written when the makefile is
+ * parsed.
+ *
+ * @param fp    The file to parse.
+ * @param path  Name of the file, the cache is named from it.
+ * @return      The makefile.
+ */
+makefile *parse_makefile_cached(FILE *fp, const char *path)
+{
+	char cache[PATH_MAX];
+	struct stat st;
+	makefile *m;
+
+	if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)
+			|| !cache_path(path, cache, sizeof cache))
+		return parse_makefile(fp);
 
+	if ((m = calloc(1, sizeof *m)) != NULL && load_image(m, cache, &st))
+		return m;
+	free(m);
+
+	if ((m = parse_image(fp, &st)) != NULL)
+		save_image(m, cache);
 	return m;
 }
 
+/**
+ * Change the words of a rule from offsets in the image to pointers, the
+ * first time the rule is used.
+ *
+ * @param rule  The rule.
+ * @return      The words of the rule.
+ */
+static char **rule_words(rule *rule)
+{
+	char *image = (char *)rule - rule->self;
+	char **words = (char **)(image + rule->words);
+
+	if (!rule->resolved) {
+		for (size_t i = 0; i < rule->n_words; i++)
+			if (words[i] != NULL)
+				words[i] = image + (uintptr_t)words[i];
+		rule->resolved = 1;
+	}
+	return words;
+}
+
 /**
  * Get the default target for a makefile.  The default target is the target
  * from the first rule.
@@ -224,7 +862,7 @@ makefile *parse_makefile(FILE *fp)
  */
 const char *makefile_default_target(makefile *m)
 {
-	return m->rules->target;
+	return (const char *)m->image + m->rules->target;
 }
 
 /**
@@ -236,11 +874,59 @@ const char *makefile_default_target(makefile *m)
  */
 rule *makefile_rule(makefile *m, const char *target)
 {
-	for (rule *i = m->rules; i != NULL; i = i->next)
-		if (strcmp(i->target, target) == 0)
-			return i;
+	int id = makefile_name_id(m, target);
 
-	return NULL;
+	return id == -1 ? NULL : makefile_rule_id(m, id);
+}
+
+/**
+ * Get the number of distinct target and prerequisite names in a makefile.
+ * The names have the ids 0 to this number - 1.
+ *
+ * @param make  The makefile.
+ * @return      The number of names.
+ */
+int makefile_names(makefile *m)
+{
+	return m->image->n_names;
+}
+
+/**
+ * Get the id of a target or prerequisite name.
+ *
+ * @param make  The makefile.
+ * @param name  The name.
+ * @return      The id of the name, or -1 if the makefile does not use it.
+ */
+int makefile_name_id(makefile *m, const char *name)
+{
+	return m->index[find_slot(m, name)];
+}
+
+/**
+ * Get the name with an id.
+ *
+ * @param make  The makefile.
+ * @param id    Id of a name.
+ * @return      The name.
+ */
+const char *makefile_name(makefile *m, int id)
+{
+	return (const char *)m->image + m->names[id];
+}
+
+/**
+ * Get the rule for building the target with an id.
+ *
+ * @param make  The makefile.
+ * @param id    Id of a name.
+ * @return      The rule for building the target, or NULL if it has none.
+ */
+rule *makefile_rule_id(makefile *m, int id)
+{
+	int i = m->name_rules[id];
+
+	return i == -1 ? NULL : &m->rules[i];
 }
 
 /**
@@ -252,7 +938,7 @@ rule *makefile_rule(makefile *m, const char *target)
  */
 const char **rule_prereq(rule *rule)
 {
-	return (const char **)rule->prereq;
+	return (const char **)rule_words(rule);
 }
 
 /**
@@ -265,30 +951,19 @@ const char **rule_prereq(rule *rule)
  */
 char **rule_cmd(rule *rule)
 {
-	return rule->cmd;
+	return rule_words(rule) + rule->n_prereq + 1;
 }
 
 /**
- * Recursively delete a list of rules.
+ * Get the ids of the prerequisites for a rule.
+ *
+ * @param rule  The rule.
+ * @return      Array containing the ids of the prerequisites for the rule.
+ *              The array is terminated with -1.
  */
-static void del_rules(struct rule *rules)
+const int *rule_prereq_ids(rule *rule)
 {
-	if (rules == NULL)
-		return;
-
-	free(rules->target);
-
-	for (size_t i = 0; rules->prereq[i] != NULL; i++)
-		free(rules->prereq[i]);
-	free(rules->prereq);
-
-	for (size_t i = 0; rules->cmd[i] != NULL; i++)
-		free(rules->cmd[i]);
-	free(rules->cmd);
-
-	del_rules(rules->next);
-
-	free(rules);
+	return (const int *)((char *)rule - rule->self + rule->prereq_id);
 }
 
 /**
@@ -299,6 +974,9 @@ static void del_rules(struct rule *rules)
  */
 void makefile_del(makefile *make)
 {
-	del_rules(make->rules);
+	if (make->mapped)
+		munmap(make->image, make->image->size);
+	else
+		free(make->image);
 	free(make);
 }
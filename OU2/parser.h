@@ -23,6 +23,20 @@ typedef struct rule rule;
  */
 makefile *parse_makefile(FILE *fp);
 
+/**
+ * Parse a makefile, or load it from its cache if the makefile has not
+ * changed since the cache was written.  The cache is a file next to the
+ * makefile with the same name, a dot before it and .cache after it, which
+ * holds the parsed makefile so it can be mapped as it is.  A new cache is
+ * written when the makefile is parsed.  Its size, modification time and
+ * inode tell if the makefile has changed.
+ *
+ * @param fp    The file to parse.
+ * @param path  Name of the file.
+ * @return      The makefile.
+ */
+makefile *parse_makefile_cached(FILE *fp, const char *path);
+
 /**
  * Get the default target for a makefile.  The default target is the target
  * from the first rule.
@@ -41,6 +55,42 @@ const char *makefile_default_target(makefile *make);
  */
 rule *makefile_rule(makefile *make, const char *target);
 
+/**
+ * Get the number of distinct target and prerequisite names in a makefile.
+ * The names have the ids 0 to this number - 1.
+ *
+ * @param make  The makefile.
+ * @return      The number of names.
+ */
+int makefile_names(makefile *make);
+
+/**
+ * Get the id of a target or prerequisite name.
+ *
+ * @param make  The makefile.
+ * @param name  The name.
+ * @return      The id of the name, or -1 if the makefile does not use it.
+ */
+int makefile_name_id(makefile *make, const char *name);
+
+/**
+ * Get the name with an id.
+ *
+ * @param make  The makefile.
+ * @param id    Id of a name.
+ * @return      The name.
+ */
+const char *makefile_name(makefile *make, int id);
+
+/**
+ * Get the rule for building the target with an id.
+ *
+ * @param make  The makefile.
+ * @param id    Id of a name.
+ * @return      The rule for building the target, or NULL if it has none.
+ */
+rule *makefile_rule_id(makefile *make, int id);
+
 /**
  * Get the prerequisites for a rule.
  *
@@ -60,6 +110,15 @@ const char **rule_prereq(rule *rule);
  */
 char **rule_cmd(rule *rule);
 
+/**
+ * Get the ids of the prerequisites for a rule.
+ *
+ * @param rule  The rule.
+ * @return      Array containing the ids of the prerequisites for the rule.
+ *              The array is terminated with -1.
+ */
+const int *rule_prereq_ids(rule *rule);
+
 /**
  * Free the memory of a makefile.  This will also delete the rules returned by
  * makefile_rule.
@@ -0,0 +1,455 @@
+/**
+ * @file checkpoint.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of checkpoint files for resuming a scan.
+ * @version 1
+ * @date 2021-10-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "checkpoint.h"
+#include "snapshot.h"
+
+// ===========INTERNAL DATA TYPES============
+
+/*
+ * The directories from the earlier scan are kept in an open addressing hash
+ * table that is only written while loading, so lookups need no lock. New
+ * directories only go to the file. The same entries are also sorted by path,
+ * so the directories below a skipped one are next to each other and can be
+ * replayed into a snapshot.
+ */
+
+typedef struct entry
+{
+	char *path;
+	struct timespec mtime;
+	long long blocks;
+	long long total;
+} entry;
+
+struct checkpoint
+{
+	FILE *fp;
+	const char *file_name;
+	pthread_mutex_t mutex;
+	entry *entries;
+	size_t capacity;
+	size_t count;
+	entry **sorted;
+};
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that finds the slot of a path, or the empty slot where it
+ *        belongs.
+ *
+ * @param entries the table
+ * @param capacity size of the table, a power of two
+ * @param path path to find
+ * @return the slot
+ */
+static entry *find_slot(entry *entries, size_t capacity, const char *path)
+{
+	size_t i = snapshot_path_hash(path) & (capacity - 1);
+
+	while (entries[i].path != NULL && strcmp(entries[i].path, path) != 0)
+	{
+		i = (i + 1) & (capacity - 1);
+	}
+
+	return &entries[i];
+}
+
+/**
+ * @brief Function that inserts a path into the table, growing it when it is
+ *        more than half full. Takes over the memory of path.
+ *
+ * @param c checkpoint to insert into
+ * @param path path of the directory
+ * @param mtime modification time of the directory when it was scanned
+ * @param blocks blocks of the directory itself and the files directly in it
+ * @param total blocks of the directory
+ */
+static void insert(checkpoint *c, char *path, struct timespec mtime, long long blocks, long long total)
+{
+	if ((c->count + 1) * 2 > c->capacity)
+	{
+		size_t capacity = c->capacity == 0 ? 1024 : c->capacity * 2;
+		entry *entries = calloc(capacity, sizeof(*entries));
+
+		if (entries == NULL)
+		{
+			perror("Failed to allocate");
+			exit(EXIT_FAILURE);
+		}
+
+		for (size_t i = 0; i < c->capacity; i++)
+		{
+			if (c->entries[i].path != NULL)
+			{
+				*find_slot(entries, capacity, c->entries[i].path) = c->entries[i];
+			}
+		}
+
+		free(c->entries);
+		c->entries = entries;
+		c->capacity = capacity;
+	}
+
+	entry *slot = find_slot(c->entries, c->capacity, path);
+
+	//a directory can be in the file twice if it was finished in two runs.
+	if (slot->path != NULL)
+	{
+		free(path);
+	}
+	else
+	{
+		slot->path = path;
+		c->count++;
+	}
+	slot->mtime = mtime;
+	slot->blocks = blocks;
+	slot->total = total;
+}
+
+/**
+ * @brief Function that compares two entries by path.
+ *
+ * @param a first entry
+ * @param b second entry
+ * @return <0, 0 or >0 like strcmp
+ */
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp((*(entry *const *)a)->path, (*(entry *const *)b)->path);
+}
+
+/**
+ * @brief Function that sorts the entries of the table by path.
+ *
+ * @param c checkpoint to sort
+ */
+static void sort(checkpoint *c)
+{
+	size_t n = 0;
+
+	if ((c->sorted = malloc((c->count + 1) * sizeof(*c->sorted))) == NULL)
+	{
+		perror("Failed to allocate");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < c->capacity; i++)
+	{
+		if (c->entries[i].path != NULL)
+		{
+			c->sorted[n++] = &c->entries[i];
+		}
+	}
+
+	qsort(c->sorted, n, sizeof(*c->sorted), compare_paths);
+}
+
+/**
+ * @brief Function that empties the table.
+ *
+ * @param c checkpoint to empty
+ */
+static void clear(checkpoint *c)
+{
+	for (size_t i = 0; i < c->capacity; i++)
+	{
+		free(c->entries[i].path);
+	}
+
+	free(c->entries);
+	free(c->sorted);
+	c->entries = NULL;
+	c->sorted = NULL;
+	c->capacity = 0;
+	c->count = 0;
+}
+
+/**
+ * @brief Function that reads the lines of an earlier scan into the table.
+ *        A last line without newline is from a scan that was killed while
+ *        writing and is ignored.
+ *
+ * @param c checkpoint to load into
+ * @param fp file to read
+ * @param targets the targets of this scan
+ * @param n_targets number of targets
+ * @return true if the earlier scan had the same targets
+ */
+static bool load(checkpoint *c, FILE *fp, char *const targets[], int n_targets)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+	int n_found = 0;
+	bool same = true;
+
+	while ((length = getline(&line, &size, fp)) > 0)
+	{
+		char *rest;
+		struct timespec mtime;
+
+		if (line[length - 1] != '\n')
+		{
+			continue;
+		}
+		line[length - 1] = '\0';
+
+		//the targets come first, one per line.
+		if (strncmp(line, "target\t", 7) == 0)
+		{
+			same = same && n_found < n_targets && strcmp(line + 7, targets[n_found]) == 0;
+			n_found++;
+			continue;
+		}
+
+		long long total = strtoll(line, &rest, 10);
+		if (rest[0] != '\t')
+		{
+			continue;
+		}
+		long long blocks = strtoll(rest + 1, &rest, 10);
+		if (rest[0] != '\t')
+		{
+			continue;
+		}
+		mtime.tv_sec = strtoll(rest + 1, &rest, 10);
+		if (rest[0] != '.')
+		{
+			continue;
+		}
+		mtime.tv_nsec = strtol(rest + 1, &rest, 10);
+		if (rest[0] != '\t')
+		{
+			continue;
+		}
+
+		char *path = strdup(rest + 1);
+
+		if (path == NULL)
+		{
+			perror("Failed to allocate");
+			exit(EXIT_FAILURE);
+		}
+
+		insert(c, path, mtime, blocks, total);
+	}
+
+	free(line);
+	return same && n_found == n_targets;
+}
+
+/**
+ * @brief Function that loads the directories finished by an earlier scan of
+ *        the same targets, if the file exists, and opens the file for
+ *        appending. A file from a scan of other targets is started over.
+ *
+ * @param file_name checkpoint file
+ * @param targets the targets of this scan
+ * @param n_targets number of targets
+ * @return checkpoint* or NULL if the file could not be opened
+ */
+checkpoint *checkpoint_open(const char *file_name, char *const targets[], int n_targets)
+{
+	checkpoint *c = calloc(1, sizeof(*c));
+	bool same = false;
+	FILE *fp;
+
+	if (c == NULL)
+	{
+		perror("Failed to allocate");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pthread_mutex_init(&c->mutex, NULL) != 0)
+	{
+		perror("Mutex failed!");
+		exit(EXIT_FAILURE);
+	}
+
+	c->file_name = file_name;
+
+	//a missing file just means this is the first run.
+	if ((fp = fopen(file_name, "r")) != NULL)
+	{
+		same = load(c, fp, targets, n_targets);
+		fclose(fp);
+	}
+	else if (errno != ENOENT)
+	{
+		perror(file_name);
+		checkpoint_close(c, false);
+		return NULL;
+	}
+
+	if (!same)
+	{
+		clear(c);
+	}
+	sort(c);
+
+	if ((c->fp = fopen(file_name, same ? "a" : "w")) == NULL)
+	{
+		perror(file_name);
+		checkpoint_close(c, false);
+		return NULL;
+	}
+
+	//one line per write, so a killed scan loses at most the line being written.
+	setvbuf(c->fp, NULL, _IOLBF, 0);
+
+	for (int i = 0; !same && i < n_targets; i++)
+	{
+		fprintf(c->fp, "target\t%s\n", targets[i]);
+	}
+
+	return c;
+}
+
+/**
+ * @brief Function that looks up a finished directory. Safe to call from
+ *        several threads at once.
+ *
+ * @param c checkpoint to search
+ * @param path path of the directory
+ * @param mtime modification time of the directory now
+ * @param total set to the blocks used by the directory and everything below it
+ * @return true if the directory was finished by an earlier scan and has not
+ *         been modified since
+ */
+bool checkpoint_lookup(const checkpoint *c, const char *path, const struct timespec *mtime, long long *total)
+{
+	if (c->count == 0)
+	{
+		return false;
+	}
+
+	entry *slot = find_slot(c->entries, c->capacity, path);
+
+	//a directory changed since it was scanned is scanned again.
+	if (slot->path == NULL || slot->mtime.tv_sec != mtime->tv_sec || slot->mtime.tv_nsec != mtime->tv_nsec)
+	{
+		return false;
+	}
+
+	*total = slot->total;
+	return true;
+}
+
+/**
+ * @brief Function that adds a directory finished by an earlier scan and every
+ *        directory below it to a snapshot. Not thread safe for the snapshot,
+ *        the caller has to hold its lock.
+ *
+ * @param c checkpoint to read
+ * @param path path of the directory
+ * @param s snapshot to add to
+ */
+void checkpoint_replay(const checkpoint *c, const char *path, snapshot *s)
+{
+	size_t length = strlen(path);
+	size_t low = 0;
+	size_t high = c->count;
+
+	//the path itself and everything below it sort from the path on.
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+
+		if (strcmp(c->sorted[middle]->path, path) < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	for (size_t i = low; i < c->count; i++)
+	{
+		const char *other = c->sorted[i]->path;
+
+		if (strncmp(other, path, length) != 0)
+		{
+			break;
+		}
+
+		//a sibling such as "dir2" sorts between "dir" and "dir/a".
+		if (other[length] == '\0' || other[length] == '/')
+		{
+			snapshot_add(s, other, c->sorted[i]->blocks);
+		}
+	}
+}
+
+/**
+ * @brief Function that appends a finished directory to the file. Safe to
+ *        call from several threads at once.
+ *
+ * @param c checkpoint to add to
+ * @param path path of the directory
+ * @param mtime modification time of the directory when it was scanned
+ * @param blocks blocks used by the directory itself and the files directly in it
+ * @param total blocks used by the directory and everything below it
+ * @return false if the path can not be written
+ */
+bool checkpoint_add(checkpoint *c, const char *path, const struct timespec *mtime, long long blocks, long long total)
+{
+	//a newline in the path would break the line format, it is scanned again instead.
+	if (strchr(path, '\n') != NULL)
+	{
+		return false;
+	}
+
+	pthread_mutex_lock(&c->mutex);
+	fprintf(c->fp, "%lld\t%lld\t%lld.%09ld\t%s\n", total, blocks, (long long)mtime->tv_sec, mtime->tv_nsec, path);
+	pthread_mutex_unlock(&c->mutex);
+	return true;
+}
+
+/**
+ * @brief Function that closes the file and frees the checkpoint.
+ *
+ * @param c checkpoint to close
+ * @return 0 on success, -1 if the file could not be written
+ */
+int checkpoint_close(checkpoint *c, bool finished)
+{
+	int result = 0;
+
+	if (c->fp != NULL && (ferror(c->fp) | fclose(c->fp)))
+	{
+		perror(c->file_name);
+		result = -1;
+	}
+
+	//a finished scan leaves nothing to resume.
+	if (finished && c->fp != NULL && remove(c->file_name) != 0)
+	{
+		perror(c->file_name);
+		result = -1;
+	}
+
+	clear(c);
+	pthread_mutex_destroy(&c->mutex);
+	free(c);
+	return result;
+}
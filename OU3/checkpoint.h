@@ -0,0 +1,90 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "snapshot.h"
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * A checkpoint file starts with one line per target of the scan,
+ * "target\t<path>\n", followed by one line per directory that was scanned
+ * to the end, including everything below it:
+ * "<total>\t<blocks>\t<mtime seconds>.<mtime nanoseconds>\t<path>\n", where
+ * total counts everything below the directory and blocks only the directory
+ * and the files directly in it, as a snapshot does. Lines are
+ * appended as directories are finished, so an interrupted scan leaves a
+ * usable file. Only a scan of the same targets reuses it, and only for
+ * directories that were not modified since. The targets themselves are not
+ * written as directories. The file is removed when the scan ran to the end,
+ * even with errors, so only a scan stopped by a signal or the time limit is
+ * resumed.
+ */
+
+// Checkpoint type.
+typedef struct checkpoint checkpoint;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that loads the directories finished by an earlier scan of
+ *        the same targets, if the file exists, and opens the file for
+ *        appending. A file from a scan of other targets is started over.
+ *
+ * @param file_name checkpoint file
+ * @param targets the targets of this scan
+ * @param n_targets number of targets
+ * @return checkpoint* or NULL if the file could not be opened
+ */
+checkpoint *checkpoint_open(const char *file_name, char *const targets[], int n_targets);
+
+/**
+ * @brief Function that looks up a finished directory. Safe to call from
+ *        several threads at once.
+ *
+ * @param c checkpoint to search
+ * @param path path of the directory
+ * @param mtime modification time of the directory now
+ * @param total set to the blocks used by the directory and everything below it
+ * @return true if the directory was finished by an earlier scan and has not
+ *         been modified since
+ */
+bool checkpoint_lookup(const checkpoint *c, const char *path, const struct timespec *mtime, long long *total);
+
+/**
+ * @brief Function that adds a directory finished by an earlier scan and every
+ *        directory below it to a snapshot. Not thread safe for the snapshot,
+ *        the caller has to hold its lock.
+ *
+ * @param c checkpoint to read
+ * @param path path of the directory
+ * @param s snapshot to add to
+ */
+void checkpoint_replay(const checkpoint *c, const char *path, snapshot *s);
+
+/**
+ * @brief Function that appends a finished directory to the file. Safe to
+ *        call from several threads at once.
+ *
+ * @param c checkpoint to add to
+ * @param path path of the directory
+ * @param mtime modification time of the directory when it was scanned
+ * @param blocks blocks used by the directory itself and the files directly in it
+ * @param total blocks used by the directory and everything below it
+ * @return false if the path can not be written
+ */
+bool checkpoint_add(checkpoint *c, const char *path, const struct timespec *mtime, long long blocks, long long total);
+
+/**
+ * @brief Function that closes the file and frees the checkpoint. The file is
+ *        removed if the scan finished, so the next scan starts over.
+ *
+ * @param c checkpoint to close
+ * @param finished true if the scan was not stopped by a signal or the time limit
+ * @return 0 on success, -1 if the file could not be written or removed
+ */
+int checkpoint_close(checkpoint *c, bool finished);
+
+#endif
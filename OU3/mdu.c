@@ -21,30 +21,109 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <signal.h>
 
 #include "list.h"
 #include "queue.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+
+//interval between two --progress lines.
+#define PROGRESS_INTERVAL_NS 1000000000L
+//errors kept per thread, the rest are only counted.
+#define MAX_ERRORS_PER_THREAD 1000
+
+typedef struct data data;
+
+//counters owned by one scanning thread, only that thread writes to them.
+typedef struct worker
+{
+    data *d;
+    atomic_llong entries;
+    atomic_llong blocks;
+    atomic_llong skipped;
+    char **errors;
+    int n_errors;
+    long long dropped_errors;
+
+}worker;
+
+//directory in the queue, freed when it and everything below it is done.
+typedef struct dir_node
+{
+    char *path;
+    struct dir_node *parent;
+    bool from_checkpoint;
+    struct timespec mtime;
+    long long blocks;
+    atomic_int pending;
+    atomic_llong total;
+    atomic_bool incomplete;
+
+}dir_node;
 
 //data structure decliration
-typedef struct data
+struct data
 {   
     int number_of_threads;
     queue *queue;
     int exit_code;
     pthread_mutex_t mutex;
     sem_t semaphore;
+    snapshot *snapshot;
+    checkpoint *checkpoint;
+    worker *workers;
+    bool progress;
+    bool has_deadline;
+    struct timespec deadline;
+    atomic_bool stop;
+    atomic_bool partial;
+    bool scan_done;
+    pthread_mutex_t monitor_mutex;
+    pthread_cond_t monitor_condition;
 
-}data;
+};
 
 //decliration of functions.
-int check_target_size(const char *target_file);
-void dir_check(const char *target_dir, data *d);
-mode_t check_target_mode(const char *target);
+bool check_target_stat(dir_node *node, struct stat *file_information, worker *w);
+int dir_check(dir_node *node, worker *w);
 void *check_target(void *ptr);
+void worker_error(worker *w, const char *format, const char *path, int errnum);
+dir_node *node_new(char *path, dir_node *parent);
+void node_release(dir_node *node, data *d);
+void report_errors(data *d);
+void stop_signal_handler(int signal_number);
+void stop_signal_init(data *d);
 int thread_maker(data *d);
 void mutex_init(data *d);
 void add_target(data *d, int argc, char *argv[]);
+int parse_number(const char *arg, const char *what);
+void counter_add(atomic_llong *counter, long long value);
+void *monitor(void *ptr);
+void monitor_start(data *d, pthread_t *thread);
+void monitor_stop(data *d, pthread_t thread);
+void print_progress(data *d, long long *last_entries, const struct timespec *last_time);
+
+//long options, the short ones are kept for the old interface.
+static const struct option long_options[] =
+{
+    {"snapshot", required_argument, NULL, 'S'},
+    {"diff", no_argument, NULL, 'D'},
+    {"top", required_argument, NULL, 'T'},
+    {"progress", no_argument, NULL, 'P'},
+    {"time-limit", required_argument, NULL, 'L'},
+    {"checkpoint", required_argument, NULL, 'C'},
+    {NULL, 0, NULL, 0}
+};
+
+//the scan a SIGINT or SIGTERM stops.
+static data *signal_data;
 
 /**
  * @brief Main function that runs the program.
@@ -62,7 +141,13 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    char flag; 
+    int flag; 
+    int diff = 0;
+    int top = 10;
+    double time_limit = 0;
+    char *snapshot_file = NULL;
+    char *checkpoint_file = NULL;
+    char *rest;
     data *d = malloc(sizeof(*d));
     mutex_init(d);
 
@@ -75,121 +160,395 @@ int main(int argc, char *argv[])
 
     d->number_of_threads = 1;
     d->exit_code = EXIT_SUCCESS;
+    d->snapshot = NULL;
+    d->checkpoint = NULL;
+    d->progress = false;
+    d->has_deadline = false;
+    atomic_init(&d->stop, false);
 
-    // loop to catch j flag.
-    while ((flag = getopt(argc, argv, "j:")) != -1)
+    // loop to catch the flags.
+    while ((flag = getopt_long(argc, argv, "j:", long_options, NULL)) != -1)
     {   
+        switch (flag)
+        {
         // j flag caught
-        if (flag == 'j')
-        {   
-            char* rest;
-
-            errno = 0; 
-            //check how many threads to make
-            d->number_of_threads = strtol(optarg, &rest, 10);
-
-            //if strtol fails.
-            if (errno != 0)
+        case 'j':
+            d->number_of_threads = parse_number(optarg, "threads");
+            break;
+        case 'S':
+            snapshot_file = optarg;
+            break;
+        case 'D':
+            diff = 1;
+            break;
+        case 'T':
+            top = parse_number(optarg, "entries");
+            break;
+        case 'P':
+            d->progress = true;
+            break;
+        case 'L':
+            errno = 0;
+            time_limit = strtod(optarg, &rest);
+            if (errno != 0 || rest[0] != '\0' || !(time_limit > 0))
             {
-                perror("Strltol failed!");
+                fprintf(stderr, "Invalid time limit!\n");
                 return EXIT_FAILURE;
             }
-            
-            //if no, or invalid amout of threads is read
-            if (rest[0] != '\0' || d->number_of_threads <= 0)
-            {
-                fprintf(stderr, "Invalid amount of threads!\n");
-                return EXIT_FAILURE;
-            }
-        }
+            d->has_deadline = true;
+            break;
+        case 'C':
+            checkpoint_file = optarg;
+            break;
         // if a invalid flag is read, print error and close exit program.
-        else
-        {
+        default:
             fprintf(stderr, "No valid flag!\n");
             return EXIT_FAILURE;
         }
     }
 
+    //compare two snapshots instead of scanning.
+    if (diff)
+    {
+        free(d);
+        if (argc - optind != 2)
+        {
+            fprintf(stderr, "usage: ./mdu --diff [--top N] OLD NEW\n");
+            return EXIT_FAILURE;
+        }
+        return snapshot_diff(argv[optind], argv[optind + 1], top);
+    }
+
+    if (snapshot_file != NULL)
+    {
+        d->snapshot = snapshot_empty();
+    }
+
+    //directories in the checkpoint file are not scanned again.
+    if (checkpoint_file != NULL && (d->checkpoint = checkpoint_open(checkpoint_file, argv + optind, argc - optind)) == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    //the time limit covers all targets, so the deadline is set once.
+    if (d->has_deadline)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &d->deadline);
+        d->deadline.tv_sec += (time_t)time_limit;
+        d->deadline.tv_nsec += (long)((time_limit - (time_t)time_limit) * 1e9);
+        if (d->deadline.tv_nsec >= 1000000000L)
+        {
+            d->deadline.tv_sec++;
+            d->deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    d->workers = calloc(d->number_of_threads, sizeof(*d->workers));
+    if (d->workers == NULL)
+    {
+        perror("Allocation failed!");
+        return EXIT_FAILURE;
+    }
+
     //add targets to queue.
+    stop_signal_init(d);
     add_target(d, argc ,argv);
 
+    //the checkpoint is only kept for a scan stopped by a signal or the time limit.
+    if (d->checkpoint != NULL && checkpoint_close(d->checkpoint, !atomic_load(&d->stop)) < 0)
+    {
+        d->exit_code = EXIT_FAILURE;
+    }
+
+    //write the per-directory totals, a stopped scan would look like
+    //everything it did not reach was removed.
+    if (d->snapshot != NULL)
+    {
+        if (atomic_load(&d->stop))
+        {
+            fprintf(stderr, "mdu: scan stopped, snapshot '%s' not written\n", snapshot_file);
+            d->exit_code = EXIT_FAILURE;
+        }
+        else if (snapshot_write(d->snapshot, snapshot_file) < 0)
+        {
+            d->exit_code = EXIT_FAILURE;
+        }
+        snapshot_kill(d->snapshot);
+    }
+
     //return exit_code and free data structure.
     int exit_code = d->exit_code;
+    pthread_mutex_destroy(&d->mutex);
+    free(d->workers);
     free(d);   
     return exit_code;
 }
 
 /**
- * @brief Function that checks the target file. 
+ * @brief Function that parses a positive number from a flag.
  * 
- * @param target_file file to check size of.
- * @return the size as a int.
+ * @param arg the flag argument
+ * @param what what the number counts, used in the error message
+ * @return the number
  */
-int check_target_size(const char *target_file)
-{   
-    struct stat file_information;
-    
-    //check if target stats was returned correctly.
-    if (lstat(target_file, &file_information) < 0)
+int parse_number(const char *arg, const char *what)
+{
+    char* rest;
+
+    errno = 0; 
+    long number = strtol(arg, &rest, 10);
+
+    //if strtol fails.
+    if (errno != 0)
     {
-        perror(target_file);
+        perror("Strltol failed!");
         exit(EXIT_FAILURE);
     }
     
-    return file_information.st_blocks;
+    //if no, or invalid amout is read
+    if (rest[0] != '\0' || number <= 0 || number > INT32_MAX)
+    {
+        fprintf(stderr, "Invalid amount of %s!\n", what);
+        exit(EXIT_FAILURE);
+    }
+
+    return number;
 }
 
 /**
- * @brief function that checks the target mode, directory or file.
+ * @brief Function that records an error of a thread so it can be reported
+ *        when the scan is done.
  * 
- * @param target target to check
- * @return the target as a mode_t
+ * @param w the thread that got the error
+ * @param format message with two %s, for the path and the error
+ * @param path path that failed
+ * @param errnum the errno of the error
  */
-mode_t check_target_mode(const char *target)
+void worker_error(worker *w, const char *format, const char *path, int errnum)
 {
-    struct stat file_information;
-    
-    //check if target stats was returned correctly.
-    if (lstat(target, &file_information) < 0)
+    char reason[256];
+
+    //only the first errors are kept, the rest are only counted.
+    if (w->n_errors == MAX_ERRORS_PER_THREAD)
+    {
+        w->dropped_errors++;
+        return;
+    }
+
+    if (w->errors == NULL)
     {
-        perror(target);
+        w->errors = malloc(sizeof(*w->errors) * MAX_ERRORS_PER_THREAD);
+        if (w->errors == NULL)
+        {
+            perror("Failed to allocate!");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (strerror_r(errnum, reason, sizeof(reason)) != 0)
+    {
+        snprintf(reason, sizeof(reason), "Unknown error %d", errnum);
+    }
+
+    int length = snprintf(NULL, 0, format, path, reason);
+    char *message = malloc(length + 1);
+
+    if (message == NULL)
+    {
+        perror("Failed to allocate!");
         exit(EXIT_FAILURE);
     }
 
-    return file_information.st_mode;
+    snprintf(message, length + 1, format, path, reason);
+    w->errors[w->n_errors++] = message;
+}
+
+/**
+ * @brief Function that creates a node for a directory in the scan. The parent
+ *        is kept alive until all of its sub directories are done.
+ * 
+ * @param path path of the directory, the node takes over the memory
+ * @param parent the directory the path is in, NULL for a target
+ * @return the node
+ */
+dir_node *node_new(char *path, dir_node *parent)
+{
+    dir_node *node = malloc(sizeof(*node));
+
+    if (node == NULL)
+    {
+        perror("Failed to allocate!");
+        exit(EXIT_FAILURE);
+    }
+
+    node->path = path;
+    node->parent = parent;
+    node->from_checkpoint = false;
+    atomic_init(&node->pending, 1);
+    atomic_init(&node->total, 0);
+    atomic_init(&node->incomplete, false);
+
+    if (parent != NULL)
+    {
+        atomic_fetch_add(&parent->pending, 1);
+    }
+
+    return node;
 }
 
 /**
- * @brief Function that reads from dir
+ * @brief Function that marks a directory as done by the thread that read it.
+ *        When the last sub directory is done as well, the total is written to
+ *        the checkpoint and added to the parent, which is then released too.
  * 
- * @param target_dir dir to open
+ * @param node node to release
  * @param d data structure
  */
-void dir_check(const char *target_dir, data *d)
+void node_release(dir_node *node, data *d)
+{
+    while (node != NULL && atomic_fetch_sub(&node->pending, 1) == 1)
+    {
+        dir_node *parent = node->parent;
+        long long total = atomic_load(&node->total);
+        bool incomplete = atomic_load(&node->incomplete);
+
+        //only a directory with nothing missing below it can be skipped next
+        //time, a target is scanned again so its total is never stale. A
+        //directory that can not be written is scanned again with its parent.
+        if (d->checkpoint != NULL && !incomplete && !node->from_checkpoint && parent != NULL
+            && !checkpoint_add(d->checkpoint, node->path, &node->mtime, node->blocks, total))
+        {
+            incomplete = true;
+        }
+
+        if (parent != NULL)
+        {
+            atomic_fetch_add(&parent->total, total);
+            if (incomplete)
+            {
+                atomic_store(&parent->incomplete, true);
+            }
+        }
+
+        free(node->path);
+        free(node);
+        node = parent;
+    }
+}
+
+/**
+ * @brief Function that gets the information of the target. An entry that was
+ *        removed after its directory was read is skipped, other errors are
+ *        recorded and the directory it is in is marked incomplete.
+ * 
+ * @param node target to check
+ * @param file_information the information of the target
+ * @param w the thread that checks
+ * @return true if the information was read
+ */
+bool check_target_stat(dir_node *node, struct stat *file_information, worker *w)
 {
+    //check if target stats was returned correctly.
+    if (lstat(node->path, file_information) == 0)
+    {
+        return true;
+    }
+
+    //a target from the command line that does not exist is an error.
+    if (errno == ENOENT && node->parent != NULL)
+    {
+        counter_add(&w->skipped, 1);
+        return false;
+    }
+
+    worker_error(w, "%s: %s", node->path, errno);
+    atomic_store(&node->incomplete, true);
+    return false;
+}
+
+/**
+ * @brief Function that reads from dir. Sub directories are added to the queue
+ *        and everything else is counted directly, so the returned size is the
+ *        size of the files in this directory only.
+ * 
+ * @param node dir to open
+ * @param w the scanning thread
+ * @return the size of the files directly in the directory.
+ */
+int dir_check(dir_node *node, worker *w)
+{
+    data *d = w->d;
+    const char *target_dir = node->path;
     DIR *dir;
     struct dirent* direntp;
+    struct stat file_information;
+    int size = 0;
 
     //checks if directory is vaild or not.
     if ((dir = opendir(target_dir)) == NULL)
     {
-        fprintf(stderr, "du: cannot read directory '%s': Permission denied\n", target_dir);
-        //only adding mutex lock and unlock here to remove errors when using helgrind. 
-        pthread_mutex_lock(&d->mutex);
-        d->exit_code = EXIT_FAILURE;
-        pthread_mutex_unlock(&d->mutex);
+        if (errno == ENOENT)
+        {
+            counter_add(&w->skipped, 1);
+        }
+        else
+        {
+            worker_error(w, "du: cannot read directory '%s': %s", target_dir, errno);
+            atomic_store(&node->incomplete, true);
+        }
     }
     else
     {   
         //read all files in directory.
         while ((direntp = readdir(dir)) != NULL)
         {   
+            //give up on the rest of the directory when the time is up.
+            if (atomic_load_explicit(&d->stop, memory_order_relaxed))
+            {
+                atomic_store_explicit(&d->partial, true, memory_order_relaxed);
+                atomic_store(&node->incomplete, true);
+                break;
+            }
+
             //removes the "." and ".." from the directory.
             if ((strcmp(direntp->d_name, ".") == 0) || (strcmp(direntp->d_name, "..") == 0))
             {
                 continue;
             }
 
+            //stat relative to the open directory so the path is not resolved again.
+            if (fstatat(dirfd(dir), direntp->d_name, &file_information, AT_SYMLINK_NOFOLLOW) < 0)
+            {
+                //removed between readdir and stat.
+                if (errno == ENOENT)
+                {
+                    counter_add(&w->skipped, 1);
+                }
+                else
+                {
+                    char failed[PATH_MAX];
+
+                    snprintf(failed, sizeof(failed), "%s/%s", target_dir, direntp->d_name);
+                    worker_error(w, "%s: %s", failed, errno);
+                    atomic_store(&node->incomplete, true);
+                }
+                continue;
+            }
+
+            counter_add(&w->entries, 1);
+
+            //if target is a file or a symbolic link.
+            if (S_ISREG(file_information.st_mode) || S_ISLNK(file_information.st_mode))
+            {
+                size += file_information.st_blocks;
+                counter_add(&w->blocks, file_information.st_blocks);
+            }
+
+            if (!S_ISDIR(file_information.st_mode))
+            {
+                continue;
+            }
+
             //allocate memory for file_name and add null terminator to the first bit.
             char *file_name = malloc(sizeof(*file_name)*PATH_MAX);
 
@@ -210,53 +569,103 @@ void dir_check(const char *target_dir, data *d)
             strcat(file_name, direntp->d_name);
 
             //add target to queue.
-            queue_enqueue(d->queue, file_name);
+            queue_enqueue(d->queue, node_new(file_name, node));
         }
 
         closedir(dir);
     }
+
+    return size;
 }
 
 /**
  * @brief Function that checks the target size.
  * 
- * @param ptr target to check
+ * @param ptr the worker of the thread
  * @return void* 
  */
 void *check_target(void *ptr)
 {   
-    data *d = ptr;
+    worker *w = ptr;
+    data *d = w->d;
     int *size = malloc(sizeof(*size));
     *size = 0;
-    mode_t mode_of_target;
-    char *target;
+    struct stat file_information;
+    long long total;
+    dir_node *node;
 
     //loop to check if the target is a file or a directory.
     while (!queue_is_done(d->queue, &d->semaphore, d->number_of_threads))
     {   
-        sem_wait(&d->semaphore);
+        //sem_wait is interrupted by the stop signals even with SA_RESTART.
+        while (sem_wait(&d->semaphore) < 0 && errno == EINTR)
+        {
+            continue;
+        }
 
         //get the target from queue.
-        target = queue_dequeue(d->queue);
-        if(target != NULL) 
+        node = queue_dequeue(d->queue);
+
+        //when the time is up the queue is only emptied.
+        if (node != NULL && atomic_load_explicit(&d->stop, memory_order_relaxed))
         {
-            //check the target mode
-            mode_of_target = check_target_mode(target);
+            atomic_store_explicit(&d->partial, true, memory_order_relaxed);
+            atomic_store(&node->incomplete, true);
+        }
+        else if (node != NULL && check_target_stat(node, &file_information, w)) 
+        {
+            counter_add(&w->entries, 1);
+
+            //a directory finished by an earlier scan and not modified since
+            //is not read again.
+            if (S_ISDIR(file_information.st_mode) && d->checkpoint != NULL
+                && checkpoint_lookup(d->checkpoint, node->path, &file_information.st_mtim, &total))
+            {
+                node->from_checkpoint = true;
+                atomic_fetch_add(&node->total, total);
+                *size += total;
+                counter_add(&w->blocks, total);
 
+                //the directories below it are in the snapshot all the same.
+                if (d->snapshot != NULL)
+                {
+                    pthread_mutex_lock(&d->mutex);
+                    checkpoint_replay(d->checkpoint, node->path, d->snapshot);
+                    pthread_mutex_unlock(&d->mutex);
+                }
+            }
             //if target is a file or a symbolic link.
-            if (S_ISREG(mode_of_target) || S_ISLNK(mode_of_target))
+            else if (S_ISREG(file_information.st_mode) || S_ISLNK(file_information.st_mode))
             {
-                *size += check_target_size(target);        
+                *size += file_information.st_blocks;        
+                counter_add(&w->blocks, file_information.st_blocks);
+                atomic_fetch_add(&node->total, file_information.st_blocks);
             }
 
             //if target is a directory .
-            if (S_ISDIR(mode_of_target))
+            else if (S_ISDIR(file_information.st_mode))
             {
-                dir_check(target, d);
-                *size += check_target_size(target);  
+                node->mtime = file_information.st_mtim;
+                counter_add(&w->blocks, file_information.st_blocks);
+
+                int dir_size = file_information.st_blocks + dir_check(node, w);
+                node->blocks = dir_size;
+                *size += dir_size;
+                atomic_fetch_add(&node->total, dir_size);
+
+                //record the directory total for --snapshot.
+                if (d->snapshot != NULL)
+                {
+                    pthread_mutex_lock(&d->mutex);
+                    snapshot_add(d->snapshot, node->path, dir_size);
+                    pthread_mutex_unlock(&d->mutex);
+                }
             }
+        }
 
-            free(target);
+        if (node != NULL)
+        {
+            node_release(node, d);
         }
 
         sem_post(&d->semaphore);
@@ -280,7 +689,7 @@ int thread_maker(data *d)
     //create threads
     for (int i = 0; i < d->number_of_threads; i++) 
     {   
-        if (pthread_create(&thread[i], NULL, *check_target, d) != 0)
+        if (pthread_create(&thread[i], NULL, *check_target, &d->workers[i]) != 0)
         {
             perror("Thread create failed!");
             exit(EXIT_FAILURE);
@@ -310,12 +719,264 @@ int thread_maker(data *d)
  */
 void mutex_init(data *d)
 {
+    pthread_condattr_t attributes;
+
     //init of mutex 
-	if (pthread_mutex_init(&d->mutex, NULL) != 0) 
+	if (pthread_mutex_init(&d->mutex, NULL) != 0 || pthread_mutex_init(&d->monitor_mutex, NULL) != 0) 
 	{
 		perror("Mutex failed!");
 		exit(EXIT_FAILURE);
 	}
+
+    //the monitor sleeps on a monotonic clock so the time limit is not affected by clock changes.
+    if (pthread_condattr_init(&attributes) != 0 
+        || pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC) != 0
+        || pthread_cond_init(&d->monitor_condition, &attributes) != 0)
+    {
+        perror("Condition failed!");
+        exit(EXIT_FAILURE);
+    }
+    pthread_condattr_destroy(&attributes);
+}
+
+/**
+ * @brief Function that adds to a counter of a worker. Only the owning thread
+ *        writes to the counter, so a relaxed load and store is enough and the
+ *        scan does not pay for a locked add.
+ * 
+ * @param counter counter to add to
+ * @param value value to add
+ */
+void counter_add(atomic_llong *counter, long long value)
+{
+    long long old = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, old + value, memory_order_relaxed);
+}
+
+/**
+ * @brief Function that prints one progress line to stderr.
+ * 
+ * @param d data structure
+ * @param last_entries entries at the last line, updated
+ * @param last_time time of the last line
+ */
+void print_progress(data *d, long long *last_entries, const struct timespec *last_time)
+{
+    struct timespec now;
+    long long entries = 0;
+    long long blocks = 0;
+    long long skipped = 0;
+
+    //sum the counters of all workers.
+    for (int i = 0; i < d->number_of_threads; i++)
+    {
+        entries += atomic_load_explicit(&d->workers[i].entries, memory_order_relaxed);
+        blocks += atomic_load_explicit(&d->workers[i].blocks, memory_order_relaxed);
+        skipped += atomic_load_explicit(&d->workers[i].skipped, memory_order_relaxed);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - last_time->tv_sec) + (now.tv_nsec - last_time->tv_nsec) / 1e9;
+    double rate = seconds > 0 ? (entries - *last_entries) / seconds : 0;
+
+    fprintf(stderr, "mdu: %lld entries, %.0f entries/s, %.1f MiB, queue %zu, %lld skipped\n", 
+        entries, rate, blocks * 512.0 / (1024 * 1024), queue_length(d->queue), skipped);
+    *last_entries = entries;
+}
+
+/**
+ * @brief Function that runs in its own thread during a scan. It prints the
+ *        progress and stops the scan when the deadline has passed.
+ * 
+ * @param ptr data structure
+ * @return void* 
+ */
+void *monitor(void *ptr)
+{
+    data *d = ptr;
+    long long last_entries = 0;
+    struct timespec last_time;
+    struct timespec wake;
+
+    clock_gettime(CLOCK_MONOTONIC, &last_time);
+
+    pthread_mutex_lock(&d->monitor_mutex);
+    while (!d->scan_done)
+    {
+        //wake up at the next progress line or at the deadline, whichever is first.
+        wake = last_time;
+        wake.tv_nsec += PROGRESS_INTERVAL_NS;
+        wake.tv_sec += wake.tv_nsec / 1000000000L;
+        wake.tv_nsec %= 1000000000L;
+
+        bool at_deadline = d->has_deadline && !atomic_load_explicit(&d->stop, memory_order_relaxed)
+            && (!d->progress || d->deadline.tv_sec < wake.tv_sec 
+            || (d->deadline.tv_sec == wake.tv_sec && d->deadline.tv_nsec < wake.tv_nsec));
+
+        if (at_deadline)
+        {
+            wake = d->deadline;
+        }
+        //nothing left to do but wait for the scan to finish.
+        else if (!d->progress)
+        {
+            pthread_cond_wait(&d->monitor_condition, &d->monitor_mutex);
+            continue;
+        }
+
+        if (pthread_cond_timedwait(&d->monitor_condition, &d->monitor_mutex, &wake) != ETIMEDOUT)
+        {
+            continue;
+        }
+
+        if (at_deadline)
+        {
+            atomic_store_explicit(&d->stop, true, memory_order_relaxed);
+            if (!d->progress)
+            {
+                continue;
+            }
+        }
+
+        if (d->progress)
+        {
+            struct timespec now;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            print_progress(d, &last_entries, &last_time);
+            last_time = now;
+        }
+    }
+    pthread_mutex_unlock(&d->monitor_mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief Function that starts the monitor thread if --progress or
+ *        --time-limit is used.
+ * 
+ * @param d data structure
+ * @param thread the started thread
+ */
+void monitor_start(data *d, pthread_t *thread)
+{
+    d->scan_done = false;
+
+    if (!d->progress && !d->has_deadline)
+    {
+        return;
+    }
+
+    if (pthread_create(thread, NULL, monitor, d) != 0)
+    {
+        perror("Thread create failed!");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function that wakes the monitor thread up and waits for it to stop.
+ * 
+ * @param d data structure
+ * @param thread the monitor thread
+ */
+void monitor_stop(data *d, pthread_t thread)
+{
+    if (!d->progress && !d->has_deadline)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&d->monitor_mutex);
+    d->scan_done = true;
+    pthread_cond_signal(&d->monitor_condition);
+    pthread_mutex_unlock(&d->monitor_mutex);
+
+    if (pthread_join(thread, NULL) != 0)
+    {
+        perror("Thread join failed!");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function that prints the errors the threads collected during the
+ *        scan and how many entries vanished while it ran.
+ * 
+ * @param d data structure
+ */
+void report_errors(data *d)
+{
+    long long skipped = 0;
+
+    for (int i = 0; i < d->number_of_threads; i++)
+    {
+        worker *w = &d->workers[i];
+
+        for (int j = 0; j < w->n_errors; j++)
+        {
+            fprintf(stderr, "%s\n", w->errors[j]);
+            free(w->errors[j]);
+        }
+
+        if (w->dropped_errors > 0)
+        {
+            fprintf(stderr, "mdu: %lld more errors\n", w->dropped_errors);
+        }
+
+        if (w->n_errors > 0 || w->dropped_errors > 0)
+        {
+            d->exit_code = EXIT_FAILURE;
+        }
+
+        skipped += atomic_load(&w->skipped);
+        free(w->errors);
+        w->errors = NULL;
+        w->n_errors = 0;
+        w->dropped_errors = 0;
+    }
+
+    //entries removed during the scan are not errors, but the total misses them.
+    if (skipped > 0)
+    {
+        fprintf(stderr, "mdu: %lld entries vanished during the scan and were skipped\n", skipped);
+    }
+}
+
+/**
+ * @brief Signal handler that stops the scan the same way --time-limit does,
+ *        so an interrupted scan still prints its total and leaves a usable
+ *        checkpoint. A second signal kills the program.
+ * 
+ * @param signal_number the signal
+ */
+void stop_signal_handler(int signal_number)
+{
+    (void)signal_number;
+    atomic_store(&signal_data->stop, true);
+}
+
+/**
+ * @brief Function that installs the handler for SIGINT and SIGTERM.
+ * 
+ * @param d data structure
+ */
+void stop_signal_init(data *d)
+{
+    struct sigaction action;
+
+    signal_data = d;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_signal_handler;
+    action.sa_flags = SA_RESETHAND | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGINT, &action, NULL) < 0 || sigaction(SIGTERM, &action, NULL) < 0)
+    {
+        perror("Sigaction failed!");
+        exit(EXIT_FAILURE);
+    }
 }
 
 /**
@@ -328,6 +989,8 @@ void mutex_init(data *d)
 void add_target(data *d, int argc, char *argv[])
 {
     char *file;
+    pthread_t monitor_thread;
+    int size;
 
     //add targets to queue.
     for (int i = optind; i < argc ; i++)
@@ -343,26 +1006,50 @@ void add_target(data *d, int argc, char *argv[])
 
         //copy argv to file so each target can  be freed after being dequeued.
         file = strdup(argv[i]);
-        queue_enqueue(d->queue, file);
+        queue_enqueue(d->queue, node_new(file, NULL));
+
+        //reset the counters of the workers for this target.
+        for (int j = 0; j < d->number_of_threads; j++)
+        {
+            d->workers[j].d = d;
+            atomic_init(&d->workers[j].entries, 0);
+            atomic_init(&d->workers[j].blocks, 0);
+            atomic_init(&d->workers[j].skipped, 0);
+        }
+
+        atomic_store_explicit(&d->partial, false, memory_order_relaxed);
+        monitor_start(d, &monitor_thread);
 
         if (d->number_of_threads == 1)
         {
             //check if target is a file or directory without threads.
-            int *size = check_target(d);
-            fprintf(stdout, "%d      ", *size);
-            fprintf(stdout, "%s\n", argv[i]);
-            free(size);
+            int *size_catch = check_target(&d->workers[0]);
+            size = *size_catch;
+            free(size_catch);
         }
         else
         {   
             //check if target is a file or directory with threads.
-            int size = thread_maker(d);
-            fprintf(stdout, "%d      ", size);
+            size = thread_maker(d);
+        }
+
+        monitor_stop(d, monitor_thread);
+        report_errors(d);
+
+        fprintf(stdout, "%d      ", size);
+
+        //a scan stopped by --time-limit is marked so it is not mistaken for a total.
+        if (atomic_load_explicit(&d->partial, memory_order_relaxed))
+        {
+            fprintf(stdout, "%s (partial)\n", argv[i]);
+            d->exit_code = EXIT_FAILURE;
+        }
+        else
+        {
             fprintf(stdout, "%s\n", argv[i]);
         }
 
         queue_kill(d->queue);
         sem_destroy(&d->semaphore);
-        pthread_mutex_destroy(&d->mutex);
     }
 }
\ No newline at end of file
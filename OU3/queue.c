@@ -24,6 +24,7 @@
 
 struct queue {
 	list *elements;
+	size_t length;
 };
 
 pthread_mutex_t mutex;
@@ -127,6 +128,7 @@ void queue_enqueue(queue *q, void *v)
 
 	//insert to queue
 	list_insert(q->elements, v, list_end(q->elements));
+	q->length++;
 
 	//send signal 
 	pthread_cond_signal(&condition);
@@ -136,19 +138,38 @@ void queue_enqueue(queue *q, void *v)
 
 }
 
+/**
+ * @brief Function that returns the number of elements in the queue.
+ * 
+ * @param q queue to check
+ * @return number of elements
+ */
+size_t queue_length(const queue *q)
+{
+	//lock mutex
+	pthread_mutex_lock(&mutex);
+
+	size_t length = q->length;
+
+	//unlock mutex
+	pthread_mutex_unlock(&mutex);
+
+	return length;
+}
+
 /**
  * @brief Function that removes the first element from the queue.
  * 
  * @param q queue to manipuliate
- * @return char* 
+ * @return the element, or NULL if the queue is empty
  */
-char *queue_dequeue(queue *q)
+void *queue_dequeue(queue *q)
 {	
 	
 	//lock mutex
 	pthread_mutex_lock(&mutex);
 
-	char *file = NULL;
+	void *file = NULL;
 	if(!list_is_empty(q->elements)) 
 	{
 		//get the element from the queue.
@@ -156,6 +177,7 @@ char *queue_dequeue(queue *q)
 
 		//remove from queue.
 		list_remove(q->elements, list_first(q->elements));
+		q->length--;
 	}
 
 	//unlock mutex
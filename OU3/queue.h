@@ -3,6 +3,7 @@
 
 #include <semaphore.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "util.h"
 
@@ -41,13 +42,21 @@ bool queue_is_done(const queue *q, sem_t *semaphore, int number_of_threads);
  */
 void queue_enqueue(queue *q, void *v);
 
+/**
+ * @brief Function that returns the number of elements in the queue.
+ * 
+ * @param q queue to check
+ * @return number of elements
+ */
+size_t queue_length(const queue *q);
+
 /**
  * @brief Function that removes the first element from the queue.
  * 
  * @param q queue to manipuliate
- * @return char* 
+ * @return the element, or NULL if the queue is empty
  */
-char *queue_dequeue(queue *q);
+void *queue_dequeue(queue *q);
 
 /**
  * queue_kill() - Destroy a given queue.
@@ -0,0 +1,509 @@
+/**
+ * @file snapshot.c
+ * @author Jaffar El-Tai (hed20jei)
+ * @brief implimentation of snapshot files with per-directory totals.
+ * @version 1
+ * @date 2021-10-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "MDUSNAP1"
+#define SNAPSHOT_MAGIC_LENGTH 8
+#define SNAPSHOT_BUFFER_SIZE (1 << 20)
+
+// ===========INTERNAL DATA TYPES============
+
+/*
+ * The records are collected in a growing array while scanning and sorted
+ * once before they are written. Reading is done one record at a time so a
+ * diff never holds more than the current record of each file in memory.
+ */
+
+typedef struct record
+{
+	uint64_t hash;
+	int64_t blocks;
+	char *path;
+} record;
+
+struct snapshot
+{
+	record *records;
+	size_t count;
+	size_t capacity;
+};
+
+typedef struct reader
+{
+	FILE *fp;
+	const char *file_name;
+	uint64_t remaining;
+	bool valid;
+	uint64_t hash;
+	int64_t blocks;
+	char *path;
+	size_t path_capacity;
+	char *previous_path;
+	size_t previous_capacity;
+} reader;
+
+typedef struct change
+{
+	int64_t key;
+	int64_t delta;
+	int64_t old_blocks;
+	int64_t new_blocks;
+	char *path;
+} change;
+
+// ===========INTERNAL FUNCTION IMPLEMENTATIONS============
+
+/**
+ * @brief Function that compares two keys, first by hash and then by path.
+ *
+ * @return negative, zero or positive like strcmp
+ */
+static int compare_keys(uint64_t hash_a, const char *path_a, uint64_t hash_b, const char *path_b)
+{
+	if (hash_a != hash_b)
+	{
+		return hash_a < hash_b ? -1 : 1;
+	}
+
+	return strcmp(path_a, path_b);
+}
+
+/**
+ * @brief qsort callback for records.
+ */
+static int compare_records(const void *a, const void *b)
+{
+	const record *ra = a;
+	const record *rb = b;
+
+	return compare_keys(ra->hash, ra->path, rb->hash, rb->path);
+}
+
+/**
+ * @brief Function that hashes a path with 64 bit FNV-1a, the hash the
+ *        records are sorted by.
+ *
+ * @param path path to hash
+ * @return the hash
+ */
+uint64_t snapshot_path_hash(const char *path)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (const unsigned char *p = (const unsigned char *)path; *p != '\0'; p++)
+	{
+		hash ^= *p;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Function that creates an empty snapshot.
+ *
+ * @return snapshot* that was created
+ */
+snapshot *snapshot_empty(void)
+{
+	snapshot *s = calloc(1, sizeof(*s));
+
+	if (s == NULL)
+	{
+		perror("Failed to allocate");
+		exit(EXIT_FAILURE);
+	}
+
+	return s;
+}
+
+/**
+ * @brief Function that adds the total of one directory to the snapshot. Not
+ *        thread safe, the caller has to hold a lock when scanning in parallel.
+ *
+ * @param s snapshot to add to
+ * @param path path of the directory
+ * @param blocks blocks used by the directory itself and the files directly in it
+ */
+void snapshot_add(snapshot *s, const char *path, int64_t blocks)
+{
+	//grow the array when it is full.
+	if (s->count == s->capacity)
+	{
+		size_t capacity = s->capacity == 0 ? 1024 : s->capacity * 2;
+		record *records = realloc(s->records, capacity * sizeof(*records));
+
+		if (records == NULL)
+		{
+			perror("Failed to allocate");
+			exit(EXIT_FAILURE);
+		}
+
+		s->records = records;
+		s->capacity = capacity;
+	}
+
+	record *r = &s->records[s->count];
+	r->path = strdup(path);
+
+	if (r->path == NULL)
+	{
+		perror("Failed to allocate");
+		exit(EXIT_FAILURE);
+	}
+
+	r->hash = snapshot_path_hash(path);
+	r->blocks = blocks;
+	s->count++;
+}
+
+/**
+ * @brief Function that sorts the snapshot and writes it to a file.
+ *
+ * @param s snapshot to write
+ * @param file_name file to write to
+ * @return 0 on success, -1 on failure
+ */
+int snapshot_write(snapshot *s, const char *file_name)
+{
+	qsort(s->records, s->count, sizeof(*s->records), compare_records);
+
+	//remove duplicates, a path can be scanned twice if it is given twice.
+	size_t unique = 0;
+	for (size_t i = 0; i < s->count; i++)
+	{
+		if (unique > 0 && compare_records(&s->records[unique - 1], &s->records[i]) == 0)
+		{
+			free(s->records[i].path);
+			continue;
+		}
+		s->records[unique++] = s->records[i];
+	}
+	s->count = unique;
+
+	FILE *fp = fopen(file_name, "wb");
+
+	if (fp == NULL)
+	{
+		perror(file_name);
+		return -1;
+	}
+
+	setvbuf(fp, NULL, _IOFBF, SNAPSHOT_BUFFER_SIZE);
+
+	uint64_t count = s->count;
+	fwrite(SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LENGTH, fp);
+	fwrite(&count, sizeof(count), 1, fp);
+
+	for (size_t i = 0; i < s->count; i++)
+	{
+		uint32_t path_len = strlen(s->records[i].path);
+
+		fwrite(&s->records[i].hash, sizeof(s->records[i].hash), 1, fp);
+		fwrite(&s->records[i].blocks, sizeof(s->records[i].blocks), 1, fp);
+		fwrite(&path_len, sizeof(path_len), 1, fp);
+		fwrite(s->records[i].path, 1, path_len, fp);
+	}
+
+	//fclose flushes, so both have to be checked.
+	if (ferror(fp) | fclose(fp))
+	{
+		perror(file_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Function that destroys a snapshot and frees its memory.
+ *
+ * @param s snapshot to destroy
+ */
+void snapshot_kill(snapshot *s)
+{
+	for (size_t i = 0; i < s->count; i++)
+	{
+		free(s->records[i].path);
+	}
+
+	free(s->records);
+	free(s);
+}
+
+/**
+ * @brief Function that opens a snapshot file and reads its header.
+ *
+ * @param r reader to initialize
+ * @param file_name file to open
+ * @return true if the file is a snapshot
+ */
+static bool reader_open(reader *r, const char *file_name)
+{
+	char magic[SNAPSHOT_MAGIC_LENGTH];
+
+	memset(r, 0, sizeof(*r));
+	r->file_name = file_name;
+
+	if ((r->fp = fopen(file_name, "rb")) == NULL)
+	{
+		perror(file_name);
+		return false;
+	}
+
+	setvbuf(r->fp, NULL, _IOFBF, SNAPSHOT_BUFFER_SIZE);
+
+	if (fread(magic, 1, sizeof(magic), r->fp) != sizeof(magic)
+		|| memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0
+		|| fread(&r->remaining, sizeof(r->remaining), 1, r->fp) != 1)
+	{
+		fprintf(stderr, "%s: not an mdu snapshot\n", file_name);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Function that reads the next record and checks that the file is
+ *        still sorted.
+ *
+ * @param r reader to advance
+ * @return false if the file is truncated or out of order
+ */
+static bool reader_next(reader *r)
+{
+	uint64_t previous_hash = r->hash;
+	bool had_previous = r->valid;
+	uint32_t path_len;
+
+	if (r->remaining == 0)
+	{
+		r->valid = false;
+		return true;
+	}
+
+	if (fread(&r->hash, sizeof(r->hash), 1, r->fp) != 1
+		|| fread(&r->blocks, sizeof(r->blocks), 1, r->fp) != 1
+		|| fread(&path_len, sizeof(path_len), 1, r->fp) != 1)
+	{
+		fprintf(stderr, "%s: truncated snapshot\n", r->file_name);
+		return false;
+	}
+
+	//swap buffers so the previous path is kept for the order check.
+	char *path = r->previous_path;
+	size_t capacity = r->previous_capacity;
+	r->previous_path = r->path;
+	r->previous_capacity = r->path_capacity;
+	r->path = path;
+	r->path_capacity = capacity;
+
+	if (path_len + 1 > r->path_capacity)
+	{
+		r->path_capacity = path_len + 1;
+		if ((r->path = realloc(r->path, r->path_capacity)) == NULL)
+		{
+			perror("Failed to allocate");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (fread(r->path, 1, path_len, r->fp) != path_len)
+	{
+		fprintf(stderr, "%s: truncated snapshot\n", r->file_name);
+		return false;
+	}
+	r->path[path_len] = '\0';
+
+	if (had_previous && compare_keys(previous_hash, r->previous_path, r->hash, r->path) >= 0)
+	{
+		fprintf(stderr, "%s: snapshot is not sorted\n", r->file_name);
+		return false;
+	}
+
+	r->valid = true;
+	r->remaining--;
+	return true;
+}
+
+/**
+ * @brief Function that closes a reader and frees its memory.
+ *
+ * @param r reader to close
+ */
+static void reader_close(reader *r)
+{
+	if (r->fp != NULL)
+	{
+		fclose(r->fp);
+	}
+	free(r->path);
+	free(r->previous_path);
+}
+
+/**
+ * @brief Function that keeps the changes with the largest key in a sorted
+ *        list of at most top entries.
+ *
+ * @param list list sorted by descending key
+ * @param n number of entries in list
+ * @param top maximum number of entries
+ * @param key value to sort on
+ * @param c change to offer, its path is copied if it is kept
+ */
+static void offer_change(change *list, int *n, int top, int64_t key, const change *c)
+{
+	//most changes are too small to be kept, so check the last entry first.
+	if (key <= 0 || (*n == top && key <= list[top - 1].key))
+	{
+		return;
+	}
+
+	int i = *n < top ? (*n)++ : top - 1;
+
+	free(list[i].path);
+	while (i > 0 && key > list[i - 1].key)
+	{
+		list[i] = list[i - 1];
+		i--;
+	}
+
+	list[i] = *c;
+	list[i].key = key;
+	if ((list[i].path = strdup(c->path)) == NULL)
+	{
+		perror("Failed to allocate");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Function that prints and frees a list of changes.
+ *
+ * @param title heading of the list
+ * @param list list to print
+ * @param n number of entries in list
+ */
+static void print_changes(const char *title, change *list, int n)
+{
+	fprintf(stdout, "%s:\n", title);
+
+	for (int i = 0; i < n; i++)
+	{
+		const char *note = "";
+
+		if (list[i].old_blocks == 0)
+		{
+			note = " (new)";
+		}
+		else if (list[i].new_blocks == 0)
+		{
+			note = " (removed)";
+		}
+
+		fprintf(stdout, "%+" PRId64 "      %s%s\n", list[i].delta, list[i].path, note);
+		free(list[i].path);
+	}
+}
+
+/**
+ * @brief Function that merge-joins two snapshot files and prints the
+ *        directories that grew and shrunk the most from old to new. Only a
+ *        fixed number of records is kept in memory.
+ *
+ * @param old_file snapshot taken first
+ * @param new_file snapshot taken last
+ * @param top number of growers and shrinkers to print
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int snapshot_diff(const char *old_file, const char *new_file, int top)
+{
+	reader a = {0};
+	reader b = {0};
+	int exit_code = EXIT_FAILURE;
+	change *growers = calloc(top, sizeof(*growers));
+	change *shrinkers = calloc(top, sizeof(*shrinkers));
+	int n_growers = 0;
+	int n_shrinkers = 0;
+
+	if (growers == NULL || shrinkers == NULL)
+	{
+		perror("Failed to allocate");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!reader_open(&a, old_file) || !reader_open(&b, new_file)
+		|| !reader_next(&a) || !reader_next(&b))
+	{
+		goto out;
+	}
+
+	//walk both files in key order, a key missing on one side counts as 0.
+	while (a.valid || b.valid)
+	{
+		int cmp;
+		change c;
+
+		if (!a.valid)
+		{
+			cmp = 1;
+		}
+		else if (!b.valid)
+		{
+			cmp = -1;
+		}
+		else
+		{
+			cmp = compare_keys(a.hash, a.path, b.hash, b.path);
+		}
+
+		c.old_blocks = cmp <= 0 ? a.blocks : 0;
+		c.new_blocks = cmp >= 0 ? b.blocks : 0;
+		c.path = cmp <= 0 ? a.path : b.path;
+		c.delta = c.new_blocks - c.old_blocks;
+
+		offer_change(growers, &n_growers, top, c.delta, &c);
+		offer_change(shrinkers, &n_shrinkers, top, -c.delta, &c);
+
+		if ((cmp <= 0 && !reader_next(&a)) || (cmp >= 0 && !reader_next(&b)))
+		{
+			goto out;
+		}
+	}
+
+	print_changes("Top growers", growers, n_growers);
+	print_changes("Top shrinkers", shrinkers, n_shrinkers);
+	n_growers = 0;
+	n_shrinkers = 0;
+	exit_code = EXIT_SUCCESS;
+
+out:
+	for (int i = 0; i < n_growers; i++)
+	{
+		free(growers[i].path);
+	}
+	for (int i = 0; i < n_shrinkers; i++)
+	{
+		free(shrinkers[i].path);
+	}
+	free(growers);
+	free(shrinkers);
+	reader_close(&a);
+	reader_close(&b);
+	return exit_code;
+}
@@ -0,0 +1,76 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <stdint.h>
+
+// ==========PUBLIC DATA TYPES============
+
+/*
+ * A snapshot file is a header followed by one record per directory, sorted
+ * by (hash, path) so that two snapshots can be merge-joined in one pass.
+ * All integers are stored in host byte order.
+ *
+ *	header: char magic[8] ("MDUSNAP1"), uint64_t count
+ *	record: uint64_t hash, int64_t blocks, uint32_t path_len, path bytes
+ */
+
+// Snapshot type.
+typedef struct snapshot snapshot;
+
+// ==========DATA STRUCTURE INTERFACE==========
+
+/**
+ * @brief Function that hashes a path with 64 bit FNV-1a, the hash the
+ *        records are sorted by.
+ *
+ * @param path path to hash
+ * @return the hash
+ */
+uint64_t snapshot_path_hash(const char *path);
+
+/**
+ * @brief Function that creates an empty snapshot.
+ *
+ * @return snapshot* that was created
+ */
+snapshot *snapshot_empty(void);
+
+/**
+ * @brief Function that adds the total of one directory to the snapshot. Not
+ *        thread safe, the caller has to hold a lock when scanning in parallel.
+ *
+ * @param s snapshot to add to
+ * @param path path of the directory
+ * @param blocks blocks used by the directory itself and the files directly in it
+ */
+void snapshot_add(snapshot *s, const char *path, int64_t blocks);
+
+/**
+ * @brief Function that sorts the snapshot and writes it to a file.
+ *
+ * @param s snapshot to write
+ * @param file_name file to write to
+ * @return 0 on success, -1 on failure
+ */
+int snapshot_write(snapshot *s, const char *file_name);
+
+/**
+ * @brief Function that destroys a snapshot and frees its memory.
+ *
+ * @param s snapshot to destroy
+ */
+void snapshot_kill(snapshot *s);
+
+/**
+ * @brief Function that merge-joins two snapshot files and prints the
+ *        directories that grew and shrunk the most from old to new. Only a
+ *        fixed number of records is kept in memory.
+ *
+ * @param old_file snapshot taken first
+ * @param new_file snapshot taken last
+ * @param top number of growers and shrinkers to print
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int snapshot_diff(const char *old_file, const char *new_file, int top);
+
+#endif